@@ -0,0 +1,219 @@
+# End-to-end benchmark of ./main over a fixed matrix of graphs, thread
+# counts and population sizes, every run with a fixed seed.
+#
+# Usage: sh bench.sh run [name]
+#          Runs the matrix and writes name.csv and name.json (name
+#          defaults to bench).
+#        sh bench.sh compare old.csv new.csv [tolerance]
+#          Flags every cell of new.csv that got more than tolerance
+#          percent (default 5) worse than in old.csv, and exits with 1
+#          if any did.
+#        sh bench.sh placement [threads]
+#          Runs the first graph of the matrix with the largest
+#          population, once with --placement off and once pinned, under
+#          perf stat, and prints how many of the memory loads were
+#          served by a remote NUMA node (threads defaults to nproc).
+#
+# The matrix can be changed through the environment, for example
+#   THREADS="1 2 4 8" REPETITIONS=5 sh bench.sh run
+# GRAPHS holds kind:argument:target triples, where kind is the main
+# flag (generate, file or points) and target the fitness whose time to
+# reach is measured. Repetition r runs with --seed r. FLAGS are passed
+# on to every run, for example FLAGS="--placement pinned".
+#
+# Every cell reports the means over the repetitions of generations and
+# children per second, run time, best fitness and the time to the
+# target (over the runs that reached it, -1 if none did), and the
+# scaling efficiency: children per second per thread, relative to the
+# single thread run of the same graph and population.
+GRAPHS=${GRAPHS:-"generate:300:1600 file:graph.txt:2000"}
+THREADS=${THREADS:-"1 2 4"}
+POPULATIONS=${POPULATIONS:-"1000 4000"}
+REPETITIONS=${REPETITIONS:-3}
+SAME=${SAME:-10}
+FLAGS=${FLAGS:-}
+
+run() {
+	name=${1:-bench}
+	raw=$(mktemp)
+	for graph in $GRAPHS
+	do
+		kind=${graph%%:*}
+		rest=${graph#*:}
+		argument=${rest%%:*}
+		target=${rest#*:}
+		for population in $POPULATIONS
+		do
+			for threads in $THREADS
+			do
+				repetition=1
+				while [ $repetition -le $REPETITIONS ]
+				do
+					if ! ./main $threads $population $SAME --$kind $argument \
+						--seed $repetition --target $target $FLAGS > /dev/null
+					then
+						echo "run failed: $threads $population --$kind $argument" >&2
+						rm -f $raw
+						exit 1
+					fi
+					# threads population iterations time best children/s to-target
+					head -1 stats.txt | awk -v graph="$kind:$argument" \
+						'{print graph, $1, $2, $5, $6, $7, $8, $9}' >> $raw
+					repetition=$((repetition + 1))
+				done
+			done
+		done
+	done
+	awk -v csv="$name.csv" -v json="$name.json" -v same=$SAME '
+	{
+		key = $1 " " $2 " " $3
+		if (!(key in runs))
+			order[cells++] = key
+		graph[key] = $1
+		threads[key] = $2
+		population[key] = $3
+		runs[key]++
+		generations[key] += $4 / $5
+		children[key] += $7
+		time[key] += $5
+		best[key] += $6
+		if ($8 >= 0) {
+			reached[key]++
+			to_target[key] += $8
+		}
+	}
+	END {
+		print "graph,threads,population,repetitions,generations_per_second," \
+			"children_per_second,time,best,time_to_target,reached,efficiency" > csv
+		printf "{\n  \"same_fitness_for\": %d,\n  \"results\": [", same > json
+		for (i = 0; i < cells; ++i) {
+			key = order[i]
+			n = runs[key]
+			single = graph[key] " 1 " population[key]
+			efficiency = -1
+			if (single in runs)
+				efficiency = children[key] * runs[single] / \
+					(threads[key] * children[single] * n)
+			target = reached[key] ? to_target[key] / reached[key] : -1
+			printf "%s,%d,%d,%d,%.3f,%.1f,%.4f,%.1f,%.4f,%d,%.3f\n", graph[key],
+				threads[key], population[key], n, generations[key] / n,
+				children[key] / n, time[key] / n, best[key] / n, target,
+				reached[key], efficiency > csv
+			printf "%s\n    {\"graph\": \"%s\", \"threads\": %d, \"population\": %d, " \
+				"\"repetitions\": %d, \"generations_per_second\": %.3f, " \
+				"\"children_per_second\": %.1f, \"time\": %.4f, \"best\": %.1f, " \
+				"\"time_to_target\": %.4f, \"reached\": %d, \"efficiency\": %.3f}",
+				i ? "," : "", graph[key], threads[key], population[key], n,
+				generations[key] / n, children[key] / n, time[key] / n,
+				best[key] / n, target, reached[key], efficiency > json
+		}
+		printf "\n  ]\n}\n" > json
+	}' $raw
+	rm -f $raw
+	cat $name.csv
+}
+
+compare() {
+	if [ ! -f "$1" ] || [ ! -f "$2" ]
+	then
+		echo "usage: sh bench.sh compare old.csv new.csv [tolerance]" >&2
+		exit 2
+	fi
+	awk -F, -v tolerance=${3:-5} '
+	# Percent by which |new| is worse than |old|, higher being better
+	# if |higher|.
+	function worse(old, new, higher) {
+		if (old == 0)
+			return 0
+		return (higher ? old - new : new - old) * 100 / old
+	}
+	function check(metric, old, new, higher,    change) {
+		change = worse(old, new, higher)
+		printf "%-24s %2d %7d %-22s %12.4f %12.4f %+7.1f%%%s\n", $1, $2, $3,
+			metric, old, new, (change ? -change : 0), (change > tolerance ? "  REGRESSION" : "")
+		if (change > tolerance)
+			++regressions
+	}
+	FNR == 1 { next }
+	NR == FNR {
+		key = $1 " " $2 " " $3
+		old_generations[key] = $5
+		old_children[key] = $6
+		old_best[key] = $8
+		old_target[key] = $9
+		next
+	}
+	{
+		key = $1 " " $2 " " $3
+		if (!(key in old_children)) {
+			printf "%-24s %2d %7d not in the old results\n", $1, $2, $3
+			next
+		}
+		check("generations_per_second", old_generations[key], $5, 1)
+		check("children_per_second", old_children[key], $6, 1)
+		check("best", old_best[key], $8, 0)
+		if (old_target[key] >= 0 && $9 < 0) {
+			printf "%-24s %2d %7d %-22s %12.4f %12s  REGRESSION\n", $1, $2, $3,
+				"time_to_target", old_target[key], "not reached"
+			++regressions
+		} else if (old_target[key] >= 0) {
+			check("time_to_target", old_target[key], $9, 0)
+		}
+	}
+	END {
+		printf "%d regressions over %s%%\n", regressions + 0, tolerance
+		exit (regressions > 0)
+	}' "$1" "$2"
+}
+
+placement() {
+	if ! command -v perf > /dev/null
+	then
+		echo "placement needs perf" >&2
+		exit 2
+	fi
+	threads=${1:-$(nproc)}
+	graph=${GRAPHS%% *}
+	kind=${graph%%:*}
+	rest=${graph#*:}
+	argument=${rest%%:*}
+	population=${POPULATIONS##* }
+	out=$(mktemp)
+	for mode in off pinned
+	do
+		if ! perf stat -x, -e node-loads,node-load-misses -o $out ./main $threads \
+			$population $SAME --$kind $argument --seed 1 --placement $mode $FLAGS \
+			> /dev/null
+		then
+			echo "run failed: --placement $mode" >&2
+			rm -f $out
+			exit 1
+		fi
+		# Node load misses are the loads a remote node had to serve.
+		awk -F, -v mode=$mode '
+		$3 ~ /^node-loads/ { loads = $1 }
+		$3 ~ /^node-load-misses/ { misses = $1 }
+		END {
+			printf "%-6s %s node loads, %s remote (%.1f%%)\n", mode, loads, misses,
+				(loads > 0 ? misses * 100 / loads : 0)
+		}' $out
+	done
+	rm -f $out
+}
+
+case $1 in
+run)
+	run $2
+	;;
+compare)
+	compare $2 $3 $4
+	;;
+placement)
+	placement $2
+	;;
+*)
+	echo "usage: sh bench.sh run [name] | compare old.csv new.csv [tolerance]" \
+		"| placement [threads]" >&2
+	exit 2
+	;;
+esac
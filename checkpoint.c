@@ -0,0 +1,209 @@
+#include "checkpoint.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define kCheckpointMagic "TSPSTATE"
+const uint32_t kCheckpointVersion = 1;
+const uint32_t kCheckpointByteOrder = 0x01020304u;
+
+typedef struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t city_size;
+  uint32_t length;
+  uint64_t count;
+  uint64_t seed;
+  uint64_t next_stream;
+  uint64_t iterations;
+  uint64_t children;
+  uint64_t same_best_for;
+  double time;
+  int32_t best_fitness;
+  uint32_t reserved;
+} CheckpointHeader;
+
+void CheckpointInit(Checkpoint* self, size_t count, size_t length) {
+  memset(self, 0, sizeof(Checkpoint));
+  self->count = count;
+  self->length = length;
+  self->tours = malloc(count * length * sizeof(City));
+  self->fitness = malloc(count * sizeof(int));
+  self->best_path = malloc(length * sizeof(City));
+  assert(self->tours && self->fitness && self->best_path);
+}
+
+void CheckpointDestroy(Checkpoint* self) {
+  free(self->tours);
+  free(self->fitness);
+  free(self->best_path);
+}
+
+int CheckpointSave(const Checkpoint* self, const char* path) {
+  CheckpointHeader header;
+  // Written next to the checkpoint and renamed over it once complete.
+  size_t temp_size = strlen(path) + 5;
+  char* temp = malloc(temp_size);
+  FILE* file;
+  int failed;
+  assert(temp);
+  snprintf(temp, temp_size, "%s.tmp", path);
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kCheckpointMagic, sizeof(header.magic));
+  header.version = kCheckpointVersion;
+  header.byte_order = kCheckpointByteOrder;
+  header.city_size = sizeof(City);
+  header.length = self->length;
+  header.count = self->count;
+  header.seed = self->seed;
+  header.next_stream = self->next_stream;
+  header.iterations = self->iterations;
+  header.children = self->children;
+  header.same_best_for = self->same_best_for;
+  header.time = self->time;
+  header.best_fitness = self->best_fitness;
+  file = fopen(temp, "wb");
+  if (!file) {
+    fprintf(stderr, "cannot open %s for writing\n", temp);
+    free(temp);
+    return -1;
+  }
+  failed =
+      fwrite(&header, sizeof(header), 1, file) != 1 ||
+      fwrite(self->tours, sizeof(City), self->count * self->length, file) !=
+          self->count * self->length ||
+      fwrite(self->fitness, sizeof(int), self->count, file) != self->count ||
+      fwrite(self->best_path, sizeof(City), self->length, file) !=
+          self->length ||
+      fflush(file) || fsync(fileno(file));
+  failed = fclose(file) || failed;
+  if (failed || rename(temp, path)) {
+    fprintf(stderr, "cannot write checkpoint %s\n", path);
+    unlink(temp);
+    free(temp);
+    return -1;
+  }
+  free(temp);
+  return 0;
+}
+
+int CheckpointLoad(Checkpoint* self, const char* path) {
+  CheckpointHeader header;
+  FILE* file = fopen(path, "rb");
+  int failed;
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return -1;
+  }
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, kCheckpointMagic, sizeof(header.magic))) {
+    fprintf(stderr, "%s is not a checkpoint\n", path);
+    fclose(file);
+    return -1;
+  }
+  if (header.version != kCheckpointVersion ||
+      header.byte_order != kCheckpointByteOrder ||
+      header.city_size != sizeof(City)) {
+    fprintf(stderr, "%s was written by an incompatible build\n", path);
+    fclose(file);
+    return -1;
+  }
+  if (header.length < 2 || header.length > kMaxCities || !header.count) {
+    fprintf(stderr, "%s has a bad header\n", path);
+    fclose(file);
+    return -1;
+  }
+  CheckpointInit(self, header.count, header.length);
+  self->seed = header.seed;
+  self->next_stream = header.next_stream;
+  self->iterations = header.iterations;
+  self->children = header.children;
+  self->same_best_for = header.same_best_for;
+  self->time = header.time;
+  self->best_fitness = header.best_fitness;
+  failed =
+      fread(self->tours, sizeof(City), self->count * self->length, file) !=
+          self->count * self->length ||
+      fread(self->fitness, sizeof(int), self->count, file) != self->count ||
+      fread(self->best_path, sizeof(City), self->length, file) !=
+          self->length;
+  fclose(file);
+  if (failed) {
+    fprintf(stderr, "%s is truncated\n", path);
+    CheckpointDestroy(self);
+    return -1;
+  }
+  return 0;
+}
+
+void* CheckpointWriterThread(void* in) {
+  CheckpointWriter* self = in;
+  pthread_mutex_lock(&self->mutex_);
+  for (;;) {
+    while (!self->pending_ && !self->stop_)
+      pthread_cond_wait(&self->cond_, &self->mutex_);
+    if (!self->pending_)
+      break;
+    // The solver leaves the snapshot alone until |pending_| is clear.
+    pthread_mutex_unlock(&self->mutex_);
+    CheckpointSave(&self->snapshot_, self->path_);
+    pthread_mutex_lock(&self->mutex_);
+    self->pending_ = 0;
+    pthread_cond_broadcast(&self->cond_);
+  }
+  pthread_mutex_unlock(&self->mutex_);
+  return NULL;
+}
+
+int CheckpointWriterInit(CheckpointWriter* self, const char* path,
+                         size_t count, size_t length) {
+  self->path_ = strdup(path);
+  assert(self->path_);
+  pthread_mutex_init(&self->mutex_, NULL);
+  pthread_cond_init(&self->cond_, NULL);
+  self->pending_ = 0;
+  self->stop_ = 0;
+  CheckpointInit(&self->snapshot_, count, length);
+  if (pthread_create(&self->thread_, NULL, CheckpointWriterThread, self)) {
+    fprintf(stderr, "cannot start the checkpoint writer for %s\n", path);
+    pthread_mutex_destroy(&self->mutex_);
+    pthread_cond_destroy(&self->cond_);
+    CheckpointDestroy(&self->snapshot_);
+    free(self->path_);
+    return -1;
+  }
+  return 0;
+}
+
+void CheckpointWriterDestroy(CheckpointWriter* self) {
+  pthread_mutex_lock(&self->mutex_);
+  self->stop_ = 1;
+  pthread_cond_broadcast(&self->cond_);
+  pthread_mutex_unlock(&self->mutex_);
+  pthread_join(self->thread_, NULL);
+  pthread_mutex_destroy(&self->mutex_);
+  pthread_cond_destroy(&self->cond_);
+  CheckpointDestroy(&self->snapshot_);
+  free(self->path_);
+}
+
+Checkpoint* CheckpointWriterBegin(CheckpointWriter* self, int wait) {
+  int busy;
+  pthread_mutex_lock(&self->mutex_);
+  while (wait && self->pending_)
+    pthread_cond_wait(&self->cond_, &self->mutex_);
+  busy = self->pending_;
+  pthread_mutex_unlock(&self->mutex_);
+  return busy ? NULL : &self->snapshot_;
+}
+
+void CheckpointWriterCommit(CheckpointWriter* self) {
+  pthread_mutex_lock(&self->mutex_);
+  self->pending_ = 1;
+  pthread_cond_signal(&self->cond_);
+  pthread_mutex_unlock(&self->mutex_);
+}
@@ -0,0 +1,72 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "population.h"
+
+// Everything the global model needs to carry on with a run from the
+// start of a generation. Random streams are derived from the seed and
+// a stream number (see random_provider.h), so the seed and the next
+// stream number to hand out are the whole generator state.
+typedef struct Checkpoint {
+  uint64_t seed;
+  uint64_t next_stream;
+  uint64_t iterations;
+  uint64_t children;
+  // Generations since the best fitness last improved.
+  uint64_t same_best_for;
+  // Seconds the run has taken so far.
+  double time;
+  int best_fitness;
+  // The parents of the next generation, |count| tours of |length|
+  // cities, and the best tour found so far.
+  size_t count;
+  size_t length;
+  City* tours;
+  int* fitness;
+  City* best_path;
+} Checkpoint;
+
+// Allocate room for |count| tours of |length| cities.
+void CheckpointInit(Checkpoint* self, size_t count, size_t length);
+void CheckpointDestroy(Checkpoint* self);
+
+// Checkpoint files are a header with the magic "TSPSTATE", format
+// version, a byte order mark, the size of a city and the fields above,
+// followed by the tours, their fitness and the best tour, all in host
+// byte order. Both return 0 on success and -1 after printing what
+// went wrong to stderr. |CheckpointLoad| initialises |self|.
+int CheckpointSave(const Checkpoint* self, const char* path);
+int CheckpointLoad(Checkpoint* self, const char* path);
+
+// Writes checkpoints to a file from a thread of its own, so the
+// solver only pays for copying its state into |snapshot_|. The file
+// is replaced atomically, a crash leaves the previous checkpoint.
+typedef struct CheckpointWriter {
+  char* path_;
+  pthread_t thread_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+  // A snapshot is waiting to be written or being written.
+  int pending_;
+  int stop_;
+  Checkpoint snapshot_;
+} CheckpointWriter;
+
+// Returns 0, or -1 if the thread could not be started, which leaves
+// nothing to destroy.
+int CheckpointWriterInit(CheckpointWriter* self, const char* path,
+                         size_t count, size_t length);
+// Writes the last snapshot, if any, before returning.
+void CheckpointWriterDestroy(CheckpointWriter* self);
+
+// The snapshot to fill in, or NULL if the previous one is still being
+// written; then this checkpoint is skipped, unless |wait| is set.
+// Every snapshot returned has to be handed to |CheckpointWriterCommit|.
+Checkpoint* CheckpointWriterBegin(CheckpointWriter* self, int wait);
+void CheckpointWriterCommit(CheckpointWriter* self);
+
+#endif
@@ -0,0 +1,538 @@
+#include "cluster.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "population.h"
+
+// Every message is a type and a payload size (both 32-bit little
+// endian) followed by the payload.
+typedef enum ClusterMessage {
+  // Worker: graph size and migration interval.
+  kMessageHello = 1,
+  // Worker: best fitness, generations, children bred (only known
+  // in the final report) and best tour.
+  kMessageReport,
+  // Coordinator: nothing better is known, carry on.
+  kMessageContinue,
+  // Coordinator: fitness and tour of the global best.
+  kMessageTour,
+  // Coordinator: stop and send the final result.
+  kMessageStop,
+  // Worker: the same as a report, sent once stopped.
+  kMessageFinal,
+} ClusterMessage;
+
+const char* kUnixAddressPrefix = "unix:";
+const size_t kMessageHeaderSize = 8;
+// Fixed part of reports: fitness, generations and children.
+#define kReportSize 20
+// Workers may be started before the coordinator listens.
+const int kConnectAttempts = 100;
+const useconds_t kConnectRetryDelay = 100000;
+
+static void PutU32(uint8_t* out, uint32_t value) {
+  int i;
+  for (i = 0; i < 4; ++i)
+    out[i] = value >> (8 * i);
+}
+
+static uint32_t GetU32(const uint8_t* in) {
+  return in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 |
+         (uint32_t)in[3] << 24;
+}
+
+static void PutU64(uint8_t* out, uint64_t value) {
+  PutU32(out, value);
+  PutU32(out + 4, value >> 32);
+}
+
+static uint64_t GetU64(const uint8_t* in) {
+  return GetU32(in) | (uint64_t)GetU32(in + 4) << 32;
+}
+
+// Bits needed for a city of a graph with |n| cities.
+static size_t CityBits(size_t n) {
+  size_t bits = 1;
+  while (((size_t)1 << bits) < n)
+    ++bits;
+  return bits;
+}
+
+static size_t PackedTourSize(size_t n) {
+  return (n * CityBits(n) + 7) / 8;
+}
+
+static void PackTour(const City* tour, size_t n, uint8_t* out) {
+  size_t bits = CityBits(n);
+  size_t bit = 0;
+  size_t i;
+  memset(out, 0, PackedTourSize(n));
+  for (i = 0; i < n; ++i) {
+    size_t j;
+    for (j = 0; j < bits; ++j, ++bit) {
+      if ((tour[i] >> j) & 1)
+        out[bit / 8] |= 1 << (bit % 8);
+    }
+  }
+}
+
+// Returns 0 if the cities are not a permutation of [0, n).
+static int UnpackTour(const uint8_t* in, size_t n, City* tour) {
+  size_t bits = CityBits(n);
+  size_t bit = 0;
+  uint8_t* seen = calloc(n, 1);
+  size_t i;
+  int valid = 1;
+  assert(seen);
+  for (i = 0; i < n; ++i) {
+    size_t city = 0;
+    size_t j;
+    for (j = 0; j < bits; ++j, ++bit)
+      city |= (size_t)((in[bit / 8] >> (bit % 8)) & 1) << j;
+    if (city >= n || seen[city]) {
+      valid = 0;
+      break;
+    }
+    seen[city] = 1;
+    tour[i] = city;
+  }
+  free(seen);
+  return valid;
+}
+
+static int TourFitness(const City* tour, size_t n, const graph_t* graph) {
+  int fitness = graph_weight_unchecked(graph, tour[n - 1], tour[0]);
+  size_t i;
+  for (i = 1; i < n; ++i)
+    fitness += graph_weight_unchecked(graph, tour[i - 1], tour[i]);
+  return fitness;
+}
+
+static int WriteAll(int fd, const uint8_t* data, size_t size) {
+  while (size) {
+    ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return -1;
+    data += written;
+    size -= written;
+  }
+  return 0;
+}
+
+static int ReadAll(int fd, uint8_t* data, size_t size) {
+  while (size) {
+    ssize_t got = recv(fd, data, size, 0);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return -1;
+    data += got;
+    size -= got;
+  }
+  return 0;
+}
+
+static int SendMessage(int fd, ClusterMessage type, const uint8_t* payload,
+                       size_t size) {
+  uint8_t header[8];
+  PutU32(header, type);
+  PutU32(header + 4, size);
+  if (WriteAll(fd, header, kMessageHeaderSize))
+    return -1;
+  return size ? WriteAll(fd, payload, size) : 0;
+}
+
+// Read one message into |payload|, which holds |capacity| bytes.
+// Returns the type, or -1 on errors and oversized messages.
+static int ReceiveMessage(int fd, uint8_t* payload, size_t capacity,
+                          size_t* size) {
+  uint8_t header[8];
+  if (ReadAll(fd, header, kMessageHeaderSize))
+    return -1;
+  *size = GetU32(header + 4);
+  if (*size > capacity || ReadAll(fd, payload, *size))
+    return -1;
+  return GetU32(header);
+}
+
+// Resolve |address|. Unix addresses fill |un| and set |list| to
+// NULL, TCP ones return a list to be freed with freeaddrinfo.
+static int ResolveAddress(const char* address, int passive,
+                          struct sockaddr_un* un, struct addrinfo** list) {
+  size_t prefix = strlen(kUnixAddressPrefix);
+  if (!strncmp(address, kUnixAddressPrefix, prefix)) {
+    if (strlen(address + prefix) >= sizeof(un->sun_path)) {
+      fprintf(stderr, "cluster: socket path too long: %s\n", address);
+      return -1;
+    }
+    memset(un, 0, sizeof(*un));
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, address + prefix);
+    *list = NULL;
+    return 0;
+  } else {
+    struct addrinfo hints;
+    char host[256];
+    const char* colon = strrchr(address, ':');
+    int error;
+    if (!colon || (size_t)(colon - address) >= sizeof(host)) {
+      fprintf(stderr, "cluster: bad address %s\n", address);
+      return -1;
+    }
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    error = getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, list);
+    if (error) {
+      fprintf(stderr, "cluster: %s: %s\n", address, gai_strerror(error));
+      return -1;
+    }
+    return 0;
+  }
+}
+
+static int Listen(const char* address, size_t backlog) {
+  struct sockaddr_un un;
+  struct addrinfo* list;
+  struct addrinfo* info;
+  int fd = -1;
+  if (ResolveAddress(address, 1, &un, &list))
+    return -1;
+  if (!list) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(un.sun_path);
+    if (fd >= 0 && (bind(fd, (struct sockaddr*)&un, sizeof(un)) ||
+                    listen(fd, backlog))) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  for (info = list; info && fd < 0; info = info->ai_next) {
+    int reuse = 1;
+    fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (fd < 0)
+      continue;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, info->ai_addr, info->ai_addrlen) || listen(fd, backlog)) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (list)
+    freeaddrinfo(list);
+  if (fd < 0)
+    fprintf(stderr, "cluster: cannot listen at %s: %s\n", address,
+            strerror(errno));
+  return fd;
+}
+
+static int Connect(const char* address) {
+  struct sockaddr_un un;
+  struct addrinfo* list;
+  int attempt;
+  int fd = -1;
+  if (ResolveAddress(address, 0, &un, &list))
+    return -1;
+  for (attempt = 0; attempt < kConnectAttempts && fd < 0; ++attempt) {
+    struct addrinfo* info;
+    if (attempt)
+      usleep(kConnectRetryDelay);
+    if (!list) {
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd >= 0 && connect(fd, (struct sockaddr*)&un, sizeof(un))) {
+        close(fd);
+        fd = -1;
+      }
+    }
+    for (info = list; info && fd < 0; info = info->ai_next) {
+      fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+      if (fd >= 0 && connect(fd, info->ai_addr, info->ai_addrlen)) {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+  if (list)
+    freeaddrinfo(list);
+  if (fd < 0) {
+    fprintf(stderr, "cluster: cannot connect to %s: %s\n", address,
+            strerror(errno));
+  } else if (list) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+static double Seconds(void) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec + now.tv_usec / 1.0e6;
+}
+
+typedef struct ClusterWorker {
+  int fd;
+  // Reports since the global best last improved.
+  size_t stale_reports;
+  // Reports that count as |same_fitness_for| generations.
+  size_t stale_limit;
+} ClusterWorker;
+
+int ClusterCoordinate(const char* address, size_t workers,
+                      const graph_t* graph, size_t same_fitness_for,
+                      ShortestPathData* return_data) {
+  size_t n = graph->n;
+  size_t tour_size = PackedTourSize(n);
+  size_t capacity = kReportSize + tour_size;
+  uint8_t* payload = malloc(capacity);
+  City* tour = malloc(n * sizeof(City));
+  City* best = malloc(n * sizeof(City));
+  ClusterWorker* peers = calloc(workers, sizeof(ClusterWorker));
+  struct pollfd* polls = malloc(workers * sizeof(struct pollfd));
+  int best_fitness = INT_MAX;
+  int stopping = 0;
+  size_t alive = 0;
+  size_t i;
+  double begin = Seconds();
+  int listener = Listen(address, workers);
+  assert(payload && tour && best && peers && polls);
+  if (return_data) {
+    return_data->iterations = 0;
+    return_data->children = 0;
+  }
+  if (listener < 0)
+    goto done;
+  // Everybody joins before the run is coordinated.
+  while (alive < workers) {
+    size_t size;
+    ClusterWorker* peer = peers + alive;
+    peer->fd = accept(listener, NULL, NULL);
+    if (peer->fd < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (ReceiveMessage(peer->fd, payload, capacity, &size) != kMessageHello ||
+        size != 8 || GetU32(payload) != n || !GetU32(payload + 4)) {
+      fprintf(stderr, "cluster: a worker sent a bad hello\n");
+      close(peer->fd);
+      continue;
+    }
+    peer->stale_limit =
+        (same_fitness_for + GetU32(payload + 4) - 1) / GetU32(payload + 4);
+    if (!peer->stale_limit)
+      peer->stale_limit = 1;
+    ++alive;
+  }
+  close(listener);
+  if (address && !strncmp(address, kUnixAddressPrefix,
+                          strlen(kUnixAddressPrefix)))
+    unlink(address + strlen(kUnixAddressPrefix));
+  workers = alive;
+  while (alive) {
+    for (i = 0; i < workers; ++i) {
+      polls[i].fd = peers[i].fd;
+      polls[i].events = POLLIN;
+      polls[i].revents = 0;
+    }
+    if (poll(polls, workers, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (i = 0; i < workers; ++i) {
+      ClusterWorker* peer = peers + i;
+      size_t size;
+      int type;
+      int fitness;
+      if (peer->fd < 0 || !polls[i].revents)
+        continue;
+      type = ReceiveMessage(peer->fd, payload, capacity, &size);
+      if ((type != kMessageReport && type != kMessageFinal) ||
+          size != kReportSize + tour_size ||
+          !UnpackTour(payload + kReportSize, n, tour)) {
+        // Gone, or not speaking the protocol any more.
+        close(peer->fd);
+        peer->fd = -1;
+        --alive;
+        continue;
+      }
+      // The workers' fitness is not trusted.
+      fitness = TourFitness(tour, n, graph);
+      if (fitness < best_fitness) {
+        size_t j;
+        best_fitness = fitness;
+        memcpy(best, tour, n * sizeof(City));
+        for (j = 0; j < workers; ++j)
+          peers[j].stale_reports = 0;
+      } else if (type == kMessageReport) {
+        ++peer->stale_reports;
+      }
+      if (type == kMessageFinal) {
+        if (return_data) {
+          if (GetU64(payload + 4) > return_data->iterations)
+            return_data->iterations = GetU64(payload + 4);
+          return_data->children += GetU64(payload + 12);
+        }
+        close(peer->fd);
+        peer->fd = -1;
+        --alive;
+        continue;
+      }
+      if (!stopping) {
+        size_t j;
+        stopping = 1;
+        for (j = 0; j < workers; ++j) {
+          if (peers[j].fd >= 0 &&
+              peers[j].stale_reports < peers[j].stale_limit)
+            stopping = 0;
+        }
+      }
+      if (stopping) {
+        type = SendMessage(peer->fd, kMessageStop, NULL, 0);
+      } else if (best_fitness < fitness) {
+        PutU32(payload, best_fitness);
+        PackTour(best, n, payload + 4);
+        type = SendMessage(peer->fd, kMessageTour, payload, 4 + tour_size);
+      } else {
+        type = SendMessage(peer->fd, kMessageContinue, NULL, 0);
+      }
+      if (type < 0) {
+        close(peer->fd);
+        peer->fd = -1;
+        --alive;
+      }
+    }
+  }
+done:
+  if (return_data) {
+    return_data->time = Seconds() - begin;
+    if (best_fitness != INT_MAX) {
+      for (i = 0; i < n; ++i)
+        return_data->best_path[i] = best[i];
+    }
+  }
+  free(payload);
+  free(tour);
+  free(best);
+  free(peers);
+  free(polls);
+  return best_fitness == INT_MAX ? -1 : best_fitness;
+}
+
+typedef struct ClusterPort {
+  int fd;
+  const graph_t* graph;
+  uint8_t* payload;
+  size_t tour_size;
+  // The coordinator is gone, no final report.
+  int failed;
+} ClusterPort;
+
+static void PutReport(ClusterPort* self, const City* best, int best_fitness,
+                      size_t generations, size_t children) {
+  PutU32(self->payload, best_fitness);
+  PutU64(self->payload + 4, generations);
+  PutU64(self->payload + 12, children);
+  PackTour(best, self->graph->n, self->payload + kReportSize);
+}
+
+static int ClusterExchange(void* context, const City* best, int best_fitness,
+                           size_t generations, City* incoming) {
+  ClusterPort* self = context;
+  size_t n = self->graph->n;
+  size_t size;
+  PutReport(self, best, best_fitness, generations, 0);
+  if (SendMessage(self->fd, kMessageReport, self->payload,
+                  kReportSize + self->tour_size)) {
+    self->failed = 1;
+    return -1;
+  }
+  switch (ReceiveMessage(self->fd, self->payload,
+                         kReportSize + self->tour_size, &size)) {
+    case kMessageContinue:
+      return 0;
+    case kMessageTour:
+      return size == 4 + self->tour_size &&
+             UnpackTour(self->payload + 4, n, incoming);
+    case kMessageStop:
+      return -1;
+    default:
+      self->failed = 1;
+      return -1;
+  }
+}
+
+int ClusterWork(const char* address, const graph_t* graph,
+                size_t thread_count, size_t population_size,
+                const ShortestPathOptions* options,
+                ShortestPathData* return_data) {
+  ShortestPathOptions island_options;
+  MigrationPort port;
+  ClusterPort cluster;
+  uint8_t hello[8];
+  City* best;
+  size_t i;
+  int best_fitness;
+  assert(return_data && return_data->best_path);
+  if (options) {
+    island_options = *options;
+  } else {
+    ShortestPathDefaultOptions(&island_options);
+  }
+  cluster.fd = Connect(address);
+  if (cluster.fd < 0)
+    return -1;
+  cluster.graph = graph;
+  cluster.tour_size = PackedTourSize(graph->n);
+  cluster.payload = malloc(kReportSize + cluster.tour_size);
+  assert(cluster.payload);
+  cluster.failed = 0;
+  PutU32(hello, graph->n);
+  PutU32(hello + 4, island_options.migration_interval);
+  if (SendMessage(cluster.fd, kMessageHello, hello, sizeof(hello))) {
+    close(cluster.fd);
+    free(cluster.payload);
+    return -1;
+  }
+  port.context = &cluster;
+  port.exchange = ClusterExchange;
+  island_options.model = kModelIslands;
+  island_options.port = &port;
+  best_fitness = ShortestPath(graph, thread_count, population_size, 0,
+                              &island_options, return_data);
+  if (!cluster.failed) {
+    best = malloc(graph->n * sizeof(City));
+    assert(best);
+    for (i = 0; i < graph->n; ++i)
+      best[i] = return_data->best_path[i];
+    PutReport(&cluster, best, best_fitness, return_data->iterations,
+              return_data->children);
+    SendMessage(cluster.fd, kMessageFinal, cluster.payload,
+                kReportSize + cluster.tour_size);
+    free(best);
+  }
+  close(cluster.fd);
+  free(cluster.payload);
+  return best_fitness;
+}
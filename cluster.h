@@ -0,0 +1,36 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stddef.h>
+
+#include "graph.h"
+#include "salesman.h"
+
+// Multi-process island model. Every worker process runs islands of
+// its own and, through a |MigrationPort|, reports its best tour to a
+// coordinator process, which answers with the best tour any worker
+// has found so far if that one is better. The coordinator stops all
+// the workers once the global best has not improved for
+// |same_fitness_for| generations on every one of them.
+//
+// Addresses are either "unix:<path>" for a Unix domain socket or
+// "<host>:<port>" for TCP. Tours are sent bit-packed, with just
+// enough bits per city for the graph.
+
+// Wait for |workers| workers to join at |address| and coordinate
+// them until they are done. Workers have to load the same graph.
+// Returns the best fitness, or -1 if the run failed.
+int ClusterCoordinate(const char* address, size_t workers,
+                      const graph_t* graph, size_t same_fitness_for,
+                      ShortestPathData* return_data);
+
+// Join the coordinator at |address| and run the island model with
+// |options| until it says to stop. |return_data| is required, its
+// best path is the best tour of this worker. Returns the best
+// fitness, or -1 if the coordinator could not be reached.
+int ClusterWork(const char* address, const graph_t* graph,
+                size_t thread_count, size_t population_size,
+                const ShortestPathOptions* options,
+                ShortestPathData* return_data);
+
+#endif
@@ -0,0 +1,22 @@
+# Run a coordinator and several worker processes on this machine.
+# Usage: sh cluster.sh [workers] [threads] [population] [same_fitness_for]
+#                      [graph file] [address]
+workers=${1:-3}
+threads=${2:-2}
+population=${3:-2000}
+same=${4:-10}
+graph=${5:-graph.txt}
+address=${6:-unix:/tmp/salesman-$$.sock}
+./main 0 $population $same --file $graph --coordinate $address \
+	--workers $workers > /dev/null &
+coordinator=$!
+for worker in $(seq $workers)
+do
+	./main $threads $population $same --file $graph --join $address \
+		--seed $worker > /dev/null &
+done
+wait $coordinator
+status=$?
+wait
+head -1 stats.txt
+exit $status
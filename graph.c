@@ -1,66 +1,557 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "graph.h"
 
-graph_t *graph_generate(const int n, const int w)
+#define GRAPH_FILE_MAGIC "TSPGRAPH"
+#define GRAPH_FILE_VERSION 1
+#define GRAPH_FILE_BYTE_ORDER 0x01020304u
+#define GRAPH_FILE_SYMMETRIC 1u
+#define GRAPH_FILE_DATA_OFFSET 64
+
+typedef struct graph_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t n;
+	uint32_t backend;
+	uint32_t width;
+	uint32_t flags;
+	uint64_t data_offset;
+	uint64_t data_size;
+} graph_file_header;
+
+static void graph_fail(graph_error *err, const char *format, ...)
 {
-	int *weights = malloc(n * n * sizeof(int));
-	assert(weights);
+	if (!err) {
+		return;
+	}
+	va_list args;
+	va_start(args, format);
+	vsnprintf(err->message, sizeof(err->message), format, args);
+	va_end(args);
+}
+
+// graph_chunk_error keeps the first error found by one worker,
+// at is the position of the offending entry (SIZE_MAX if none)
+typedef struct graph_chunk_error {
+	size_t at;
+	graph_error error;
+} graph_chunk_error;
+
+static void graph_chunk_fail(graph_chunk_error *e, const size_t at,
+		const char *format, ...)
+{
+	va_list args;
+	e->at = at;
+	va_start(args, format);
+	vsnprintf(e->error.message, sizeof(e->error.message), format, args);
+	va_end(args);
+}
+
+// graph_first_error copies the error that comes first in the input,
+// so the report doesn't depend on the number of threads;
+// returns 1 if any worker failed
+static int graph_first_error(const graph_chunk_error *errors, const int count,
+		graph_error *err)
+{
+	int first = -1;
+	for (int i = 0; i < count; i++) {
+		if (errors[i].at != SIZE_MAX &&
+				(first < 0 || errors[i].at < errors[first].at)) {
+			first = i;
+		}
+	}
+	if (first < 0) {
+		return 0;
+	}
+	if (err) {
+		*err = errors[first].error;
+	}
+	return 1;
+}
+
+typedef struct graph_worker {
+	void (*func)(void *arg, int index, int count);
+	void *arg;
+	int index;
+	int count;
+} graph_worker;
+
+static void *graph_worker_main(void *in)
+{
+	graph_worker *w = in;
+	w->func(w->arg, w->index, w->count);
+	return NULL;
+}
+
+// graph_parallel runs func(arg, index, count) for every index in
+// [0:count) on its own thread, the calling one included
+static void graph_parallel(int count, void (*func)(void *, int, int),
+		void *arg)
+{
+	pthread_t *ids = malloc(count * sizeof(pthread_t));
+	graph_worker *workers = malloc(count * sizeof(graph_worker));
+	int *started = calloc(count, sizeof(int));
+	assert(ids && workers && started);
+	for (int i = 1; i < count; i++) {
+		workers[i] = (graph_worker){func, arg, i, count};
+		started[i] = !pthread_create(ids + i, NULL, graph_worker_main,
+				workers + i);
+		if (!started[i]) {
+			func(arg, i, count);
+		}
+	}
+	func(arg, 0, count);
+	for (int i = 1; i < count; i++) {
+		if (started[i]) {
+			pthread_join(ids[i], NULL);
+		}
+	}
+	free(ids);
+	free(workers);
+	free(started);
+}
+
+// graph_threads bounds the number of threads to use for total items
+static int graph_threads(const int threads, const size_t total)
+{
+	if (threads < 1 || total == 0) {
+		return 1;
+	}
+	return (size_t)threads < total ? threads : (int)total;
+}
+
+// graph_dense_backend returns the narrowest dense backend that can hold
+// weights in range [0:w]
+static graph_backend graph_dense_backend(const int w)
+{
+	if (w <= UINT8_MAX) {
+		return GRAPH_DENSE_U8;
+	}
+	if (w <= UINT16_MAX) {
+		return GRAPH_DENSE_U16;
+	}
+	return GRAPH_DENSE_I32;
+}
 
+static size_t graph_entry_size(const graph_backend backend)
+{
+	switch (backend) {
+	case GRAPH_DENSE_U8:
+		return sizeof(uint8_t);
+	case GRAPH_DENSE_U16:
+		return sizeof(uint16_t);
+	default:
+		return sizeof(int32_t);
+	}
+}
+
+// graph_alloc_dense allocates a graph with a zeroed n * n matrix fitting
+// weights in range [0:w]
+static graph_t *graph_alloc_dense(const int n, const int w)
+{
 	graph_t *g = calloc(1, sizeof(graph_t));
 	assert(g);
 	g->n = n;
-	g->weights = weights;
+	g->symmetric = 1;
+	g->backend = graph_dense_backend(w);
+	g->weights = calloc((size_t)n * n, graph_entry_size(g->backend));
+	assert(g->weights);
+	return g;
+}
+
+// graph_set_weight stores weight of the edge (a,b) in a dense graph
+static void graph_set_weight(graph_t *g, const size_t a, const size_t b,
+		const int weight)
+{
+	size_t index = a * g->n + b;
+	switch (g->backend) {
+	case GRAPH_DENSE_U8:
+		((uint8_t *)g->weights)[index] = weight;
+		break;
+	case GRAPH_DENSE_U16:
+		((uint16_t *)g->weights)[index] = weight;
+		break;
+	case GRAPH_DENSE_I32:
+		((int32_t *)g->weights)[index] = weight;
+		break;
+	default:
+		assert(0);
+	}
+}
+
+graph_t *graph_generate(const int n, const int w)
+{
+	graph_t *g = graph_alloc_dense(n, w);
 
 	for (int i = 0; i < n; i++) {
-		weights[i * n + i] = -1;
 		for (int j = i + 1; j < n; j++) {
 			int weight = rand() % w + 1;
-			weights[i * n + j] = weight;
-			weights[j * n + i] = weight;
+			graph_set_weight(g, i, j, weight);
+			graph_set_weight(g, j, i, weight);
 		}
 	}
 
 	return g;
 }
 
-inline int graph_weight(const graph_t *g, const int a, const int b)
+// side of the square tiles graph_generate_seeded fills the matrix in,
+// and points generated per random stream
+#define GRAPH_TILE 64
+#define GRAPH_POINTS_PER_STREAM 1024
+
+// graph_random is a splitmix64 stream; streams seeded with different
+// ids are independent, so work split by stream gives the same numbers
+// on any number of threads
+typedef struct graph_random {
+	uint64_t state;
+} graph_random;
+
+static uint64_t graph_mix(uint64_t x)
 {
-	if (a > g->n || b > g->n) {
-		return -1;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+static void graph_random_init(graph_random *r, const uint64_t seed,
+		const uint64_t stream)
+{
+	r->state = graph_mix(seed + graph_mix(stream + 1));
+}
+
+static uint64_t graph_random_next(graph_random *r)
+{
+	r->state += 0x9e3779b97f4a7c15ull;
+	return graph_mix(r->state);
+}
+
+// graph_random_below returns a number in range [0:bound)
+static uint64_t graph_random_below(graph_random *r, const uint64_t bound)
+{
+	return ((graph_random_next(r) >> 32) * bound) >> 32;
+}
+
+// graph_random_unit returns a number in range [0:1)
+static double graph_random_unit(graph_random *r)
+{
+	return (graph_random_next(r) >> 11) * 0x1.0p-53;
+}
+
+typedef struct graph_generator {
+	graph_t *g;
+	int w;
+	graph_family family;
+	uint64_t seed;
+	// clustered family only, |centres| (x, y) pairs
+	int centres;
+	double *centre_coords;
+} graph_generator;
+
+// graph_fill_tiles fills the tiles on and above the diagonal whose
+// number modulo count is index, each from the stream of its number,
+// together with their mirror images below the diagonal
+static void graph_fill_tiles(void *arg, int index, int count)
+{
+	graph_generator *gen = arg;
+	graph_t *g = gen->g;
+	size_t n = g->n;
+	size_t tiles = (n + GRAPH_TILE - 1) / GRAPH_TILE;
+	size_t number = 0;
+	for (size_t row = 0; row < tiles; row++) {
+		for (size_t column = row; column < tiles; column++, number++) {
+			if (number % count != (size_t)index) {
+				continue;
+			}
+			graph_random r;
+			graph_random_init(&r, gen->seed, number);
+			size_t i_end = (row + 1) * GRAPH_TILE < n ?
+				(row + 1) * GRAPH_TILE : n;
+			size_t j_end = (column + 1) * GRAPH_TILE < n ?
+				(column + 1) * GRAPH_TILE : n;
+			for (size_t i = row * GRAPH_TILE; i < i_end; i++) {
+				size_t j_begin = column * GRAPH_TILE > i + 1 ?
+					column * GRAPH_TILE : i + 1;
+				for (size_t j = j_begin; j < j_end; j++) {
+					int weight = graph_random_below(&r, gen->w) + 1;
+					graph_set_weight(g, i, j, weight);
+					graph_set_weight(g, j, i, weight);
+				}
+			}
+		}
 	}
-	return g->weights[a * g->n + b];
 }
 
-graph_t *graph_read(FILE *f)
+// graph_fill_points places the points of every block of
+// GRAPH_POINTS_PER_STREAM whose number modulo count is index
+static void graph_fill_points(void *arg, int index, int count)
 {
-	int n;
-	assert(fscanf(f, "%d", &n));
-	int *weights = malloc(n * n * sizeof(int));
-	assert(weights);
+	const double pi = 3.14159265358979323846;
+	graph_generator *gen = arg;
+	size_t n = gen->g->n;
+	size_t blocks = (n + GRAPH_POINTS_PER_STREAM - 1) /
+		GRAPH_POINTS_PER_STREAM;
+	// spread of a cluster, so that the clusters about fill the square
+	double sigma = gen->w / (4.0 * sqrt(gen->centres));
+	for (size_t block = index; block < blocks; block += count) {
+		graph_random r;
+		// stream 0 belongs to the centres
+		graph_random_init(&r, gen->seed, block + 1);
+		size_t end = (block + 1) * GRAPH_POINTS_PER_STREAM < n ?
+			(block + 1) * GRAPH_POINTS_PER_STREAM : n;
+		for (size_t i = block * GRAPH_POINTS_PER_STREAM; i < end; i++) {
+			double *point = gen->g->coords + 2 * i;
+			if (gen->family == GRAPH_FAMILY_EUCLIDEAN) {
+				point[0] = gen->w * graph_random_unit(&r);
+				point[1] = gen->w * graph_random_unit(&r);
+				continue;
+			}
+			// normally distributed around a random centre (Box-Muller)
+			const double *centre = gen->centre_coords +
+				2 * graph_random_below(&r, gen->centres);
+			double radius = sigma *
+				sqrt(-2.0 * log(1.0 - graph_random_unit(&r)));
+			double angle = 2.0 * pi * graph_random_unit(&r);
+			point[0] = centre[0] + radius * cos(angle);
+			point[1] = centre[1] + radius * sin(angle);
+		}
+	}
+}
 
+// graph_fill fills a graph of family allocated by the caller (with a
+// zeroed matrix for GRAPH_FAMILY_UNIFORM) from seed
+static void graph_fill(graph_t *g, const int w, const graph_family family,
+		const uint64_t seed, const int threads)
+{
+	graph_generator gen = {g, w, family, seed, 1, NULL};
+	if (family == GRAPH_FAMILY_UNIFORM) {
+		size_t tiles = (g->n + GRAPH_TILE - 1) / GRAPH_TILE;
+		graph_parallel(graph_threads(threads, tiles * (tiles + 1) / 2),
+				graph_fill_tiles, &gen);
+		return;
+	}
+	if (family == GRAPH_FAMILY_CLUSTERED) {
+		graph_random r;
+		gen.centres = sqrt(g->n) > 1 ? (int)sqrt(g->n) : 1;
+		gen.centre_coords = malloc(2 * gen.centres * sizeof(double));
+		assert(gen.centre_coords);
+		graph_random_init(&r, seed, 0);
+		for (int i = 0; i < 2 * gen.centres; i++) {
+			gen.centre_coords[i] = w * graph_random_unit(&r);
+		}
+	}
+	size_t blocks = (g->n + GRAPH_POINTS_PER_STREAM - 1) /
+		GRAPH_POINTS_PER_STREAM;
+	graph_parallel(graph_threads(threads, blocks), graph_fill_points, &gen);
+	free(gen.centre_coords);
+}
+
+graph_t *graph_generate_seeded(const int n, const int w,
+		const graph_family family, const uint64_t seed, const int threads)
+{
+	graph_t *g;
+	assert(n > 0 && w > 0);
+	if (family == GRAPH_FAMILY_UNIFORM) {
+		g = graph_alloc_dense(n, w);
+	} else {
+		g = calloc(1, sizeof(graph_t));
+		assert(g);
+		g->n = n;
+		g->symmetric = 1;
+		g->backend = GRAPH_EUCLIDEAN;
+		g->coords = malloc(2 * (size_t)n * sizeof(double));
+		assert(g->coords);
+	}
+	graph_fill(g, w, family, seed, threads);
+	return g;
+}
+
+int graph_family_by_name(const char *name)
+{
+	if (!strcmp(name, "uniform")) {
+		return GRAPH_FAMILY_UNIFORM;
+	}
+	if (!strcmp(name, "euclidean")) {
+		return GRAPH_FAMILY_EUCLIDEAN;
+	}
+	if (!strcmp(name, "clustered")) {
+		return GRAPH_FAMILY_CLUSTERED;
+	}
+	return -1;
+}
+
+graph_t *graph_from_points(const int n, const double *x, const double *y,
+		const graph_backend backend)
+{
+	// TSPLIB's own (truncated) value of pi, for compatible GEO distances
+	const double pi = 3.141592;
 	graph_t *g = calloc(1, sizeof(graph_t));
 	assert(g);
+	assert(backend == GRAPH_EUCLIDEAN || backend == GRAPH_GEO);
 	g->n = n;
-	g->weights = weights;
+	g->symmetric = 1;
+	g->backend = backend;
+	g->coords = malloc(2 * (size_t)n * sizeof(double));
+	assert(g->coords);
 	for (int i = 0; i < n; i++) {
-		for (int j = 0; j < n; j++) {
-			assert(fscanf(f, "%d", weights + i * n + j));
+		if (backend == GRAPH_EUCLIDEAN) {
+			g->coords[2 * i] = x[i];
+			g->coords[2 * i + 1] = y[i];
+		} else {
+			// TSPLIB GEO coordinates are DDD.MM (degrees and minutes)
+			double degrees = (int)x[i];
+			double latitude = pi * (degrees + 5.0 * (x[i] - degrees) / 3.0) / 180.0;
+			degrees = (int)y[i];
+			g->coords[2 * i] = latitude;
+			g->coords[2 * i + 1] =
+				pi * (degrees + 5.0 * (y[i] - degrees) / 3.0) / 180.0;
 		}
 	}
+	return g;
+}
 
-	// check graph for consistency
-	for (int i = 0; i < n; i++) {
-		for (int j = 0; j < n; j++) {
-			assert(weights[i * n + j] == weights[j * n + i]);
+int graph_weight(const graph_t *g, const int a, const int b)
+{
+	if (a < 0 || b < 0 || a >= g->n || b >= g->n || a == b) {
+		return -1;
+	}
+	return graph_weight_unchecked(g, a, b);
+}
+
+typedef struct graph_matrix {
+	int n;
+	const int *weights;
+	int *row_max;
+	graph_t *g;
+	graph_chunk_error *errors;
+} graph_matrix;
+
+// graph_check_rows checks a share of the rows of a text matrix:
+// -1 on the diagonal, non-negative and symmetric weights elsewhere
+static void graph_check_rows(void *arg, int index, int count)
+{
+	graph_matrix *m = arg;
+	graph_chunk_error *e = m->errors + index;
+	size_t n = m->n;
+	size_t begin = n * index / count;
+	size_t end = n * (index + 1) / count;
+	e->at = SIZE_MAX;
+	for (size_t i = begin; i < end; i++) {
+		const int *row = m->weights + i * n;
+		int max = 0;
+		for (size_t j = 0; j < n; j++) {
+			int w = row[j];
 			if (i == j) {
-				assert(weights[i * n + i] == -1);
+				if (w != -1) {
+					graph_chunk_fail(e, i * n + j,
+							"self-loop of node %zu should be -1, not %d", i, w);
+					return;
+				}
+				continue;
+			}
+			if (w < 0) {
+				graph_chunk_fail(e, i * n + j,
+						"edge (%zu,%zu) has negative weight %d", i, j, w);
+				return;
 			}
+			if (w != m->weights[j * n + i]) {
+				graph_chunk_fail(e, i * n + j,
+						"edge (%zu,%zu) has weight %d, but (%zu,%zu) has %d",
+						i, j, w, j, i, m->weights[j * n + i]);
+				return;
+			}
+			if (w > max) {
+				max = w;
+			}
+		}
+		m->row_max[i] = max;
+	}
+}
+
+// graph_narrow_rows copies a share of the rows of a checked text
+// matrix into the dense storage of the graph
+static void graph_narrow_rows(void *arg, int index, int count)
+{
+	graph_matrix *m = arg;
+	size_t n = m->n;
+	size_t begin = n * index / count;
+	size_t end = n * (index + 1) / count;
+	for (size_t i = begin; i < end; i++) {
+		for (size_t j = 0; j < n; j++) {
+			if (i != j) {
+				graph_set_weight(m->g, i, j, m->weights[i * n + j]);
+			}
+		}
+	}
+}
+
+// graph_from_matrix checks a matrix in the text format and stores it
+// in the narrowest dense type the weights fit in
+static graph_t *graph_from_matrix(const int n, const int *weights,
+		const int threads, graph_error *err)
+{
+	graph_matrix m = {n, weights, NULL, NULL, NULL};
+	int count = graph_threads(threads, n);
+	int max_weight = 0;
+	m.row_max = malloc(n * sizeof(int));
+	m.errors = malloc(count * sizeof(graph_chunk_error));
+	assert(m.row_max && m.errors);
+
+	graph_parallel(count, graph_check_rows, &m);
+	if (graph_first_error(m.errors, count, err)) {
+		free(m.row_max);
+		free(m.errors);
+		return NULL;
+	}
+	for (int i = 0; i < n; i++) {
+		if (m.row_max[i] > max_weight) {
+			max_weight = m.row_max[i];
+		}
+	}
+
+	m.g = graph_alloc_dense(n, max_weight);
+	graph_parallel(count, graph_narrow_rows, &m);
+	free(m.row_max);
+	free(m.errors);
+	return m.g;
+}
+
+graph_t *graph_read(FILE *f)
+{
+	int n;
+	graph_error error;
+	if (fscanf(f, "%d", &n) != 1 || n < 1) {
+		fprintf(stderr, "graph_read: bad number of nodes\n");
+		return NULL;
+	}
+	int *weights = malloc((size_t)n * n * sizeof(int));
+	assert(weights);
+
+	for (size_t i = 0; i < (size_t)n * n; i++) {
+		if (fscanf(f, "%d", weights + i) != 1) {
+			fprintf(stderr, "graph_read: bad or missing entry (%zu,%zu)\n",
+					i / n, i % n);
+			free(weights);
+			return NULL;
 		}
 	}
 
+	graph_t *g = graph_from_matrix(n, weights, 1, &error);
+	if (!g) {
+		fprintf(stderr, "graph_read: %s\n", error.message);
+	}
+	free(weights);
+
 	return g;
 }
 
@@ -74,6 +565,58 @@ graph_t *graph_read_file(const char *filename)
 	return g;
 }
 
+graph_t *graph_read_points(FILE *f, graph_error *err)
+{
+	int n;
+	char metric[16];
+	graph_backend backend;
+	if (fscanf(f, "%d %15s", &n, metric) != 2 || n < 1) {
+		graph_fail(err, "bad number of nodes or metric");
+		return NULL;
+	}
+	if (!strcmp(metric, "GEO")) {
+		backend = GRAPH_GEO;
+	} else if (!strcmp(metric, "EUC_2D")) {
+		backend = GRAPH_EUCLIDEAN;
+	} else {
+		graph_fail(err, "unknown metric %s", metric);
+		return NULL;
+	}
+
+	double *x = malloc(n * sizeof(double));
+	double *y = malloc(n * sizeof(double));
+	assert(x && y);
+	for (int i = 0; i < n; i++) {
+		if (fscanf(f, "%lf %lf", x + i, y + i) != 2) {
+			graph_fail(err, "expected %d nodes, found %d", n, i);
+			free(x);
+			free(y);
+			return NULL;
+		}
+	}
+
+	graph_t *g = graph_from_points(n, x, y, backend);
+	free(x);
+	free(y);
+	if (graph_validate(g, 1, err)) {
+		graph_destroy(g);
+		return NULL;
+	}
+	return g;
+}
+
+graph_t *graph_read_points_file(const char *filename, graph_error *err)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		graph_fail(err, "cannot open %s", filename);
+		return NULL;
+	}
+	graph_t *g = graph_read_points(f, err);
+	fclose(f);
+	return g;
+}
+
 
 void graph_dump(const graph_t *g, FILE *f)
 {
@@ -95,8 +638,459 @@ void graph_dump_file(const graph_t *g, const char *filename)
 }
 
 
+// graph_data_size returns the size of the weights or coords of g
+static size_t graph_data_size(const graph_t *g)
+{
+	if (g->backend == GRAPH_EUCLIDEAN || g->backend == GRAPH_GEO) {
+		return 2 * (size_t)g->n * sizeof(double);
+	}
+	return (size_t)g->n * g->n * graph_entry_size(g->backend);
+}
+
+// graph_file_header_of fills the header of a binary file holding g
+static void graph_file_header_of(const graph_t *g,
+		char header[GRAPH_FILE_DATA_OFFSET])
+{
+	graph_file_header h = {GRAPH_FILE_MAGIC, GRAPH_FILE_VERSION,
+		GRAPH_FILE_BYTE_ORDER, g->n, g->backend, 0,
+		g->symmetric ? GRAPH_FILE_SYMMETRIC : 0, GRAPH_FILE_DATA_OFFSET,
+		graph_data_size(g)};
+	int coordinates = g->backend == GRAPH_EUCLIDEAN || g->backend == GRAPH_GEO;
+	h.width = coordinates ? sizeof(double) : graph_entry_size(g->backend);
+	memset(header, 0, GRAPH_FILE_DATA_OFFSET);
+	memcpy(header, &h, sizeof(h));
+}
+
+int graph_dump_binary(const graph_t *g, FILE *f, graph_error *err)
+{
+	char header[GRAPH_FILE_DATA_OFFSET];
+	int coordinates = g->backend == GRAPH_EUCLIDEAN || g->backend == GRAPH_GEO;
+	graph_file_header_of(g, header);
+	if (fwrite(header, sizeof(header), 1, f) != 1 ||
+			fwrite(coordinates ? (void *)g->coords : g->weights,
+				graph_data_size(g), 1, f) != 1) {
+		graph_fail(err, "write failed");
+		return -1;
+	}
+	return 0;
+}
+
+int graph_dump_binary_file(const graph_t *g, const char *filename,
+		graph_error *err)
+{
+	FILE *f = fopen(filename, "wb");
+	if (!f) {
+		graph_fail(err, "cannot open %s for writing", filename);
+		return -1;
+	}
+	int result = graph_dump_binary(g, f, err);
+	if (fclose(f) && !result) {
+		graph_fail(err, "write failed");
+		result = -1;
+	}
+	return result;
+}
+
+int graph_generate_binary_file(const char *filename, const int n,
+		const int w, const graph_family family, const uint64_t seed,
+		const int threads, graph_error *err)
+{
+	if (family != GRAPH_FAMILY_UNIFORM) {
+		// only n points, nothing to gain from writing them in place
+		graph_t *g = graph_generate_seeded(n, w, family, seed, threads);
+		int result = graph_dump_binary_file(g, filename, err);
+		graph_destroy(g);
+		return result;
+	}
+	graph_t shape = {.n = n, .backend = graph_dense_backend(w),
+		.symmetric = 1};
+	size_t size = GRAPH_FILE_DATA_OFFSET + graph_data_size(&shape);
+	int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		graph_fail(err, "cannot open %s for writing", filename);
+		return -1;
+	}
+	// the file starts out as zeros, which is the diagonal done
+	if (ftruncate(fd, size)) {
+		graph_fail(err, "cannot grow %s to %zu bytes", filename, size);
+		close(fd);
+		return -1;
+	}
+	char *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		graph_fail(err, "cannot map %s", filename);
+		return -1;
+	}
+	graph_file_header_of(&shape, data);
+	shape.weights = data + GRAPH_FILE_DATA_OFFSET;
+	graph_fill(&shape, w, family, seed, threads);
+	if (munmap(data, size)) {
+		graph_fail(err, "write failed");
+		return -1;
+	}
+	return 0;
+}
+
+// graph_map_file maps a whole file read-only, returns NULL on failure
+static void *graph_map_file(const char *filename, size_t *size,
+		graph_error *err)
+{
+	struct stat st;
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		graph_fail(err, "cannot open %s", filename);
+		return NULL;
+	}
+	if (fstat(fd, &st) || st.st_size == 0) {
+		graph_fail(err, "%s is empty or unreadable", filename);
+		close(fd);
+		return NULL;
+	}
+	*size = st.st_size;
+	void *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		graph_fail(err, "cannot map %s", filename);
+		return NULL;
+	}
+	return data;
+}
+
+// graph_check_header checks that a binary file of the given size
+// holds what its header says
+static int graph_check_header(const graph_file_header *h, const size_t size,
+		graph_error *err)
+{
+	if (memcmp(h->magic, GRAPH_FILE_MAGIC, sizeof(h->magic))) {
+		graph_fail(err, "not a binary graph file");
+		return -1;
+	}
+	if (h->version != GRAPH_FILE_VERSION) {
+		graph_fail(err, "unsupported format version %u", h->version);
+		return -1;
+	}
+	if (h->byte_order != GRAPH_FILE_BYTE_ORDER) {
+		graph_fail(err, "file was written with another byte order");
+		return -1;
+	}
+	if (h->n < 1 || h->n > INT_MAX || h->backend > GRAPH_GEO) {
+		graph_fail(err, "bad header: n %u, backend %u", h->n, h->backend);
+		return -1;
+	}
+	graph_t shape = {.n = h->n, .backend = h->backend};
+	size_t width = h->backend >= GRAPH_EUCLIDEAN ?
+		sizeof(double) : graph_entry_size(h->backend);
+	if (h->width != width || h->data_size != graph_data_size(&shape)) {
+		graph_fail(err, "bad header: width %u, data size %llu",
+				h->width, (unsigned long long)h->data_size);
+		return -1;
+	}
+	if (h->data_offset < sizeof(*h) || h->data_offset % sizeof(double) ||
+			h->data_offset > size || size - h->data_offset < h->data_size) {
+		graph_fail(err, "file is truncated or has a bad data offset");
+		return -1;
+	}
+	return 0;
+}
+
+graph_t *graph_map_binary(const char *filename, graph_error *err)
+{
+	size_t size;
+	char *data = graph_map_file(filename, &size, err);
+	if (!data) {
+		return NULL;
+	}
+	graph_file_header h;
+	if (size < sizeof(h)) {
+		graph_fail(err, "%s is too short for a binary graph", filename);
+		munmap(data, size);
+		return NULL;
+	}
+	memcpy(&h, data, sizeof(h));
+	if (graph_check_header(&h, size, err)) {
+		munmap(data, size);
+		return NULL;
+	}
+
+	graph_t *g = calloc(1, sizeof(graph_t));
+	assert(g);
+	g->n = h.n;
+	g->backend = h.backend;
+	g->symmetric = !!(h.flags & GRAPH_FILE_SYMMETRIC);
+	if (g->backend >= GRAPH_EUCLIDEAN) {
+		g->coords = (double *)(data + h.data_offset);
+	} else {
+		g->weights = data + h.data_offset;
+	}
+	g->mapping = data;
+	g->mapping_size = size;
+	return g;
+}
+
+static int graph_is_space(const char c)
+{
+	return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+// graph_parse_int parses the integer token at data[*pos] and moves
+// *pos past it, returns 0 for a malformed or out of range token
+static int graph_parse_int(const char *data, const size_t size, size_t *pos,
+		int *value)
+{
+	size_t i = *pos;
+	int negative = i < size && data[i] == '-';
+	size_t digits = i += negative;
+	long long v = 0;
+	while (i < size && data[i] >= '0' && data[i] <= '9') {
+		v = v * 10 + (data[i] - '0');
+		if (v > INT_MAX) {
+			return 0;
+		}
+		i++;
+	}
+	if (i == digits || (i < size && !graph_is_space(data[i]))) {
+		return 0;
+	}
+	*value = negative ? -v : v;
+	*pos = i;
+	return 1;
+}
+
+typedef struct graph_text {
+	const char *data;
+	size_t size;
+	// chunk i covers [bounds[i]:bounds[i + 1]), never splitting a token
+	size_t *bounds;
+	// entries in each chunk, then index of its first entry
+	size_t *entries;
+	int *weights;
+	graph_chunk_error *errors;
+} graph_text;
+
+// graph_scan_chunk counts the entries of a chunk if store is 0, and
+// parses them into place otherwise
+static void graph_scan_chunk(graph_text *t, const int index, const int store)
+{
+	graph_chunk_error *e = t->errors + index;
+	size_t pos = t->bounds[index];
+	size_t end = t->bounds[index + 1];
+	size_t entry = store ? t->entries[index] : 0;
+	e->at = SIZE_MAX;
+	while (pos < end) {
+		if (graph_is_space(t->data[pos])) {
+			pos++;
+			continue;
+		}
+		int value;
+		if (!graph_parse_int(t->data, end, &pos, &value)) {
+			graph_chunk_fail(e, pos, "malformed entry at byte %zu", pos);
+			return;
+		}
+		if (store) {
+			t->weights[entry] = value;
+		}
+		entry++;
+	}
+	if (!store) {
+		t->entries[index] = entry;
+	}
+}
+
+static void graph_count_chunk(void *arg, int index, int count)
+{
+	graph_scan_chunk(arg, index, 0);
+}
+
+static void graph_store_chunk(void *arg, int index, int count)
+{
+	graph_scan_chunk(arg, index, 1);
+}
+
+graph_t *graph_parse_text(const char *filename, const int threads,
+		graph_error *err)
+{
+	size_t size;
+	const char *data = graph_map_file(filename, &size, err);
+	if (!data) {
+		return NULL;
+	}
+
+	// the node count is parsed serially, the matrix in parallel
+	size_t pos = 0;
+	int n = 0;
+	while (pos < size && graph_is_space(data[pos])) {
+		pos++;
+	}
+	if (!graph_parse_int(data, size, &pos, &n) || n < 1) {
+		graph_fail(err, "bad number of nodes");
+		munmap((void *)data, size);
+		return NULL;
+	}
+
+	int count = graph_threads(threads, size - pos);
+	graph_text t = {data, size};
+	t.bounds = malloc((count + 1) * sizeof(size_t));
+	t.entries = malloc(count * sizeof(size_t));
+	t.weights = NULL;
+	t.errors = malloc(count * sizeof(graph_chunk_error));
+	assert(t.bounds && t.entries && t.errors);
+	t.bounds[0] = pos;
+	t.bounds[count] = size;
+	for (int i = 1; i < count; i++) {
+		size_t bound = pos + (size - pos) * i / count;
+		if (bound < t.bounds[i - 1]) {
+			bound = t.bounds[i - 1];
+		}
+		while (bound < size && !graph_is_space(data[bound])) {
+			bound++;
+		}
+		t.bounds[i] = bound;
+	}
+
+	graph_t *g = NULL;
+	size_t total = 0;
+	graph_parallel(count, graph_count_chunk, &t);
+	if (graph_first_error(t.errors, count, err)) {
+		goto done;
+	}
+	for (int i = 0; i < count; i++) {
+		size_t entries = t.entries[i];
+		t.entries[i] = total;
+		total += entries;
+	}
+	if (total != (size_t)n * n) {
+		graph_fail(err, "expected %zu matrix entries, found %zu",
+				(size_t)n * n, total);
+		goto done;
+	}
+	// only now that the entries are there, so a bad header can't make
+	// us allocate more than the file holds
+	t.weights = malloc(total * sizeof(int));
+	if (!t.weights) {
+		graph_fail(err, "out of memory for %d nodes", n);
+		goto done;
+	}
+	graph_parallel(count, graph_store_chunk, &t);
+	g = graph_from_matrix(n, t.weights, threads, err);
+
+done:
+	free(t.bounds);
+	free(t.entries);
+	free(t.weights);
+	free(t.errors);
+	munmap((void *)data, size);
+	return g;
+}
+
+typedef struct graph_check {
+	const graph_t *g;
+	graph_chunk_error *errors;
+} graph_check;
+
+// graph_check_nodes validates the rows (or coordinates) of a share of
+// the nodes of a graph
+static void graph_check_nodes(void *arg, int index, int count)
+{
+	graph_check *c = arg;
+	const graph_t *g = c->g;
+	graph_chunk_error *e = c->errors + index;
+	size_t n = g->n;
+	size_t begin = n * index / count;
+	size_t end = n * (index + 1) / count;
+	e->at = SIZE_MAX;
+	if (g->backend >= GRAPH_EUCLIDEAN) {
+		for (size_t i = begin; i < end; i++) {
+			if (!isfinite(g->coords[2 * i]) || !isfinite(g->coords[2 * i + 1])) {
+				graph_chunk_fail(e, i, "node %zu has bad coordinates", i);
+				return;
+			}
+		}
+		return;
+	}
+	for (size_t i = begin; i < end; i++) {
+		for (size_t j = 0; j < n; j++) {
+			int w = graph_weight_unchecked(g, i, j);
+			if (i == j) {
+				if (w != 0) {
+					graph_chunk_fail(e, i * n + j,
+							"self-loop of node %zu should be 0, not %d", i, w);
+					return;
+				}
+			} else if (w < 0) {
+				graph_chunk_fail(e, i * n + j,
+						"edge (%zu,%zu) has negative weight %d", i, j, w);
+				return;
+			} else if (g->symmetric && w != graph_weight_unchecked(g, j, i)) {
+				graph_chunk_fail(e, i * n + j,
+						"edge (%zu,%zu) has weight %d, but (%zu,%zu) has %d",
+						i, j, w, j, i, graph_weight_unchecked(g, j, i));
+				return;
+			}
+		}
+	}
+}
+
+int graph_validate(const graph_t *g, const int threads, graph_error *err)
+{
+	int count = graph_threads(threads, g->n);
+	graph_check c = {g, malloc(count * sizeof(graph_chunk_error))};
+	assert(c.errors);
+	graph_parallel(count, graph_check_nodes, &c);
+	int failed = graph_first_error(c.errors, count, err);
+	free(c.errors);
+	return failed ? -1 : 0;
+}
+
+graph_t *graph_load(const char *filename, const int threads,
+		graph_error *err)
+{
+	char magic[sizeof(GRAPH_FILE_MAGIC) - 1];
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		graph_fail(err, "cannot open %s", filename);
+		return NULL;
+	}
+	size_t read = fread(magic, 1, sizeof(magic), f);
+	fclose(f);
+
+	if (read < sizeof(magic) || memcmp(magic, GRAPH_FILE_MAGIC, sizeof(magic))) {
+		return graph_parse_text(filename, threads, err);
+	}
+	graph_t *g = graph_map_binary(filename, err);
+	if (g && graph_validate(g, threads, err)) {
+		graph_destroy(g);
+		return NULL;
+	}
+	return g;
+}
+
+graph_t *graph_copy(const graph_t *g)
+{
+	graph_t *copy = calloc(1, sizeof(graph_t));
+	void *data = malloc(graph_data_size(g));
+	assert(copy && data);
+	copy->n = g->n;
+	copy->backend = g->backend;
+	copy->symmetric = g->symmetric;
+	if (g->backend == GRAPH_EUCLIDEAN || g->backend == GRAPH_GEO) {
+		memcpy(data, g->coords, graph_data_size(g));
+		copy->coords = data;
+	} else {
+		memcpy(data, g->weights, graph_data_size(g));
+		copy->weights = data;
+	}
+	return copy;
+}
+
+
 void graph_destroy(graph_t *g)
 {
-	free(g->weights);
+	if (g->mapping) {
+		munmap(g->mapping, g->mapping_size);
+	} else {
+		free(g->weights);
+		free(g->coords);
+	}
 	free(g);
 }
@@ -1,13 +1,45 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #ifndef GRAPH_H
 #define GRAPH_H
 
+// graph_backend tells how the edge weights of a graph are stored
+typedef enum graph_backend {
+	// dense adjacency matrices, using the narrowest type that
+	// fits the largest weight (self-loops are stored as 0)
+	GRAPH_DENSE_U8,
+	GRAPH_DENSE_U16,
+	GRAPH_DENSE_I32,
+	// weights are computed on the fly from node coordinates,
+	// rounded as in TSPLIB EUC_2D and GEO
+	GRAPH_EUCLIDEAN,
+	GRAPH_GEO,
+} graph_backend;
+
 typedef struct graph_t {
 	int n;
-	int *weights;
+	graph_backend backend;
+	// weight of (a,b) always equals weight of (b,a)
+	int symmetric;
+	// n * n matrix for the dense backends
+	void *weights;
+	// n (x, y) pairs for the coordinate backends, GEO ones are
+	// kept as (latitude, longitude) in radians
+	double *coords;
+	// file mapping the weights or coords point into, if any
+	void *mapping;
+	size_t mapping_size;
 } graph_t;
 
+// graph_error receives the reason why a graph could not be loaded
+// or did not pass validation
+typedef struct graph_error {
+	char message[256];
+} graph_error;
+
 
 // graph_generate generates fully connected graph with n nodes without self-loops
 // weight of edge between a pair of nodes is generated in range [1:w]
@@ -15,6 +47,48 @@ typedef struct graph_t {
 // it is user responsiblity to init random with a propper seed
 graph_t *graph_generate(const int n, const int w);
 
+// graph_family tells what kind of instance graph_generate_seeded builds
+typedef enum graph_family {
+	// dense matrix of weights drawn uniformly from [1:w], stored with
+	// the narrowest dense backend
+	GRAPH_FAMILY_UNIFORM,
+	// points drawn uniformly from a w x w square, GRAPH_EUCLIDEAN
+	GRAPH_FAMILY_EUCLIDEAN,
+	// points spread normally around sqrt(n) centres drawn uniformly
+	// from a w x w square, GRAPH_EUCLIDEAN
+	GRAPH_FAMILY_CLUSTERED,
+} graph_family;
+
+// graph_family_by_name returns the family called "uniform",
+// "euclidean" or "clustered", or -1 for an unknown name
+int graph_family_by_name(const char *name);
+
+// graph_generate_seeded generates a graph of family with n nodes using
+// up to threads threads; the matrix is filled in 64 x 64 tiles and the
+// points in blocks, each from its own stream derived from seed, so the
+// same seed gives the same graph on any machine and thread count
+graph_t *graph_generate_seeded(const int n, const int w,
+		const graph_family family, const uint64_t seed, const int threads);
+
+// graph_generate_binary_file writes what graph_generate_seeded would
+// return as a binary graph file; dense matrices are generated straight
+// into the mapped file, so they never have to fit in memory twice;
+// returns 0 on success and -1 on failure
+int graph_generate_binary_file(const char *filename, const int n,
+		const int w, const graph_family family, const uint64_t seed,
+		const int threads, graph_error *err);
+
+// graph_from_points creates a graph over n points, where the weight of
+// an edge is the distance between its nodes; backend should be either
+// GRAPH_EUCLIDEAN (x, y) or GRAPH_GEO (TSPLIB latitude, longitude)
+graph_t *graph_from_points(const int n, const double *x, const double *y,
+		const graph_backend backend);
+
+// graph_copy returns a copy of g with weights or coords of its own,
+// never mapped; they are written by the calling thread, so the kernel
+// places them on the NUMA node that thread runs on
+graph_t *graph_copy(const graph_t *g);
+
 // graph_destroy frees all resources associated with the graph
 void graph_destroy(graph_t *g);
 
@@ -22,6 +96,36 @@ void graph_destroy(graph_t *g);
 // if edge doesn't exist than -1 will be returned
 int graph_weight(const graph_t *g, const int a, const int b);
 
+// graph_weight_unchecked returns weight of the edge (a,b) without any
+// checks, it is the accessor for hot loops: a and b should be
+// different nodes of the graph
+static inline int graph_weight_unchecked(const graph_t *g, const size_t a,
+		const size_t b)
+{
+	switch (g->backend) {
+	case GRAPH_DENSE_U8:
+		return ((const uint8_t *)g->weights)[a * g->n + b];
+	case GRAPH_DENSE_U16:
+		return ((const uint16_t *)g->weights)[a * g->n + b];
+	case GRAPH_DENSE_I32:
+		return ((const int32_t *)g->weights)[a * g->n + b];
+	case GRAPH_EUCLIDEAN: {
+		double dx = g->coords[2 * a] - g->coords[2 * b];
+		double dy = g->coords[2 * a + 1] - g->coords[2 * b + 1];
+		return (int)(sqrt(dx * dx + dy * dy) + 0.5);
+	}
+	case GRAPH_GEO: {
+		const double radius = 6378.388;
+		double q1 = cos(g->coords[2 * a + 1] - g->coords[2 * b + 1]);
+		double q2 = cos(g->coords[2 * a] - g->coords[2 * b]);
+		double q3 = cos(g->coords[2 * a] + g->coords[2 * b]);
+		return (int)(radius *
+				acos(0.5 * ((1.0 + q1) * q2 - (1.0 - q1) * q3)) + 1.0);
+	}
+	}
+	return -1;
+}
+
 // graph_read read graph from a given file
 // first line of file should contain a single number n (number of nodes)
 // the following n lines represent adjacency matrix of the graph, where
@@ -30,7 +134,47 @@ int graph_weight(const graph_t *g, const int a, const int b);
 graph_t *graph_read(FILE *f);
 graph_t *graph_read_file(const char *filename);
 
+// graph_read_points reads a graph given by node coordinates
+// first line of file should contain n and the metric (EUC_2D or GEO),
+// the following n lines contain coordinates of the nodes, which are
+// validated; returns NULL on failure
+graph_t *graph_read_points(FILE *f, graph_error *err);
+graph_t *graph_read_points_file(const char *filename, graph_error *err);
+
 void graph_dump(const graph_t *g, FILE *f);
 void graph_dump_file(const graph_t *g, const char *filename);
 
-#endif
\ No newline at end of file
+// Binary graph files start with a 64 byte header: the magic
+// "TSPGRAPH", format version, a byte order mark, n, the backend, the
+// width of a stored value in bytes, flags (bit 0: symmetric) and the
+// offset and size of the data. The data is the dense matrix or the
+// coordinates exactly as graph_t keeps them in memory, in host byte
+// order, so the file can be mapped and used without copying.
+
+// graph_dump_binary writes g in the binary format,
+// returns 0 on success and -1 on failure
+int graph_dump_binary(const graph_t *g, FILE *f, graph_error *err);
+int graph_dump_binary_file(const graph_t *g, const char *filename,
+		graph_error *err);
+
+// graph_map_binary maps a binary graph file into memory, only the
+// header is checked; returns NULL on failure
+graph_t *graph_map_binary(const char *filename, graph_error *err);
+
+// graph_parse_text reads a file in the graph_read format using up to
+// threads threads for parsing and validation; returns NULL on failure
+graph_t *graph_parse_text(const char *filename, const int threads,
+		graph_error *err);
+
+// graph_load reads either a binary or a text graph file, telling them
+// apart by the magic, and validates it; returns NULL on failure
+graph_t *graph_load(const char *filename, const int threads,
+		graph_error *err);
+
+// graph_validate checks the whole graph with up to threads threads:
+// weights should be non-negative (zero on the diagonal), symmetric if
+// the graph says so, and coordinates finite; returns 0 if the graph
+// is valid and -1 otherwise
+int graph_validate(const graph_t *g, const int threads, graph_error *err);
+
+#endif
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graph.h"
+
+// Converts graph files into the binary format:
+//   graph_convert [--points] input output [threads]
+// The input is a text matrix as read by graph_read (or, with
+// --points, a coordinate file as read by graph_read_points), and is
+// fully validated before anything is written.
+//
+// Or generates a binary graph, see graph_generate_seeded:
+//   graph_convert --generate family n w seed output [threads]
+const char* kPointsFlag = "--points";
+const char* kGenerateFlag = "--generate";
+
+int Generate(int argc, char* argv[]) {
+  graph_error error;
+  int family;
+  int n;
+  int w;
+  unsigned long long seed;
+  if (argc < 7 || (family = graph_family_by_name(argv[2])) < 0 ||
+      sscanf(argv[3], "%d", &n) != 1 || sscanf(argv[4], "%d", &w) != 1 ||
+      sscanf(argv[5], "%llu", &seed) != 1 || n < 1 || w < 1) {
+    fprintf(stderr,
+            "usage: %s %s uniform|euclidean|clustered n w seed output "
+            "[threads]\n",
+            argv[0], kGenerateFlag);
+    return 2;
+  }
+  if (graph_generate_binary_file(argv[6], n, w, family, seed,
+                                 argc > 7 ? atoi(argv[7]) : 1, &error)) {
+    fprintf(stderr, "%s: %s\n", argv[6], error.message);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  graph_t* graph;
+  graph_error error;
+  int points = argc > 1 && !strcmp(argv[1], kPointsFlag);
+  int threads;
+  if (argc > 1 && !strcmp(argv[1], kGenerateFlag))
+    return Generate(argc, argv);
+  if (argc - points < 3) {
+    fprintf(stderr, "usage: %s [%s] input output [threads]\n", argv[0],
+            kPointsFlag);
+    return 2;
+  }
+  threads = argc - points > 3 ? atoi(argv[points + 3]) : 1;
+  if (points) {
+    graph = graph_read_points_file(argv[2], &error);
+  } else {
+    graph = graph_load(argv[1], threads, &error);
+  }
+  if (!graph) {
+    fprintf(stderr, "%s: %s\n", argv[points + 1], error.message);
+    return 1;
+  }
+  if (graph_dump_binary_file(graph, argv[points + 2], &error)) {
+    fprintf(stderr, "%s: %s\n", argv[points + 2], error.message);
+    graph_destroy(graph);
+    return 1;
+  }
+  graph_destroy(graph);
+  return 0;
+}
@@ -0,0 +1,328 @@
+#include "local_search.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Neighbour list slices per pool thread.
+const size_t kNeighborSlicesPerThread = 4;
+// Longest segment moved by Or-opt.
+#define kOrOptMaxSegment 3
+
+typedef struct NeighborSlice {
+  LocalSearch* search;
+  size_t begin;
+  size_t end;
+} NeighborSlice;
+
+// Fill the neighbour lists of the cities in [begin, end) with an
+// insertion sort that only keeps the nearest |neighbors_count|.
+void NeighborTask(void* in) {
+  NeighborSlice* slice = in;
+  const LocalSearch* self = slice->search;
+  const graph_t* graph = self->graph;
+  size_t k = self->neighbors_count;
+  int* weights = malloc(k * sizeof(int));
+  size_t city;
+  assert(weights);
+  for (city = slice->begin; city < slice->end; ++city) {
+    City* neighbors = self->neighbors + city * k;
+    size_t count = 0;
+    size_t other;
+    for (other = 0; other < (size_t)graph->n; ++other) {
+      int weight;
+      size_t i;
+      if (other == city)
+        continue;
+      weight = graph_weight_unchecked(graph, city, other);
+      if (count == k && weight >= weights[k - 1])
+        continue;
+      i = count < k ? count++ : k - 1;
+      for (; i && weights[i - 1] > weight; --i) {
+        weights[i] = weights[i - 1];
+        neighbors[i] = neighbors[i - 1];
+      }
+      weights[i] = weight;
+      neighbors[i] = other;
+    }
+  }
+  free(weights);
+}
+
+void LocalSearchInit(LocalSearch* self, const graph_t* graph,
+                     size_t neighbors_count, ThreadPool* pool) {
+  size_t n = graph->n;
+  size_t slice_count = pool ? pool->thread_count_ * kNeighborSlicesPerThread
+                            : 1;
+  NeighborSlice* slices;
+  ThreadTask* tasks;
+  ThreadTask** task_pointers;
+  size_t i;
+  assert(graph->symmetric && neighbors_count);
+  if (neighbors_count > n - 1)
+    neighbors_count = n - 1;
+  if (slice_count > n)
+    slice_count = n;
+  self->graph = graph;
+  self->neighbors_count = neighbors_count;
+  self->neighbors = malloc(n * neighbors_count * sizeof(City));
+  slices = malloc(slice_count * sizeof(NeighborSlice));
+  tasks = malloc(slice_count * sizeof(ThreadTask));
+  task_pointers = malloc(slice_count * sizeof(ThreadTask*));
+  assert(self->neighbors && slices && tasks && task_pointers);
+  for (i = 0; i < slice_count; ++i) {
+    slices[i].search = self;
+    slices[i].begin = n * i / slice_count;
+    slices[i].end = n * (i + 1) / slice_count;
+    ThreadPoolCreateTask(tasks + i, slices + i, NeighborTask);
+    task_pointers[i] = tasks + i;
+  }
+  if (pool) {
+    ThreadPoolAddTasks(pool, task_pointers, slice_count);
+    ThreadPoolWait(pool);
+  } else {
+    NeighborTask(slices);
+  }
+  free(slices);
+  free(tasks);
+  free(task_pointers);
+}
+
+void LocalSearchDestroy(LocalSearch* self) {
+  free(self->neighbors);
+}
+
+void LocalSearchWorkspaceInit(LocalSearchWorkspace* self, size_t length) {
+  self->positions = malloc(length * sizeof(uint32_t));
+  self->queue = malloc(length * sizeof(City));
+  self->queued = malloc(length);
+  assert(self->positions && self->queue && self->queued);
+  self->length = length;
+}
+
+void LocalSearchWorkspaceDestroy(LocalSearchWorkspace* self) {
+  free(self->positions);
+  free(self->queue);
+  free(self->queued);
+}
+
+// One tour being improved.
+typedef struct SearchState {
+  const LocalSearch* search;
+  City* tour;
+  size_t length;
+  uint32_t* positions;
+  City* queue;
+  uint8_t* queued;
+  size_t queue_head;
+  size_t queue_count;
+  int delta;
+} SearchState;
+
+static inline int Weight(const SearchState* s, City a, City b) {
+  return graph_weight_unchecked(s->search->graph, a, b);
+}
+
+static inline size_t Wrap(const SearchState* s, size_t position) {
+  return position >= s->length ? position - s->length : position;
+}
+
+static inline City Next(const SearchState* s, City city) {
+  return s->tour[Wrap(s, s->positions[city] + 1)];
+}
+
+static inline City Prev(const SearchState* s, City city) {
+  return s->tour[Wrap(s, s->positions[city] + s->length - 1)];
+}
+
+static inline void SetCity(SearchState* s, size_t position, City city) {
+  s->tour[position] = city;
+  s->positions[city] = position;
+}
+
+// Clear the don't-look bit of |city|.
+static inline void Wake(SearchState* s, City city) {
+  if (s->queued[city])
+    return;
+  s->queued[city] = 1;
+  s->queue[Wrap(s, s->queue_head + s->queue_count)] = city;
+  ++s->queue_count;
+}
+
+// Reverse the part of the tour going forward from |from| to |to|.
+// The tour is a cycle, so reversing the rest of it instead gives the
+// same tour; the shorter of the two is done.
+static void Reverse(SearchState* s, size_t from, size_t to) {
+  size_t count = Wrap(s, to + s->length - from) + 1;
+  size_t i;
+  if (2 * count > s->length) {
+    size_t rest_from = Wrap(s, to + 1);
+    to = Wrap(s, from + s->length - 1);
+    from = rest_from;
+    count = s->length - count;
+  }
+  for (i = 0; i < count / 2; ++i) {
+    City left = s->tour[from];
+    SetCity(s, from, s->tour[to]);
+    SetCity(s, to, left);
+    from = Wrap(s, from + 1);
+    to = Wrap(s, to + s->length - 1);
+  }
+}
+
+// 2-opt around the edge (a, b), b following a if |forward| and
+// preceding it otherwise: replace (a, b) and (c, d) with (a, c)
+// and (b, d), for c close to a.
+static int TwoOpt(SearchState* s, City a, int forward) {
+  const City* neighbors = s->search->neighbors + a * s->search->neighbors_count;
+  City b = forward ? Next(s, a) : Prev(s, a);
+  int ab = Weight(s, a, b);
+  size_t i;
+  for (i = 0; i < s->search->neighbors_count; ++i) {
+    City c = neighbors[i];
+    City d;
+    int gain = ab - Weight(s, a, c);
+    if (gain <= 0)
+      break;
+    d = forward ? Next(s, c) : Prev(s, c);
+    if (c == b || d == a)
+      continue;
+    gain += Weight(s, c, d) - Weight(s, b, d);
+    if (gain > 0) {
+      if (forward)
+        Reverse(s, s->positions[b], s->positions[c]);
+      else
+        Reverse(s, s->positions[c], s->positions[b]);
+      s->delta -= gain;
+      Wake(s, a);
+      Wake(s, b);
+      Wake(s, c);
+      Wake(s, d);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Move the |count| cities starting at |start| so that they follow
+// |after|, reversed if |reversed|. The cities between the segment
+// and |after| (or the ones on the other side, whichever are fewer)
+// are shifted over by |count|.
+static void MoveSegment(SearchState* s, size_t start, size_t count,
+                        City after, int reversed) {
+  City segment[kOrOptMaxSegment];
+  size_t between =
+      (s->positions[after] + 2 * s->length - start - count) % s->length + 1;
+  size_t other = s->length - count - between;
+  size_t first;
+  size_t i;
+  for (i = 0; i < count; ++i)
+    segment[i] = s->tour[Wrap(s, start + i)];
+  if (between <= other) {
+    for (i = 0; i < between; ++i)
+      SetCity(s, Wrap(s, start + i), s->tour[Wrap(s, start + count + i)]);
+    first = Wrap(s, start + between);
+  } else {
+    // The tour is a cycle: putting the segment in front of the cities
+    // that precede it gives the same order.
+    first = Wrap(s, start + s->length - other);
+    for (i = other; i; --i)
+      SetCity(s, Wrap(s, first + count + i - 1),
+              s->tour[Wrap(s, first + i - 1)]);
+  }
+  for (i = 0; i < count; ++i)
+    SetCity(s, Wrap(s, first + i), segment[reversed ? count - 1 - i : i]);
+}
+
+// Or-opt: move the segment of up to |kOrOptMaxSegment| cities that
+// starts at |a| next to a city c close to a, either as c, a, ...
+// or reversed as ..., a, c.
+static int OrOpt(SearchState* s, City a) {
+  const City* neighbors = s->search->neighbors + a * s->search->neighbors_count;
+  size_t start = s->positions[a];
+  size_t count;
+  for (count = 1; count <= kOrOptMaxSegment && count + 3 <= s->length;
+       ++count) {
+    City last = s->tour[Wrap(s, start + count - 1)];
+    City prev = Prev(s, a);
+    City next = Next(s, last);
+    int removed = Weight(s, prev, a) + Weight(s, last, next) -
+                  Weight(s, prev, next);
+    size_t i;
+    for (i = 0; i < s->search->neighbors_count; ++i) {
+      City c = neighbors[i];
+      int ca = Weight(s, c, a);
+      City e;
+      int gain;
+      if (ca >= removed)
+        break;
+      if (Wrap(s, s->positions[c] + s->length - start) < count)
+        continue;
+      // c, a, ..., last, e
+      e = Next(s, c);
+      if (e != a) {
+        gain = removed - ca - Weight(s, last, e) + Weight(s, c, e);
+        if (gain > 0) {
+          MoveSegment(s, start, count, c, 0);
+          s->delta -= gain;
+          goto improved;
+        }
+      }
+      // e, last, ..., a, c
+      e = Prev(s, c);
+      if (e != last) {
+        gain = removed - ca - Weight(s, e, last) + Weight(s, e, c);
+        if (gain > 0) {
+          MoveSegment(s, start, count, e, 1);
+          s->delta -= gain;
+          goto improved;
+        }
+      }
+      continue;
+    improved:
+      Wake(s, prev);
+      Wake(s, next);
+      Wake(s, a);
+      Wake(s, last);
+      Wake(s, c);
+      Wake(s, e);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int LocalSearchRun(const LocalSearch* self, City* tour, size_t length,
+                   size_t budget, LocalSearchWorkspace* workspace) {
+  SearchState s;
+  size_t examined = 0;
+  size_t i;
+  assert(workspace->length >= length);
+  if (length < 5 || !self->neighbors_count)
+    return 0;
+  s.search = self;
+  s.tour = tour;
+  s.length = length;
+  s.positions = workspace->positions;
+  s.queue = workspace->queue;
+  s.queued = workspace->queued;
+  s.queue_head = 0;
+  s.queue_count = length;
+  s.delta = 0;
+  // Every city starts with a clear don't-look bit.
+  for (i = 0; i < length; ++i) {
+    s.positions[tour[i]] = i;
+    s.queue[i] = tour[i];
+    s.queued[tour[i]] = 1;
+  }
+  while (s.queue_count && (!budget || examined < budget)) {
+    City a = s.queue[s.queue_head];
+    s.queue_head = Wrap(&s, s.queue_head + 1);
+    --s.queue_count;
+    s.queued[a] = 0;
+    ++examined;
+    if (!TwoOpt(&s, a, 1) && !TwoOpt(&s, a, 0))
+      OrOpt(&s, a);
+  }
+  return s.delta;
+}
@@ -0,0 +1,57 @@
+#ifndef LOCAL_SEARCH_H
+#define LOCAL_SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "graph.h"
+#include "population.h"
+#include "thread_pool.h"
+
+typedef enum LocalSearchTarget {
+  kLocalSearchOff,
+  // Every child is improved right after it has been mutated.
+  kLocalSearchChildren,
+  // Only the children that survive selection are improved.
+  kLocalSearchElites,
+} LocalSearchTarget;
+
+// 2-opt and Or-opt local search over the |neighbors_count| nearest
+// neighbours of every city. Moves are only tried around cities whose
+// "don't look" bit is clear; the bit is set once nothing improves
+// around a city and cleared again when one of its edges changes.
+// The weights have to be symmetric.
+typedef struct LocalSearch {
+  const graph_t* graph;
+  size_t neighbors_count;
+  // |neighbors_count| cities per city, nearest first.
+  City* neighbors;
+} LocalSearch;
+
+// Per-worker memory of |LocalSearchRun|.
+typedef struct LocalSearchWorkspace {
+  // Position of every city in the tour being improved.
+  uint32_t* positions;
+  // Cities with a clear don't-look bit, in a ring of |length|.
+  City* queue;
+  uint8_t* queued;
+  size_t length;
+} LocalSearchWorkspace;
+
+// Build the neighbour lists of |graph| with tasks on |pool|. With a
+// NULL |pool| they are built on the calling thread, which may be a
+// pool task.
+void LocalSearchInit(LocalSearch* self, const graph_t* graph,
+                     size_t neighbors_count, ThreadPool* pool);
+void LocalSearchDestroy(LocalSearch* self);
+
+void LocalSearchWorkspaceInit(LocalSearchWorkspace* self, size_t length);
+void LocalSearchWorkspaceDestroy(LocalSearchWorkspace* self);
+
+// Improve |tour| in place until no move improves it or |budget|
+// cities have been looked at (0 means no limit). Returns the change
+// in fitness, which is never positive.
+int LocalSearchRun(const LocalSearch* self, City* tour, size_t length,
+                   size_t budget, LocalSearchWorkspace* workspace);
+
+#endif
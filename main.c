@@ -1,44 +1,429 @@
 #include <assert.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "cluster.h"
 #include "salesman.h"
 
 const char* kGenerateFlag = "--generate";
 const char* kFileFlag = "--file";
+const char* kPointsFlag = "--points";
+const char* kSeedFlag = "--seed";
+const char* kSelectionFlag = "--selection";
+const char* kTournamentSizeFlag = "--tournament-size";
+const char* kScheduleFlag = "--schedule";
+const char* kLocalSearchFlag = "--local-search";
+const char* kNeighborsFlag = "--neighbors";
+const char* kSearchBudgetFlag = "--search-budget";
+const char* kModelFlag = "--model";
+const char* kTopologyFlag = "--topology";
+const char* kMigrationIntervalFlag = "--migration-interval";
+const char* kMigrantsFlag = "--migrants";
+const char* kCoordinateFlag = "--coordinate";
+const char* kWorkersFlag = "--workers";
+const char* kJoinFlag = "--join";
+const char* kCrossoverFlag = "--crossover";
+const char* kMutationFlag = "--mutation";
+const char* kCheckpointFlag = "--checkpoint";
+const char* kCheckpointIntervalFlag = "--checkpoint-interval";
+const char* kResumeFlag = "--resume";
+const char* kTargetFlag = "--target";
+const char* kMetricsFlag = "--metrics";
+const char* kBatchFlag = "--batch";
+const char* kTimeLimitFlag = "--time-limit";
+const char* kFamilyFlag = "--family";
+const char* kPlacementFlag = "--placement";
+const char* kDuplicatesFlag = "--duplicates";
+const char* kInitFlag = "--init";
 const size_t kGraphWeightMax = 16;
+// Side of the square the points of generated Euclidean graphs are in.
+const int kGraphSquareSide = 1000;
+
+// Set by the first SIGINT, which stops the run as if its time was up.
+// The second one kills the process.
+atomic_int interrupted;
+
+void OnInterrupt(int signal) {
+  (void)signal;
+  atomic_store(&interrupted, 1);
+}
+
+// One line per operator, so runs can be compared by how fast each
+// one improves tours and not just by the final fitness.
+void PrintOperatorStats(const char* kind, const char* name,
+                        const OperatorStats* stats) {
+  if (!stats->calls)
+    return;
+  printf("%s %s: %lu calls, %lu improvements, gain %ld in %lf s "
+         "(%lf per second)\n",
+         kind, name, stats->calls, stats->improvements, (long)stats->gain,
+         stats->seconds, stats->seconds > 0 ? stats->gain / stats->seconds : 0);
+}
+
+// Prints why |value| doesn't do for |flag| and returns the exit
+// status for it.
+int BadValue(const char* flag, const char* value) {
+  fprintf(stderr, "bad %s value %s\n", flag, value);
+  return 1;
+}
+
+// Reads the whole of |text| as a count of at least |min| into |value|.
+int ParseCount(const char* flag, const char* text, size_t min,
+               size_t* value) {
+  int end = 0;
+  if (*text == '-' || sscanf(text, "%lu%n", value, &end) != 1 ||
+      text[end] || *value < min)
+    return BadValue(flag, text);
+  return 0;
+}
+
+int ParseInt(const char* flag, const char* text, int* value) {
+  int end = 0;
+  if (sscanf(text, "%d%n", value, &end) != 1 || text[end])
+    return BadValue(flag, text);
+  return 0;
+}
+
+int ParseSeconds(const char* flag, const char* text, double* value) {
+  int end = 0;
+  if (sscanf(text, "%lf%n", value, &end) != 1 || text[end] || *value < 0)
+    return BadValue(flag, text);
+  return 0;
+}
+
+// A random graph of |n| cities. Without a |family| (-1) the weights
+// come from rand(), otherwise the graph only depends on |seed|, see
+// |graph_generate_seeded|.
+graph_t* Generate(int n, int family, uint64_t seed, size_t threads) {
+  if (family < 0)
+    return graph_generate(n, kGraphWeightMax);
+  return graph_generate_seeded(
+      n, family == GRAPH_FAMILY_UNIFORM ? kGraphWeightMax : kGraphSquareSide,
+      family, seed, threads);
+}
+
+// Solve |count| random graphs of |n| cities as one batch, printing
+// the best fitness of each and the overall throughput. Graph i of a
+// |family| is generated from seed |options->seed| + i.
+int SolveBatch(size_t count, int n, int family, size_t t, size_t N, size_t S,
+               const ShortestPathOptions* options) {
+  graph_t** graphs = malloc(count * sizeof(graph_t*));
+  int* best_fitness = malloc(count * sizeof(int));
+  ShortestPathData* results = malloc(count * sizeof(ShortestPathData));
+  SolverContext* context = SolverContextCreate(t);
+  struct timespec begin;
+  struct timespec end;
+  double time;
+  size_t i;
+  int failed;
+  assert(graphs && best_fitness && results);
+  if (options->pin_workers)
+    SolverContextPin(context);
+  for (i = 0; i < count; ++i) {
+    graphs[i] = Generate(n, family, options->seed + i, t);
+    results[i].best_path = NULL;
+    results[i].workers = NULL;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  failed = SolverContextSolveBatch(context, (const graph_t* const*)graphs,
+                                   count, N, S, options, best_fitness,
+                                   results);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  time = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1.0e9;
+  for (i = 0; i < count; ++i) {
+    if (!failed)
+      printf("Graph %lu best: %d generations: %lu time: %lf\n", i,
+             best_fitness[i], results[i].iterations, results[i].time);
+    graph_destroy(graphs[i]);
+  }
+  if (!failed)
+    printf("%lu graphs in %lf s (%lf per second)\n", count, time,
+           count / time);
+  SolverContextDelete(context);
+  free(graphs);
+  free(best_fitness);
+  free(results);
+  return failed ? 1 : 0;
+}
+
+// Phase times, then the worker counters summed over the workers.
+void PrintMetrics(const ShortestPathData* result, size_t thread_count) {
+  WorkerMetrics total = {0};
+  size_t i;
+  printf("phases:");
+  for (i = 0; i < kPhaseCount; ++i)
+    printf(" %s %lf", SolverPhaseName(i), result->phase_time[i]);
+  for (i = 0; i < thread_count; ++i) {
+    total.tasks += result->workers[i].tasks;
+    total.steals += result->workers[i].steals;
+    total.streams += result->workers[i].streams;
+    total.busy += result->workers[i].busy;
+    total.idle += result->workers[i].idle;
+    total.lock_wait += result->workers[i].lock_wait;
+  }
+  printf("\nworkers: %lu tasks, %lu steals, %lu streams, busy %lf s, "
+         "idle %lf s, lock wait %lf s\n",
+         total.tasks, total.steals, total.streams, total.busy, total.idle,
+         total.lock_wait);
+  // Only the global model splits the phases into tasks.
+  if (result->breed_task_size)
+    printf("tasks: breed %lu children, mutate %lu children\n",
+           result->breed_task_size, result->mutate_task_size);
+}
 
 int main(int argc, char* argv[]) {
   graph_t* graph;
+  graph_error error;
   size_t t;
   size_t N;
   size_t S;
+  // Cities of a --generate graph.
+  size_t n = 0;
   ShortestPathData result;
   FILE* stats;
   int best_fitness;
-  assert(argc == 6);
-  assert(sscanf(argv[1], "%lu", &t));
-  assert(sscanf(argv[2], "%lu", &N));
-  assert(sscanf(argv[3], "%lu", &S));
-  srand(time(NULL));
+  ShortestPathOptions options;
+  size_t seed = time(NULL);
+  // Cluster mode, see cluster.h.
+  const char* coordinate_address = NULL;
+  const char* join_address = NULL;
+  size_t workers = 1;
+  // Checkpoint to carry on from.
+  const char* resume_path = NULL;
+  // Random graphs to solve at once, see |SolveBatch|.
+  size_t batch = 0;
+  struct sigaction action;
+  // Generator of --generate graphs, -1 for the rand() one.
+  int family = -1;
+  if (argc < 6 || (strcmp(argv[4], kFileFlag) &&
+                    strcmp(argv[4], kPointsFlag) &&
+                    strcmp(argv[4], kGenerateFlag))) {
+    fprintf(stderr, "usage: %s threads population generations %s|%s|%s "
+            "graph [flag value]...\n", argv[0], kFileFlag, kPointsFlag,
+            kGenerateFlag);
+    return 1;
+  }
+  if (ParseCount("threads", argv[1], 1, &t) ||
+      ParseCount("population", argv[2], 1, &N) ||
+      ParseCount("generations", argv[3], 0, &S) ||
+      (!strcmp(argv[4], kGenerateFlag) &&
+       ParseCount(kGenerateFlag, argv[5], 1, &n)))
+    return 1;
+  ShortestPathDefaultOptions(&options);
+  // Optional flags, each followed by its value.
+  for (int arg = 6; arg < argc; arg += 2) {
+    if (arg + 1 == argc) {
+      fprintf(stderr, "%s needs a value\n", argv[arg]);
+      return 1;
+    }
+    if (!strcmp(argv[arg], kSeedFlag)) {
+      if (ParseCount(kSeedFlag, argv[arg + 1], 0, &seed))
+        return 1;
+    } else if (!strcmp(argv[arg], kSelectionFlag)) {
+      if (!strcmp(argv[arg + 1], "tournament")) {
+        options.selection = kSelectionTournament;
+      } else if (!strcmp(argv[arg + 1], "truncation")) {
+        options.selection = kSelectionTruncation;
+      } else {
+        return BadValue(argv[arg], argv[arg + 1]);
+      }
+    } else if (!strcmp(argv[arg], kScheduleFlag)) {
+      if (!strcmp(argv[arg + 1], "two-phase")) {
+        options.schedule = kScheduleTwoPhase;
+      } else if (!strcmp(argv[arg + 1], "fused")) {
+        options.schedule = kScheduleFused;
+      } else {
+        return BadValue(argv[arg], argv[arg + 1]);
+      }
+    } else if (!strcmp(argv[arg], kLocalSearchFlag)) {
+      if (!strcmp(argv[arg + 1], "children")) {
+        options.local_search = kLocalSearchChildren;
+      } else if (!strcmp(argv[arg + 1], "elites")) {
+        options.local_search = kLocalSearchElites;
+      } else if (!strcmp(argv[arg + 1], "off")) {
+        options.local_search = kLocalSearchOff;
+      } else {
+        return BadValue(argv[arg], argv[arg + 1]);
+      }
+    } else if (!strcmp(argv[arg], kNeighborsFlag)) {
+      if (ParseCount(kNeighborsFlag, argv[arg + 1], 0,
+                     &options.local_search_neighbors))
+        return 1;
+    } else if (!strcmp(argv[arg], kSearchBudgetFlag)) {
+      if (ParseCount(kSearchBudgetFlag, argv[arg + 1], 0,
+                     &options.local_search_budget))
+        return 1;
+    } else if (!strcmp(argv[arg], kModelFlag)) {
+      if (!strcmp(argv[arg + 1], "islands")) {
+        options.model = kModelIslands;
+      } else if (!strcmp(argv[arg + 1], "global")) {
+        options.model = kModelGlobal;
+      } else {
+        return BadValue(argv[arg], argv[arg + 1]);
+      }
+    } else if (!strcmp(argv[arg], kTopologyFlag)) {
+      if (!strcmp(argv[arg + 1], "random")) {
+        options.migration_topology = kTopologyRandom;
+      } else if (!strcmp(argv[arg + 1], "ring")) {
+        options.migration_topology = kTopologyRing;
+      } else {
+        return BadValue(argv[arg], argv[arg + 1]);
+      }
+    } else if (!strcmp(argv[arg], kMigrationIntervalFlag)) {
+      if (ParseCount(kMigrationIntervalFlag, argv[arg + 1], 1,
+                     &options.migration_interval))
+        return 1;
+    } else if (!strcmp(argv[arg], kMigrantsFlag)) {
+      if (ParseCount(kMigrantsFlag, argv[arg + 1], 1, &options.migrants))
+        return 1;
+    } else if (!strcmp(argv[arg], kCoordinateFlag)) {
+      coordinate_address = argv[arg + 1];
+    } else if (!strcmp(argv[arg], kWorkersFlag)) {
+      if (ParseCount(kWorkersFlag, argv[arg + 1], 1, &workers))
+        return 1;
+    } else if (!strcmp(argv[arg], kJoinFlag)) {
+      join_address = argv[arg + 1];
+    } else if (!strcmp(argv[arg], kCrossoverFlag)) {
+      int op = CrossoverOperatorByName(argv[arg + 1]);
+      if (op < 0)
+        return BadValue(argv[arg], argv[arg + 1]);
+      options.crossover = op;
+    } else if (!strcmp(argv[arg], kMutationFlag)) {
+      int op = MutationOperatorByName(argv[arg + 1]);
+      if (op < 0)
+        return BadValue(argv[arg], argv[arg + 1]);
+      options.mutation = op;
+    } else if (!strcmp(argv[arg], kCheckpointFlag)) {
+      options.checkpoint_path = argv[arg + 1];
+    } else if (!strcmp(argv[arg], kCheckpointIntervalFlag)) {
+      if (ParseCount(kCheckpointIntervalFlag, argv[arg + 1], 1,
+                     &options.checkpoint_interval))
+        return 1;
+    } else if (!strcmp(argv[arg], kResumeFlag)) {
+      resume_path = argv[arg + 1];
+    } else if (!strcmp(argv[arg], kTargetFlag)) {
+      if (ParseInt(kTargetFlag, argv[arg + 1], &options.target_fitness))
+        return 1;
+    } else if (!strcmp(argv[arg], kMetricsFlag)) {
+      options.metrics_path = argv[arg + 1];
+    } else if (!strcmp(argv[arg], kBatchFlag)) {
+      if (ParseCount(kBatchFlag, argv[arg + 1], 0, &batch))
+        return 1;
+    } else if (!strcmp(argv[arg], kFamilyFlag)) {
+      family = graph_family_by_name(argv[arg + 1]);
+      if (family < 0)
+        return BadValue(argv[arg], argv[arg + 1]);
+    } else if (!strcmp(argv[arg], kTimeLimitFlag)) {
+      if (ParseSeconds(kTimeLimitFlag, argv[arg + 1], &options.time_limit))
+        return 1;
+    } else if (!strcmp(argv[arg], kDuplicatesFlag)) {
+      if (!strcmp(argv[arg + 1], "count")) {
+        options.duplicates = kDuplicatesCount;
+      } else if (!strcmp(argv[arg + 1], "drop")) {
+        options.duplicates = kDuplicatesDrop;
+      } else if (strcmp(argv[arg + 1], "keep")) {
+        return BadValue(argv[arg], argv[arg + 1]);
+      }
+    } else if (!strcmp(argv[arg], kInitFlag)) {
+      if (SeedMixParse(&options.seeding, argv[arg + 1]))
+        return 1;
+    } else if (!strcmp(argv[arg], kPlacementFlag)) {
+      if (!strcmp(argv[arg + 1], "pinned")) {
+        options.pin_workers = 1;
+      } else if (strcmp(argv[arg + 1], "off")) {
+        return BadValue(argv[arg], argv[arg + 1]);
+      }
+    } else if (!strcmp(argv[arg], kTournamentSizeFlag)) {
+      if (ParseCount(kTournamentSizeFlag, argv[arg + 1], 1,
+                     &options.tournament_size))
+        return 1;
+    } else {
+      fprintf(stderr, "unknown flag %s\n", argv[arg]);
+      return 1;
+    }
+  }
+  options.seed = seed;
+  srand(seed);
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = OnInterrupt;
+  action.sa_flags = SA_RESETHAND;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  atomic_init(&interrupted, 0);
+  options.cancel = &interrupted;
 
+  if (batch) {
+    // Only generated graphs, the same size each.
+    if (strcmp(argv[4], kGenerateFlag)) {
+      fprintf(stderr, "%s needs %s graphs\n", kBatchFlag, kGenerateFlag);
+      return 1;
+    }
+    return SolveBatch(batch, n, family, t, N, S, &options);
+  }
   if (!strcmp(argv[4], kFileFlag)) {
-    graph = graph_read_file(argv[5]);
+    // Text or binary, told apart by the file itself.
+    graph = graph_load(argv[5], t, &error);
+  } else if (!strcmp(argv[4], kPointsFlag)) {
+    graph = graph_read_points_file(argv[5], &error);
   } else {
-    assert(!strcmp(argv[4], kGenerateFlag));
-    graph = graph_generate(atoi(argv[5]), kGraphWeightMax);
+    graph = Generate(n, family, seed, t);
+  }
+  // Generated graphs are always there.
+  if (!graph) {
+    fprintf(stderr, "%s: %s\n", argv[5], error.message);
+    return 1;
   }
   result.best_path = malloc(graph->n * sizeof(int));
-  best_fitness = ShortestPath(graph, t, N, S, &result);
+  result.time_to_target = -1;
+  result.workers = malloc(t * sizeof(WorkerMetrics));
+  if (coordinate_address) {
+    best_fitness = ClusterCoordinate(coordinate_address, workers, graph, S,
+                                     &result);
+  } else if (join_address) {
+    // The coordinator writes the statistics of the whole run.
+    best_fitness = ClusterWork(join_address, graph, t, N, &options, &result);
+    free(result.best_path);
+    free(result.workers);
+    graph_destroy(graph);
+    return best_fitness < 0;
+  } else {
+    if (resume_path) {
+      // The population size and seed are the checkpoint's.
+      best_fitness = ShortestPathResume(graph, t, resume_path, S, &options,
+                                        &result);
+    } else {
+      best_fitness = ShortestPath(graph, t, N, S, &options, &result);
+    }
+    PrintOperatorStats("crossover", CrossoverOperatorName(options.crossover),
+                       &result.crossover);
+    PrintOperatorStats("mutation", MutationOperatorName(options.mutation),
+                       &result.mutation);
+    if (best_fitness >= 0)
+      PrintMetrics(&result, t);
+    if (best_fitness >= 0 && result.stopped)
+      printf("Stopped after %lu generations\n", result.iterations);
+  }
+  if (best_fitness < 0) {
+    free(result.best_path);
+    free(result.workers);
+    graph_destroy(graph);
+    return 1;
+  }
   stats = fopen("stats.txt", "w");
-  fprintf(stats, "%lu %lu %lu %d %lu %lf %d\n", t, N, S, graph->n,
-          result.iterations, result.time, best_fitness);
+  // Then the throughput in children per second and the seconds it
+  // took to reach the --target fitness (-1 if it wasn't).
+  fprintf(stats, "%lu %lu %lu %d %lu %lf %d %lf %lf\n", t, N, S, graph->n,
+          result.iterations, result.time, best_fitness,
+          result.children / result.time, result.time_to_target);
   for (int i = 0; i < graph->n; i++) {
     fprintf(stats, "%d ", result.best_path[i]);
   }
   fprintf(stats, "\n");
   free(result.best_path);
+  free(result.workers);
   graph_destroy(graph);
 }
\ No newline at end of file
@@ -0,0 +1,3 @@
+#include "metrics.h"
+
+_Thread_local WorkerCounters* metrics_worker = NULL;
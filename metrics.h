@@ -0,0 +1,70 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+// Hot path instrumentation. A counter is only ever added to by the
+// thread it belongs to, with relaxed loads and stores that cost the
+// same as plain ones, while any other thread may read it at any time.
+// Build with -DSALESMAN_NO_METRICS to compile all of it away.
+typedef atomic_uint_least64_t MetricsCounter;
+
+// Counters of one pool worker, times are in nanoseconds.
+typedef struct WorkerCounters {
+  MetricsCounter tasks;
+  MetricsCounter steals;
+  // Random streams started, see |RandomChunkInit|.
+  MetricsCounter streams;
+  MetricsCounter busy;
+  MetricsCounter idle;
+  MetricsCounter lock_wait;
+} WorkerCounters;
+
+// Counters of the pool worker running on this thread, NULL on any
+// other thread.
+extern _Thread_local WorkerCounters* metrics_worker;
+
+// Whether metrics are compiled in, for work that only feeds them.
+#ifdef SALESMAN_NO_METRICS
+#define kMetricsEnabled 0
+#else
+#define kMetricsEnabled 1
+#endif
+
+// Monotonic time in nanoseconds, 0 when metrics are compiled out.
+static inline uint64_t MetricsNow(void) {
+#ifdef SALESMAN_NO_METRICS
+  return 0;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+#endif
+}
+
+static inline void MetricsAdd(MetricsCounter* counter, uint64_t amount) {
+#ifndef SALESMAN_NO_METRICS
+  atomic_store_explicit(
+      counter, atomic_load_explicit(counter, memory_order_relaxed) + amount,
+      memory_order_relaxed);
+#endif
+}
+
+static inline uint64_t MetricsRead(const MetricsCounter* counter) {
+  return atomic_load_explicit((MetricsCounter*)counter, memory_order_relaxed);
+}
+
+// Add to a counter of the calling worker, if it is one.
+#ifdef SALESMAN_NO_METRICS
+#define MetricsAddToWorker(field, amount) ((void)(amount))
+#else
+#define MetricsAddToWorker(field, amount)         \
+  do {                                            \
+    if (metrics_worker)                           \
+      MetricsAdd(&metrics_worker->field, amount); \
+  } while (0)
+#endif
+
+#endif
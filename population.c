@@ -0,0 +1,43 @@
+#include "population.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+const size_t kMaxCities = (size_t)1 << (8 * sizeof(City));
+
+void* AlignedAlloc(size_t size) {
+  const size_t kAlignment = 64;
+  void* result = aligned_alloc(kAlignment,
+                               (size + kAlignment - 1) / kAlignment * kAlignment);
+  assert(result);
+  return result;
+}
+
+void PopulationInit(Population* self, size_t count, size_t length) {
+  self->count = count;
+  self->length = length;
+  self->tours = AlignedAlloc(count * length * sizeof(City));
+  self->fitness = AlignedAlloc(count * sizeof(int));
+  self->tours_capacity = count * length;
+  self->fitness_capacity = count;
+}
+
+void PopulationDestroy(Population* self) {
+  free(self->tours);
+  free(self->fitness);
+}
+
+void PopulationReserve(Population* self, size_t count, size_t length) {
+  if (count * length > self->tours_capacity) {
+    free(self->tours);
+    self->tours = AlignedAlloc(count * length * sizeof(City));
+    self->tours_capacity = count * length;
+  }
+  if (count > self->fitness_capacity) {
+    free(self->fitness);
+    self->fitness = AlignedAlloc(count * sizeof(int));
+    self->fitness_capacity = count;
+  }
+  self->count = count;
+  self->length = length;
+}
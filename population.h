@@ -0,0 +1,47 @@
+#ifndef POPULATION_H
+#define POPULATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Cities are stored as 16-bit indices, which halves the size of
+// every tour. Build with -DSALESMAN_WIDE_CITIES for larger graphs.
+#ifdef SALESMAN_WIDE_CITIES
+typedef uint32_t City;
+#else
+typedef uint16_t City;
+#endif
+
+// Largest number of cities a tour can hold.
+extern const size_t kMaxCities;
+
+// All tours of one generation, stored back to back in a single
+// aligned slab, with their fitness kept in a separate array.
+// Tours are referred to by their index in the population.
+typedef struct Population {
+  City* tours;
+  int* fitness;
+  size_t count;
+  size_t length;
+  // Tours and fitness values there is room for.
+  size_t tours_capacity;
+  size_t fitness_capacity;
+} Population;
+
+static inline City* PopulationTour(const Population* self, size_t index) {
+  return self->tours + index * self->length;
+}
+
+// Allocate room for |count| tours of |length| cities each.
+void PopulationInit(Population* self, size_t count, size_t length);
+void PopulationDestroy(Population* self);
+
+// Resize |self| to |count| tours of |length| cities, keeping its
+// memory if there is room enough. The tours are left undefined. A
+// zeroed population may be reserved without |PopulationInit|.
+void PopulationReserve(Population* self, size_t count, size_t length);
+
+// malloc with cache line alignment, never returns NULL.
+void* AlignedAlloc(size_t size);
+
+#endif
@@ -0,0 +1,79 @@
+#include "progress_log.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void* ProgressLogThread(void* in) {
+  ProgressLog* self = in;
+  for (;;) {
+    ProgressReport* record;
+    sem_wait(&self->posted_);
+    // A post stands for a record, but the ring hands out records in
+    // the order their slots were claimed: one claimed earlier may not
+    // be published yet. Wait for it rather than spend the post. The
+    // stop is posted once every push is done, so an empty ring then
+    // is really empty.
+    while (!(record = QueuePop(&self->ready_))) {
+      if (atomic_load(&self->stop_) && QueueEmpty(&self->ready_))
+        return NULL;
+      sched_yield();
+    }
+    self->callback_(self->context_, record);
+    QueuePush(&self->free_, record);
+  }
+}
+
+int ProgressLogInit(ProgressLog* self, size_t capacity,
+                    ProgressCallback callback, void* context) {
+  size_t i;
+  assert(callback && capacity);
+  self->callback_ = callback;
+  self->context_ = context;
+  self->records_ = malloc(capacity * sizeof(ProgressReport));
+  assert(self->records_);
+  QueueInit(&self->ready_, capacity);
+  QueueInit(&self->free_, capacity);
+  for (i = 0; i < capacity; ++i)
+    QueuePush(&self->free_, self->records_ + i);
+  sem_init(&self->posted_, 0, 0);
+  atomic_init(&self->stop_, 0);
+  atomic_init(&self->dropped_, 0);
+  if (pthread_create(&self->thread_, NULL, ProgressLogThread, self)) {
+    fprintf(stderr, "cannot start the progress log thread\n");
+    sem_destroy(&self->posted_);
+    QueueDestroy(&self->ready_);
+    QueueDestroy(&self->free_);
+    free(self->records_);
+    return -1;
+  }
+  return 0;
+}
+
+void ProgressLogDestroy(ProgressLog* self) {
+  // Every record was posted before the stop, and the thread only
+  // stops on a post it finds no record for, with the ring empty.
+  atomic_store(&self->stop_, 1);
+  sem_post(&self->posted_);
+  pthread_join(self->thread_, NULL);
+  sem_destroy(&self->posted_);
+  QueueDestroy(&self->ready_);
+  QueueDestroy(&self->free_);
+  free(self->records_);
+}
+
+void ProgressLogPush(ProgressLog* self, const ProgressReport* report) {
+  ProgressReport* record = QueuePop(&self->free_);
+  if (!record) {
+    atomic_fetch_add_explicit(&self->dropped_, 1, memory_order_relaxed);
+    return;
+  }
+  *record = *report;
+  QueuePush(&self->ready_, record);
+  sem_post(&self->posted_);
+}
+
+size_t ProgressLogDropped(ProgressLog* self) {
+  return atomic_load(&self->dropped_);
+}
@@ -0,0 +1,60 @@
+#ifndef PROGRESS_LOG_H
+#define PROGRESS_LOG_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+// One line of progress of a run.
+typedef struct ProgressReport {
+  // The island that improved, or -1 for a generation of the global
+  // model.
+  int island;
+  size_t generation;
+  int best;
+  int worst;
+  double average;
+  // Share of distinct tours among the children, -1 if duplicates are
+  // not looked for.
+  double diversity;
+  // Seconds since the run started.
+  double time;
+} ProgressReport;
+
+typedef void (*ProgressCallback)(void* context, const ProgressReport* report);
+
+// Hands progress reports from the solver threads to a callback run by
+// a thread of its own, so that no solver thread ever waits for I/O.
+// Reports go through a lock-free ring of |capacity| records; when the
+// callback falls behind that far, new reports are dropped.
+typedef struct ProgressLog {
+  ProgressCallback callback_;
+  void* context_;
+  ProgressReport* records_;
+  // Filled records, in order, and the free ones.
+  Queue ready_;
+  Queue free_;
+  // Posted once per filled record, and once to stop.
+  sem_t posted_;
+  atomic_int stop_;
+  atomic_size_t dropped_;
+  pthread_t thread_;
+} ProgressLog;
+
+// Returns 0, or -1 if the thread could not be started, which leaves
+// nothing to destroy.
+int ProgressLogInit(ProgressLog* self, size_t capacity,
+                    ProgressCallback callback, void* context);
+// Hands every report still in the ring to the callback first.
+void ProgressLogDestroy(ProgressLog* self);
+
+// Never blocks, safe to call from any number of threads.
+void ProgressLogPush(ProgressLog* self, const ProgressReport* report);
+
+// Reports dropped so far because the ring was full.
+size_t ProgressLogDropped(ProgressLog* self);
+
+#endif
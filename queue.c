@@ -3,63 +3,91 @@
 #include <assert.h>
 #include <stdlib.h>
 
-struct QueueNode {
+// Every cell carries a sequence number telling whose turn it is:
+// it equals the cursor value of the producer that may fill it, and
+// that value plus one once it holds data for the matching consumer.
+struct QueueCell {
+  atomic_size_t sequence;
   void* data;
-  struct QueueNode* next;
 };
 
-typedef struct QueueNode QueueNode;
+typedef struct QueueCell QueueCell;
 
-void QueueInit(Queue* self) {
-  self->top_ = NULL;
-  self->back_ = NULL;
-}
-
-void QueueDestroy(Queue* self) {
-  if (!self->top_)
-    return;
-  QueueNode* cursor = self->top_->next;
-  QueueNode* to_delete = self->top_;
-  while (cursor != NULL) {
-    free(to_delete);
-    to_delete = cursor;
-    cursor = cursor->next;
+void QueueInit(Queue* self, size_t capacity) {
+  size_t size = 2;
+  size_t i;
+  while (size < capacity)
+    size *= 2;
+  self->cells_ = malloc(size * sizeof(QueueCell));
+  assert(self->cells_);
+  self->mask_ = size - 1;
+  for (i = 0; i < size; ++i) {
+    atomic_store_explicit(&(self->cells_[i].sequence), i, memory_order_relaxed);
+    self->cells_[i].data = NULL;
   }
-  free(to_delete);
+  atomic_store(&(self->push_cursor_), 0);
+  atomic_store(&(self->pop_cursor_), 0);
 }
 
-void* QueueTop(const Queue* self) {
-  if (!self->top_)
-    return NULL;
-  else
-    return self->top_->data;
+void QueueDestroy(Queue* self) {
+  free(self->cells_);
+  self->cells_ = NULL;
 }
 
 void* QueuePop(Queue* self) {
-  if (!self->top_) {
-    return NULL;
+  size_t cursor = atomic_load_explicit(&(self->pop_cursor_),
+                                       memory_order_relaxed);
+  for (;;) {
+    QueueCell* cell = self->cells_ + (cursor & self->mask_);
+    size_t sequence = atomic_load_explicit(&(cell->sequence),
+                                           memory_order_acquire);
+    ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)(cursor + 1);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+              &(self->pop_cursor_), &cursor, cursor + 1,
+              memory_order_relaxed, memory_order_relaxed)) {
+        void* data = cell->data;
+        atomic_store_explicit(&(cell->sequence), cursor + self->mask_ + 1,
+                              memory_order_release);
+        return data;
+      }
+    } else if (diff < 0) {
+      return NULL;
+    } else {
+      cursor = atomic_load_explicit(&(self->pop_cursor_),
+                                    memory_order_relaxed);
+    }
   }
-  void* data = self->top_->data;
-  QueueNode* to_cleanup = self->top_;
-  self->top_ = to_cleanup->next;
-  if (!self->top_)
-    self->back_ = NULL;
-  free(to_cleanup);
-  return data;
 }
 
-void QueuePush(Queue* self, void* data) {
-  QueueNode* new_back = malloc(sizeof(QueueNode));
+int QueuePush(Queue* self, void* data) {
+  size_t cursor = atomic_load_explicit(&(self->push_cursor_),
+                                       memory_order_relaxed);
   assert(data);
-  new_back->next = NULL;
-  new_back->data = data;
-  if (!self->back_)
-    self->top_ = new_back;
-  else
-    self->back_->next = new_back;
-  self->back_ = new_back;
+  for (;;) {
+    QueueCell* cell = self->cells_ + (cursor & self->mask_);
+    size_t sequence = atomic_load_explicit(&(cell->sequence),
+                                           memory_order_acquire);
+    ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)cursor;
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+              &(self->push_cursor_), &cursor, cursor + 1,
+              memory_order_relaxed, memory_order_relaxed)) {
+        cell->data = data;
+        atomic_store_explicit(&(cell->sequence), cursor + 1,
+                              memory_order_release);
+        return 1;
+      }
+    } else if (diff < 0) {
+      return 0;
+    } else {
+      cursor = atomic_load_explicit(&(self->push_cursor_),
+                                    memory_order_relaxed);
+    }
+  }
 }
 
 int QueueEmpty(Queue* self) {
-  return self->top_ == NULL;
+  return atomic_load(&(self->push_cursor_)) ==
+         atomic_load(&(self->pop_cursor_));
 }
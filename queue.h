@@ -1,26 +1,41 @@
-struct QueueNode;
+#ifndef QUEUE_H
+#define QUEUE_H
 
+#include <stdatomic.h>
+#include <stddef.h>
+
+struct QueueCell;
+
+// Bounded lock-free multi-producer multi-consumer queue.
 typedef struct Queue {
-  struct QueueNode* top_;
-  struct QueueNode* back_;
+  struct QueueCell* cells_;
+  size_t mask_;
+  // Producers and consumers hammer different counters, keep them
+  // on separate cache lines.
+  char pad0_[64];
+  atomic_size_t push_cursor_;
+  char pad1_[64];
+  atomic_size_t pop_cursor_;
+  char pad2_[64];
 } Queue;
 
-// Initialize an empty queue.
-void QueueInit(Queue* self);
+// Initialize an empty queue that can hold at least |capacity|
+// elements. All the memory is allocated here.
+void QueueInit(Queue* self, size_t capacity);
 
 // Destroy a queue.
 void QueueDestroy(Queue* self);
 
-// Return a topmost queue element without removing it
-// from the queue. Empty queue returns NULL.
-void* QueueTop(const Queue* self);
-
 // Return a topmost queue element, removing it from the queue.
 // Empty queue returns NULL.
 void* QueuePop(Queue* self);
 
-// Add an element to the top of the queue.
-void QueuePush(Queue* self, void* value);
+// Add an element to the back of the queue.
+// Returns 0 if the queue is full, 1 otherwise.
+int QueuePush(Queue* self, void* value);
 
-// Returns 1 if the queue is empty, 0 otherwise.
+// Returns 1 if the queue is empty, 0 otherwise. With concurrent
+// users the answer may be stale by the time it is returned.
 int QueueEmpty(Queue* self);
+
+#endif
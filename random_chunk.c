@@ -1,44 +1,67 @@
 #include "random_chunk.h"
 
+#include <assert.h>
 #include <stddef.h>
 #include <stdlib.h>
 
-typedef struct RandomChunk {
-  unsigned* chunk;
-  size_t cursor;
-  size_t length;
-  RandomProvider* provider;
-} RandomChunk;
+#include "metrics.h"
 
-RandomChunk* RandomChunkCreate(RandomProvider* provider) {
+RandomChunk* RandomChunkCreate(RandomProvider* provider, uint64_t stream) {
   RandomChunk* self = (RandomChunk*)malloc(sizeof(RandomChunk));
-  self->chunk = RandomProviderPopRandom(provider);
-  self->cursor = 0;
-  self->length = kRandomQueueChunkSize;
-  self->provider = provider;
+  RandomChunkInit(self, provider, stream);
   return self;
 }
 
 void RandomChunkDelete(RandomChunk* self) {
-  free(self->chunk);
+  RandomChunkDestroy(self);
   free(self);
 }
 
+void RandomChunkInit(RandomChunk* self, RandomProvider* provider,
+                     uint64_t stream) {
+  MetricsAddToWorker(streams, 1);
+  RandomProviderSeedStream(provider, stream, self->state);
+}
+
+void RandomChunkDestroy(RandomChunk* self) {
+}
+
+static inline uint64_t RotateLeft(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+uint64_t RandomChunkPopRandomLong(RandomChunk* self) {
+  uint64_t* s = self->state;
+  uint64_t result = RotateLeft(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = RotateLeft(s[3], 45);
+  return result;
+}
+
 unsigned RandomChunkPopRandom(RandomChunk* self) {
-  unsigned to_ret = self->chunk[self->cursor];
-  if (++(self->cursor) == self->length) {
-    free(self->chunk);
-    self->chunk = RandomProviderPopRandom(self->provider);
-    self->cursor = 0;
-  }
-  return to_ret;
+  // The upper bits are the strongest ones.
+  return (unsigned)(RandomChunkPopRandomLong(self) >> 32);
 }
 
-size_t RandomChunkPopRandomLong(RandomChunk* self) {
-  size_t result = 0;
-  size_t cursor;
-  for (cursor = 0; cursor < sizeof(size_t) / sizeof(unsigned); ++cursor) {
-    ((unsigned*)&result)[cursor] = RandomChunkPopRandom(self);
+size_t RandomChunkPopRandomBelow(RandomChunk* self, size_t bound) {
+  // Lemire's multiply-and-shift: the high half of random * bound is
+  // uniform once the few values from the uneven low part are rejected.
+  unsigned __int128 product;
+  uint64_t low;
+  assert(bound);
+  product = (unsigned __int128)RandomChunkPopRandomLong(self) * bound;
+  low = (uint64_t)product;
+  if (low < bound) {
+    uint64_t threshold = -(uint64_t)bound % bound;
+    while (low < threshold) {
+      product = (unsigned __int128)RandomChunkPopRandomLong(self) * bound;
+      low = (uint64_t)product;
+    }
   }
-  return result;
-}
\ No newline at end of file
+  return (size_t)(product >> 64);
+}
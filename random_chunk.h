@@ -1,12 +1,32 @@
+#ifndef RANDOM_CHUNK_H
+#define RANDOM_CHUNK_H
+
 #include "random_provider.h"
 
-typedef struct RandomChunk RandomChunk;
+// A stream of random numbers (xoshiro256**) derived from a provider.
+// Owned by a single thread at a time, it shares no state with other
+// streams. Can live on the stack, see |RandomChunkInit|.
+typedef struct RandomChunk {
+  uint64_t state[4];
+} RandomChunk;
 
-// Create a random chunk associated with this random provider.
+// Create stream number |stream| of this random provider.
 // Does not assume responsibility for it.
-RandomChunk* RandomChunkCreate(RandomProvider* provider);
+RandomChunk* RandomChunkCreate(RandomProvider* provider, uint64_t stream);
 void RandomChunkDelete(RandomChunk* self);
 
+// Same as |RandomChunkCreate|/|RandomChunkDelete|, but for a chunk
+// whose memory is owned by the caller.
+void RandomChunkInit(RandomChunk* self, RandomProvider* provider,
+                     uint64_t stream);
+void RandomChunkDestroy(RandomChunk* self);
+
 unsigned RandomChunkPopRandom(RandomChunk* self);
 
-size_t RandomChunkPopRandomLong(RandomChunk* self);
\ No newline at end of file
+uint64_t RandomChunkPopRandomLong(RandomChunk* self);
+
+// Uniform number in [0, |bound|), without the bias of taking
+// a remainder. |bound| must be positive.
+size_t RandomChunkPopRandomBelow(RandomChunk* self, size_t bound);
+
+#endif
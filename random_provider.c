@@ -1,99 +1,49 @@
 #include "random_provider.h"
 
 #include <assert.h>
-#include <pthread.h>
-#include <stdatomic.h>
-#include <stdio.h>
 #include <stdlib.h>
 
-#include "queue.h"
-
-const size_t kRandomQueueSize = 64;
-const size_t kRandomQueueChunkSize = 1024;
-
 struct RandomProvider {
-  Queue queue_;
-  size_t queue_size_;
-  pthread_mutex_t mutex_;
-  pthread_cond_t cond_consumer_;
-  pthread_cond_t cond_producer_;
-  atomic_int shutdown_;
-  pthread_t thread_;
+  uint64_t seed_;
 };
 
-void* GenerateRandomChunk(size_t size) {
-  size_t i;
-  unsigned* chunk = (unsigned*)malloc(sizeof(unsigned) * kRandomQueueChunkSize);
-  for (i = 0; i < kRandomQueueChunkSize; i++) {
-    chunk[i] = rand();
-  }
-  return chunk;
-}
-
-void* RandomProviderThreadJob(void* in) {
-  RandomProvider* self = (RandomProvider*)in;
-  pthread_mutex_lock(&(self->mutex_));
-  // printf("START\n");
-  while (!atomic_load(&(self->shutdown_))) {
-    while (self->queue_size_ < kRandomQueueSize) {
-      QueuePush(&(self->queue_), GenerateRandomChunk(kRandomQueueChunkSize));
-      ++self->queue_size_;
-      pthread_mutex_unlock(&(self->mutex_));
-      pthread_cond_signal(&(self->cond_consumer_));
-      // Let the other threads grab a fresh chunk.
-      pthread_mutex_lock(&(self->mutex_));
-    }
-    pthread_cond_wait(&(self->cond_producer_), &(self->mutex_));
-  }
-  return NULL;
+// SplitMix64 step, used to expand (seed, stream) into a full
+// generator state.
+uint64_t SplitMix64(uint64_t* state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
 }
 
-RandomProvider* RandomProviderCreate() {
+RandomProvider* RandomProviderCreate(uint64_t seed) {
   RandomProvider* self = (RandomProvider*)malloc(sizeof(RandomProvider));
-  pthread_mutex_init(&(self->mutex_), NULL);
-  QueueInit(&(self->queue_));
-  self->queue_size_ = 0;
-  pthread_cond_init(&(self->cond_consumer_), NULL);
-  pthread_cond_init(&(self->cond_producer_), NULL);
-  atomic_store(&(self->shutdown_), 0);
-  pthread_create(&(self->thread_), NULL, RandomProviderThreadJob, self);
+  assert(self);
+  self->seed_ = seed;
   return self;
 }
 
 void RandomProviderDelete(RandomProvider* self) {
-  void* queue_el;
-  RandomProviderShutdown(self);
-  pthread_cond_signal(&(self->cond_producer_));
-  pthread_join(self->thread_, NULL);
-  pthread_mutex_destroy(&(self->mutex_));
-  pthread_cond_destroy(&(self->cond_producer_));
-  pthread_cond_destroy(&(self->cond_consumer_));
-  while ((queue_el = QueuePop(&(self->queue_)))) {
-    free(queue_el);
-  }
-  assert(QueueEmpty(&(self->queue_)));
-  QueueDestroy(&(self->queue_));
   free(self);
 }
 
-unsigned* RandomProviderPopRandom(RandomProvider* self) {
-  unsigned* to_return;
-  pthread_mutex_lock(&(self->mutex_));
-  while (self->queue_size_ == 0) {
-    pthread_cond_wait(&(self->cond_consumer_), &(self->mutex_));
-  }
-  to_return = (unsigned*)QueuePop(&(self->queue_));
-  if (--self->queue_size_ != 0) {
-    pthread_cond_signal(&(self->cond_consumer_));
-  }
-  if (self->queue_size_ < kRandomQueueSize / 2) {
-    pthread_cond_signal(&(self->cond_producer_));
-  }
-  pthread_mutex_unlock(&(self->mutex_));
-  return to_return;
+uint64_t RandomProviderGetSeed(const RandomProvider* self) {
+  return self->seed_;
 }
 
-void RandomProviderShutdown(RandomProvider* self) {
-  atomic_store(&(self->shutdown_), 1);
-  pthread_cond_signal(&(self->cond_producer_));
-}
\ No newline at end of file
+void RandomProviderSeedStream(const RandomProvider* self, uint64_t stream,
+                              uint64_t state[4]) {
+  // Hash the seed, add the stream and hash again, so that
+  // neighbouring streams (and seeds) start far apart and swapping the
+  // seed and the stream gives another key.
+  uint64_t mixer = self->seed_;
+  uint64_t key = SplitMix64(&mixer) + stream * 0x9E3779B97F4A7C15ull;
+  size_t i;
+  key = SplitMix64(&key);
+  for (i = 0; i < 4; ++i) {
+    state[i] = SplitMix64(&key);
+  }
+  // All-zero state is the one xoshiro can't leave.
+  if (!(state[0] | state[1] | state[2] | state[3]))
+    state[0] = 1;
+}
@@ -1,22 +1,24 @@
+#ifndef RANDOM_PROVIDER_H
+#define RANDOM_PROVIDER_H
+
 #include <stddef.h>
+#include <stdint.h>
 
 struct RandomProvider;
 
-struct RandomChunk;
-
-// How many |unsigned|'s are there in a chunk.
-extern const size_t kRandomQueueChunkSize;
-
 typedef struct RandomProvider RandomProvider;
 
-RandomProvider* RandomProviderCreate();
+// The provider only holds the seed, every |RandomChunk| derives its
+// own independent stream from it. It is never written to after
+// creation, so any number of threads may share it without locking.
+RandomProvider* RandomProviderCreate(uint64_t seed);
 void RandomProviderDelete(RandomProvider* self);
 
-// Shut down the provider, stopping new blocks from
-// creating.
-void RandomProviderShutdown(RandomProvider* self);
+uint64_t RandomProviderGetSeed(const RandomProvider* self);
+
+// Fill |state| with the initial generator state of stream number
+// |stream|. The same seed and stream always give the same state.
+void RandomProviderSeedStream(const RandomProvider* self, uint64_t stream,
+                              uint64_t state[4]);
 
-// Pop an array of |kRandomQueueChunkSize| size
-// (transferring ownership to caller).
-// If the queue is empty, blocks until completion.
-unsigned* RandomProviderPopRandom(RandomProvider* self);
\ No newline at end of file
+#endif
@@ -3,307 +3,2767 @@
 #include <assert.h>
 #include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/time.h>
 
+#include "checkpoint.h"
 #include "graph.h"
+#include "local_search.h"
+#include "metrics.h"
+#include "population.h"
+#include "queue.h"
 #include "random_chunk.h"
 #include "random_provider.h"
+#include "seeding.h"
+#include "selection.h"
+#include "stop_control.h"
 #include "thread_pool.h"
+#include "topology.h"
+#include "tour_set.h"
 
 const size_t kReproductionFactor = 4;
 const size_t kSwapsPerMutation = 1;
+// Children per random stream of the global model on graphs of up to
+// |kStreamBlockCities| cities, fewer on larger ones, see |TaskTuner|.
 const size_t kPathsPerMutationTask = 16;
 const size_t kPathsPerCrossoverTask = 64;
+const size_t kPathsPerBreedTask = 32;
+const size_t kStreamBlockCities = 512;
+const size_t kPathsPerImproveTask = 4;
+// A task should take about this long: long enough that scheduling it
+// is noise, short enough to balance the load.
+const double kTaskTargetSeconds = 100e-6;
+// Generations over which the task sizes are tuned.
+const size_t kTuningGenerations = 8;
+// Tasks per worker and phase the tuner never goes below.
+const size_t kMinTasksPerThread = 4;
+// Longest run of cities shuffled by the scramble mutation.
+const size_t kScrambleLength = 8;
+// Slices of the children per worker in the passes over duplicates.
+const size_t kDuplicateSlicesPerThread = 4;
+// Only one operator call in this many is timed, reading the clock
+// around every call costs more than most operators do.
+const size_t kOperatorTimingInterval = 64;
 
-typedef struct Path {
-  int* path;
-  int fitness;
+// Per-worker memory handed to the kernels so they don't have to
+// allocate anything. |stamps| marks the cities seen by the current
+// call: a city is marked if its stamp equals |stamp|, so starting a
+// new call is just incrementing |stamp|. The other arrays are free
+// for any kernel to use as it likes.
+typedef struct Scratch {
+  uint32_t* stamps;
+  uint32_t stamp;
   size_t length;
-} Path;
+  // |length| each.
+  uint32_t* positions;
+  uint32_t* sizes;
+  // 2 * |length| + 2 cities, 6 * |length| cities and 2 * |length|
+  // counts.
+  City* cities;
+  City* edges;
+  uint8_t* degrees;
+  LocalSearchWorkspace search;
+  // Nearest neighbours of every city for EAX, NULL if there are none.
+  const LocalSearch* nearest;
+  // The graph of the run, or its copy on the NUMA node of this
+  // worker, see |SolverContextPin|.
+  const graph_t* graph;
+  // Operators run by this worker.
+  OperatorStats crossover_stats;
+  OperatorStats mutation_stats;
+} Scratch;
+
+void ScratchInit(Scratch* self, size_t length) {
+  self->stamps = calloc(length, sizeof(uint32_t));
+  self->positions = malloc(length * sizeof(uint32_t));
+  self->sizes = malloc(length * sizeof(uint32_t));
+  self->cities = malloc((2 * length + 2) * sizeof(City));
+  self->edges = malloc(6 * length * sizeof(City));
+  self->degrees = malloc(2 * length);
+  assert(self->stamps && self->positions && self->sizes && self->cities &&
+         self->edges && self->degrees);
+  self->stamp = 0;
+  self->length = length;
+  self->nearest = NULL;
+  self->graph = NULL;
+  LocalSearchWorkspaceInit(&(self->search), length);
+  memset(&(self->crossover_stats), 0, sizeof(OperatorStats));
+  memset(&(self->mutation_stats), 0, sizeof(OperatorStats));
+}
+
+void ScratchDestroy(Scratch* self) {
+  free(self->stamps);
+  free(self->positions);
+  free(self->sizes);
+  free(self->cities);
+  free(self->edges);
+  free(self->degrees);
+  LocalSearchWorkspaceDestroy(&(self->search));
+}
 
-int PathCompare(const void* a, const void* b) {
-  const Path* a_path = (const Path*)a;
-  const Path* b_path = (const Path*)b;
-  return a_path->fitness - b_path->fitness;
+// Start a new marking round, returns the stamp to mark cities with.
+static inline uint32_t ScratchNextStamp(Scratch* self) {
+  if (++self->stamp == 0) {
+    // Wrapped around after 2^32 rounds, old marks could match again.
+    memset(self->stamps, 0, self->length * sizeof(uint32_t));
+    self->stamp = 1;
+  }
+  return self->stamp;
 }
 
+typedef int (*CrossoverKernel)(const City* left, const City* right,
+                               City* result, size_t length,
+                               const graph_t* graph, RandomChunk* chunk,
+                               Scratch* scratch);
+typedef int (*MutationKernel)(City* path, size_t length,
+                              const graph_t* graph, RandomChunk* chunk,
+                              Scratch* scratch);
+
 typedef struct MutateJob {
   RandomProvider* provider;
-  Path* paths;
-  const graph_t* graph;
+  uint64_t stream;
+  Population* paths;
+  size_t offset;
   size_t paths_count;
+  const ThreadPool* pool;
+  Scratch* scratches;
+  MutationKernel mutate;
+  // Improves the mutated tours if not NULL.
+  const LocalSearch* search;
+  size_t search_budget;
+  StopControl* control;
+  // If not NULL, the hash of every finished tour goes here and into
+  // |tours|.
+  uint64_t* hashes;
+  TourSet* tours;
+  // Every |block| tours take the next stream after |stream|.
+  size_t block;
+  // How long the task took.
+  double seconds;
 } MutateJob;
 
 typedef struct CrossoverJob {
   RandomProvider* provider;
-  const Path* paths;
-  size_t paths_count;
-  Path* output;
+  uint64_t stream;
+  const Population* parents;
+  // Indices of the tours in |parents| that survived selection.
+  const size_t* survivors;
+  size_t survivors_count;
+  Population* output;
+  size_t offset;
   size_t output_count;
+  const ThreadPool* pool;
+  Scratch* scratches;
+  CrossoverKernel crossover;
+  // Used by the fused schedule only.
+  MutationKernel mutate;
+  // Improves the mutated children in the fused schedule if not NULL.
+  const LocalSearch* search;
+  size_t search_budget;
+  StopControl* control;
+  // Fused schedule only: if not NULL, the hash of every finished child
+  // goes here and into |tours|.
+  uint64_t* hashes;
+  TourSet* tours;
+  // Every |block| children take the next stream after |stream|.
+  size_t block;
+  // How long the task took.
+  double seconds;
 } CrossoverJob;
 
-void StopTask(void* in) {
-  ThreadPool* pool = in;
-  ThreadPoolShutdown(pool);
-}
+// Local search over the survivors of a generation.
+typedef struct ImproveJob {
+  const LocalSearch* search;
+  size_t search_budget;
+  Population* paths;
+  const size_t* indices;
+  size_t offset;
+  size_t paths_count;
+  const ThreadPool* pool;
+  Scratch* scratches;
+  StopControl* control;
+} ImproveJob;
 
-int Fitness(const Path* path, const graph_t* graph) {
+int Fitness(const City* path, size_t length, const graph_t* graph) {
   int result = 0;
-  assert(path->length > 1);
-  int first = 0;
-  int second = 1;
-  for (; second < path->length; ++first, ++second) {
-    result += graph_weight(graph, path->path[first], path->path[second]);
+  assert(length > 1);
+  size_t first = 0;
+  size_t second = 1;
+  for (; second < length; ++first, ++second) {
+    result += graph_weight_unchecked(graph, path[first], path[second]);
   }
-  result += graph_weight(graph, 0, path->path[path->length - 1]);
+  result += graph_weight_unchecked(graph, path[length - 1], path[0]);
   return result;
 }
 
-int VerifyPermutation(const Path* path) {
-  int* used = calloc(path->length, sizeof(int));
+// Weight of the edge leaving position |pos| of a closed tour.
+static inline int EdgeWeight(const City* path, size_t length, size_t pos,
+                             const graph_t* graph) {
+  size_t next = pos + 1 == length ? 0 : pos + 1;
+  return graph_weight_unchecked(graph, path[pos], path[next]);
+}
+
+// Swap the cities at |pos1| and |pos2| and return how the fitness
+// of the tour changed. Only the (at most four) edges touching the
+// two positions are looked at.
+int SwapCities(City* path, size_t length, size_t pos1, size_t pos2,
+               const graph_t* graph) {
+  size_t edges[4];
+  size_t edge_count = 0;
+  size_t candidates[4];
   size_t i;
-  for (i = 0; i < path->length; ++i) {
-    used[path->path[i]] = 1;
+  int delta = 0;
+  City temp;
+  if (pos1 == pos2)
+    return 0;
+  candidates[0] = pos1 ? pos1 - 1 : length - 1;
+  candidates[1] = pos1;
+  candidates[2] = pos2 ? pos2 - 1 : length - 1;
+  candidates[3] = pos2;
+  // Neighbouring positions share edges, count each of them once.
+  for (i = 0; i < 4; ++i) {
+    size_t j;
+    for (j = 0; j < edge_count && edges[j] != candidates[i]; ++j) {
+    }
+    if (j == edge_count)
+      edges[edge_count++] = candidates[i];
   }
-  for (i = 0; i < path->length; ++i) {
-    if (!used[i]) {
-      for (size_t j = 0; j < path->length; ++j)
-        printf("%d ", used[j]);
+  for (i = 0; i < edge_count; ++i)
+    delta -= EdgeWeight(path, length, edges[i], graph);
+  temp = path[pos1];
+  path[pos1] = path[pos2];
+  path[pos2] = temp;
+  for (i = 0; i < edge_count; ++i)
+    delta += EdgeWeight(path, length, edges[i], graph);
+  return delta;
+}
+
+int VerifyPermutation(const City* path, size_t length, Scratch* scratch) {
+  uint32_t stamp = ScratchNextStamp(scratch);
+  size_t i;
+  assert(scratch->length >= length);
+  for (i = 0; i < length; ++i) {
+    if (path[i] >= length || scratch->stamps[path[i]] == stamp) {
+      for (size_t j = 0; j < length; ++j)
+        printf("%d ", path[j]);
       printf("\n");
       return 0;
     }
+    scratch->stamps[path[i]] = stamp;
   }
-  free(used);
   return 1;
 }
 
 // Mutate algorithm: randomly swap vertices
-// in the path.
-void Mutate(Path* path, RandomChunk* chunk) {
-  assert(VerifyPermutation(path));
+// in the path. Returns the change in fitness.
+int Mutate(City* path, size_t length, const graph_t* graph,
+           RandomChunk* chunk, Scratch* scratch) {
+  assert(VerifyPermutation(path, length, scratch));
   size_t i;
+  int delta = 0;
   for (i = 0; i < kSwapsPerMutation; i++) {
-    size_t rand1 = RandomChunkPopRandom(chunk);
-    size_t rand2 = RandomChunkPopRandom(chunk);
-    size_t pos1 = rand1 % path->length;
-    size_t pos2 = rand2 % path->length;
-    int temp = path->path[pos1];
-    path->path[pos1] = path->path[pos2];
-    path->path[pos2] = temp;
+    size_t pos1 = RandomChunkPopRandomBelow(chunk, length);
+    size_t pos2 = RandomChunkPopRandomBelow(chunk, length);
+    delta += SwapCities(path, length, pos1, pos2, graph);
   }
-  assert(VerifyPermutation(path));
+  assert(VerifyPermutation(path, length, scratch));
+  return delta;
 }
 
-void MutateTask(void* in) {
+// Sum of the |count| edges leaving the positions from |pos| on.
+static int EdgesWeight(const City* path, size_t length, size_t pos,
+                       size_t count, const graph_t* graph) {
+  int weight = 0;
+  for (; count; --count) {
+    weight += EdgeWeight(path, length, pos, graph);
+    pos = pos + 1 == length ? 0 : pos + 1;
+  }
+  return weight;
+}
+
+// Two distinct random positions, in order.
+static void RandomSlice(RandomChunk* chunk, size_t length, size_t* first,
+                        size_t* last) {
+  size_t a = RandomChunkPopRandomBelow(chunk, length);
+  size_t b = RandomChunkPopRandomBelow(chunk, length - 1);
+  if (b >= a)
+    ++b;
+  *first = a < b ? a : b;
+  *last = a < b ? b : a;
+}
+
+// Reverse the cities at positions [first, last].
+static void ReverseCities(City* path, size_t first, size_t last) {
+  for (; first < last; ++first, --last) {
+    City temp = path[first];
+    path[first] = path[last];
+    path[last] = temp;
+  }
+}
+
+// Inversion: reverse the cities between two random positions.
+// On symmetric graphs only the two edges at the ends change.
+int InversionMutate(City* path, size_t length, const graph_t* graph,
+                    RandomChunk* chunk, Scratch* scratch) {
+  size_t first;
+  size_t last;
+  size_t prev;
+  size_t edges;
+  int before;
+  RandomSlice(chunk, length, &first, &last);
+  prev = first ? first - 1 : length - 1;
+  // Edges leaving the positions from |prev| to |last|.
+  edges = last - first + 2 > length ? length : last - first + 2;
+  if (graph->symmetric) {
+    // All the cities, or all but one: the same cycle, backwards.
+    if (edges == length) {
+      ReverseCities(path, first, last);
+      return 0;
+    }
+    before = EdgeWeight(path, length, prev, graph) +
+             EdgeWeight(path, length, last, graph);
+    ReverseCities(path, first, last);
+    return EdgeWeight(path, length, prev, graph) +
+           EdgeWeight(path, length, last, graph) - before;
+  }
+  before = EdgesWeight(path, length, prev, edges, graph);
+  ReverseCities(path, first, last);
+  return EdgesWeight(path, length, prev, edges, graph) - before;
+}
+
+// Scramble: shuffle a random run of at most |kScrambleLength|
+// cities.
+int ScrambleMutate(City* path, size_t length, const graph_t* graph,
+                   RandomChunk* chunk, Scratch* scratch) {
+  size_t longest = length < kScrambleLength ? length : kScrambleLength;
+  size_t count = 2 + RandomChunkPopRandomBelow(chunk, longest - 1);
+  size_t first = RandomChunkPopRandomBelow(chunk, length - count + 1);
+  size_t prev = first ? first - 1 : length - 1;
+  size_t edges = count + 1 > length ? length : count + 1;
+  int before = EdgesWeight(path, length, prev, edges, graph);
   size_t i;
-  MutateJob* task = (MutateJob*)in;
-  RandomChunk* chunk = RandomChunkCreate(task->provider);
-  for (i = 0; i < task->paths_count; ++i) {
-    Path* path = task->paths + i;
-    Mutate(path, chunk);
-    path->fitness = Fitness(path, task->graph);
-    assert(path->fitness > 0);
+  for (i = count - 1; i; --i) {
+    size_t j = RandomChunkPopRandomBelow(chunk, i + 1);
+    City temp = path[first + i];
+    path[first + i] = path[first + j];
+    path[first + j] = temp;
   }
-  RandomChunkDelete(chunk);
-  free(task);
+  return EdgesWeight(path, length, prev, edges, graph) - before;
 }
 
 // Crossover algorithm: first half of the path is taken from the
 // |left| parent, the rest of the vertices appear in the same order
-// as in the |right| parent.
-void Crossover(const Path* left, const Path* right, Path* result) {
-  int* used = calloc(left->length, sizeof(int));
+// as in the |right| parent. Returns the fitness of the result,
+// summed up while the child is being written.
+int Crossover(const City* left, const City* right, City* result,
+              size_t length, const graph_t* graph, RandomChunk* chunk,
+              Scratch* scratch) {
+  uint32_t* used = scratch->stamps;
+  uint32_t stamp = ScratchNextStamp(scratch);
+  size_t half = length / 2;
   size_t result_cursor;
   size_t right_cursor;
-  result->length = left->length;
-  assert(right->length == left->length);
-  for (result_cursor = 0; result_cursor < result->length / 2; ++result_cursor) {
-    result->path[result_cursor] = left->path[result_cursor];
-    used[left->path[result_cursor]] = 1;
-  }
-  for (right_cursor = 0; right_cursor < right->length; ++right_cursor) {
-    if (!used[right->path[right_cursor]]) {
-      result->path[result_cursor] = right->path[right_cursor];
-      used[right->path[right_cursor]] = 1;
+  int fitness = 0;
+  // The straight copy is left to memcpy, which is vectorised.
+  memcpy(result, left, half * sizeof(City));
+  for (result_cursor = 0; result_cursor < half; ++result_cursor) {
+    used[result[result_cursor]] = stamp;
+  }
+  for (result_cursor = 1; result_cursor < half; ++result_cursor) {
+    fitness += graph_weight_unchecked(graph, result[result_cursor - 1],
+                                      result[result_cursor]);
+  }
+  result_cursor = half;
+  for (right_cursor = 0; right_cursor < length; ++right_cursor) {
+    City city = right[right_cursor];
+    if (used[city] != stamp) {
+      result[result_cursor] = city;
+      if (result_cursor)
+        fitness +=
+            graph_weight_unchecked(graph, result[result_cursor - 1], city);
       ++result_cursor;
     }
   }
-  assert(VerifyPermutation(result));
-  free(used);
+  fitness += graph_weight_unchecked(graph, result[length - 1], result[0]);
+  assert(VerifyPermutation(result, length, scratch));
+  assert(fitness == Fitness(result, length, graph));
+  return fitness;
+}
+
+// Order crossover (OX): a random slice of the |left| parent keeps
+// its place, the rest of the cities follow in the order of the
+// |right| parent, starting after the slice.
+int OrderCrossover(const City* left, const City* right, City* result,
+                   size_t length, const graph_t* graph, RandomChunk* chunk,
+                   Scratch* scratch) {
+  uint32_t* used = scratch->stamps;
+  uint32_t stamp = ScratchNextStamp(scratch);
+  size_t first;
+  size_t last;
+  size_t cursor;
+  size_t source;
+  size_t filled;
+  size_t i;
+  RandomSlice(chunk, length, &first, &last);
+  memcpy(result + first, left + first, (last - first + 1) * sizeof(City));
+  for (i = first; i <= last; ++i)
+    used[result[i]] = stamp;
+  cursor = last + 1 == length ? 0 : last + 1;
+  source = cursor;
+  for (filled = last - first + 1; filled < length;
+       source = source + 1 == length ? 0 : source + 1) {
+    City city = right[source];
+    if (used[city] != stamp) {
+      result[cursor] = city;
+      cursor = cursor + 1 == length ? 0 : cursor + 1;
+      ++filled;
+    }
+  }
+  assert(VerifyPermutation(result, length, scratch));
+  return Fitness(result, length, graph);
+}
+
+// Partially mapped crossover (PMX): a random slice comes from the
+// |left| parent and the rest of the child is the |right| parent,
+// where every city displaced by the slice takes the place the
+// slice city left behind.
+int PartiallyMappedCrossover(const City* left, const City* right,
+                             City* result, size_t length,
+                             const graph_t* graph, RandomChunk* chunk,
+                             Scratch* scratch) {
+  uint32_t* positions = scratch->positions;
+  size_t first;
+  size_t last;
+  size_t i;
+  RandomSlice(chunk, length, &first, &last);
+  memcpy(result, right, length * sizeof(City));
+  for (i = 0; i < length; ++i)
+    positions[result[i]] = i;
+  for (i = first; i <= last; ++i) {
+    City city = left[i];
+    City displaced = result[i];
+    size_t from = positions[city];
+    result[i] = city;
+    positions[city] = i;
+    result[from] = displaced;
+    positions[displaced] = from;
+  }
+  assert(VerifyPermutation(result, length, scratch));
+  return Fitness(result, length, graph);
+}
+
+// Add |to| to the neighbours of |from|, |slots| of them per city.
+static void AddNeighbor(City* neighbors, size_t slots, uint8_t* degrees,
+                        City from, City to) {
+  City* list = neighbors + slots * from;
+  uint8_t i;
+  for (i = 0; i < degrees[from]; ++i) {
+    if (list[i] == to)
+      return;
+  }
+  list[degrees[from]++] = to;
+}
+
+static void RemoveNeighbor(City* neighbors, size_t slots, uint8_t* degrees,
+                           City from, City to) {
+  City* list = neighbors + slots * from;
+  uint8_t i;
+  for (i = 0; i < degrees[from]; ++i) {
+    if (list[i] == to) {
+      list[i] = list[--degrees[from]];
+      return;
+    }
+  }
+}
+
+// Edge recombination (ERX): the child walks the union of the edges
+// of both parents, always going on to the neighbour that has the
+// fewest edges left (ties are broken at random), and jumps to a
+// random unvisited city when it runs out of edges.
+int EdgeRecombination(const City* left, const City* right, City* result,
+                      size_t length, const graph_t* graph,
+                      RandomChunk* chunk, Scratch* scratch) {
+  City* neighbors = scratch->edges;
+  uint8_t* degrees = scratch->degrees;
+  City* unvisited = scratch->cities;
+  uint32_t* positions = scratch->positions;
+  size_t unvisited_count = length;
+  City current;
+  size_t i;
+  memset(degrees, 0, length);
+  for (i = 0; i < length; ++i) {
+    size_t next = i + 1 == length ? 0 : i + 1;
+    AddNeighbor(neighbors, 4, degrees, left[i], left[next]);
+    AddNeighbor(neighbors, 4, degrees, left[next], left[i]);
+    AddNeighbor(neighbors, 4, degrees, right[i], right[next]);
+    AddNeighbor(neighbors, 4, degrees, right[next], right[i]);
+    unvisited[i] = i;
+    positions[i] = i;
+  }
+  current = left[0];
+  for (i = 0; i < length; ++i) {
+    const City* list = neighbors + 4 * (size_t)current;
+    size_t position = positions[current];
+    size_t ties = 0;
+    uint8_t fewest = UINT8_MAX;
+    City next = current;
+    uint8_t j;
+    result[i] = current;
+    // Take |current| out of the unvisited cities and the edge lists.
+    unvisited[position] = unvisited[--unvisited_count];
+    positions[unvisited[position]] = position;
+    for (j = 0; j < degrees[current]; ++j)
+      RemoveNeighbor(neighbors, 4, degrees, list[j], current);
+    if (!unvisited_count)
+      break;
+    for (j = 0; j < degrees[current]; ++j) {
+      City candidate = list[j];
+      if (degrees[candidate] < fewest) {
+        fewest = degrees[candidate];
+        next = candidate;
+        ties = 1;
+      } else if (degrees[candidate] == fewest &&
+                 !RandomChunkPopRandomBelow(chunk, ++ties)) {
+        next = candidate;
+      }
+    }
+    if (next == current)
+      next = unvisited[RandomChunkPopRandomBelow(chunk, unvisited_count)];
+    current = next;
+  }
+  assert(VerifyPermutation(result, length, scratch));
+  return Fitness(result, length, graph);
+}
+
+// Replace the link of |city| to |from| with one to |to|.
+static inline void Relink(City* links, City city, City from, City to) {
+  if (links[2 * (size_t)city] == from) {
+    links[2 * (size_t)city] = to;
+  } else {
+    assert(links[2 * (size_t)city + 1] == from);
+    links[2 * (size_t)city + 1] = to;
+  }
+}
+
+// The city after |city| when coming from |prev| on a cycle of links.
+static inline City NextLink(const City* links, City city, City prev) {
+  City next = links[2 * (size_t)city];
+  return next != prev ? next : links[2 * (size_t)city + 1];
+}
+
+// Cheapest way found so far to join a subtour to another one:
+// the edges (cities[0], cities[1]) and (cities[2], cities[3]) are
+// replaced by (cities[0], cities[2]) and (cities[1], cities[3]), or
+// crosswise if |crossed|.
+typedef struct Join {
+  City cities[4];
+  int delta;
+  int crossed;
+} Join;
+
+// Try to join the subtour of the edge (city, next) to the one of
+// |other| through either edge of |other|.
+static void TryJoin(Join* join, const City* links, const uint32_t* positions,
+                    size_t subtour, City city, City next, City other,
+                    const graph_t* graph) {
+  int removed = graph_weight_unchecked(graph, city, next);
+  int k;
+  if (positions[other] == subtour)
+    return;
+  for (k = 0; k < 2; ++k) {
+    City other_next = links[2 * (size_t)other + k];
+    int both = removed + graph_weight_unchecked(graph, other, other_next);
+    int straight = graph_weight_unchecked(graph, city, other) +
+                   graph_weight_unchecked(graph, next, other_next) - both;
+    int cross = graph_weight_unchecked(graph, city, other_next) +
+                graph_weight_unchecked(graph, next, other) - both;
+    if (straight < join->delta || cross < join->delta) {
+      join->delta = straight < cross ? straight : cross;
+      join->crossed = cross < straight;
+      join->cities[0] = city;
+      join->cities[1] = next;
+      join->cities[2] = other;
+      join->cities[3] = other_next;
+    }
+  }
+}
+
+// Edge assembly crossover with a single AB-cycle (EAX-1AB). Starting
+// from the |left| parent, a cycle that alternates between edges only
+// the left and edges only the right parent has is traced from a
+// random city. The left edges of the cycle are then swapped for the
+// right ones, which leaves a set of subtours. Those are joined
+// greedily, smallest first, by the cheapest exchange of one edge of
+// the subtour with one edge of another subtour, looking only at the
+// nearest neighbours of the subtour's cities when there are any.
+int EdgeAssembly(const City* left, const City* right, City* result,
+                 size_t length, const graph_t* graph, RandomChunk* chunk,
+                 Scratch* scratch) {
+  // Neighbours in the child being assembled, and the edges only the
+  // left or only the right parent has, two slots per city.
+  City* links = scratch->edges;
+  City* only_left = scratch->edges + 2 * length;
+  City* only_right = scratch->edges + 4 * length;
+  uint8_t* left_count = scratch->degrees;
+  uint8_t* right_count = scratch->degrees + length;
+  City* walk = scratch->cities;
+  uint32_t* positions = scratch->positions;
+  uint32_t* sizes = scratch->sizes;
+  size_t walk_length = 1;
+  size_t components = 0;
+  size_t merges;
+  size_t start;
+  size_t i;
+  if (length < 5) {
+    memcpy(result, left, length * sizeof(City));
+    return Fitness(result, length, graph);
+  }
+  for (i = 0; i < length; ++i)
+    positions[right[i]] = i;
+  for (i = 0; i < length; ++i) {
+    City city = left[i];
+    City prev = left[i ? i - 1 : length - 1];
+    City next = left[i + 1 == length ? 0 : i + 1];
+    size_t position = positions[city];
+    City right_prev = right[position ? position - 1 : length - 1];
+    City right_next = right[position + 1 == length ? 0 : position + 1];
+    links[2 * (size_t)city] = prev;
+    links[2 * (size_t)city + 1] = next;
+    left_count[city] = 0;
+    right_count[city] = 0;
+    if (prev != right_prev && prev != right_next)
+      only_left[2 * (size_t)city + left_count[city]++] = prev;
+    if (next != right_prev && next != right_next)
+      only_left[2 * (size_t)city + left_count[city]++] = next;
+    if (right_prev != prev && right_prev != next)
+      only_right[2 * (size_t)city + right_count[city]++] = right_prev;
+    if (right_next != prev && right_next != next)
+      only_right[2 * (size_t)city + right_count[city]++] = right_next;
+  }
+  // A random city with an edge only the left parent has. If there is
+  // none, the parents are the same tour.
+  start = RandomChunkPopRandomBelow(chunk, length);
+  for (i = 0; i < length && !left_count[start]; ++i)
+    start = start + 1 == length ? 0 : start + 1;
+  if (i == length) {
+    memcpy(result, left, length * sizeof(City));
+    return Fitness(result, length, graph);
+  }
+  // Every city has as many left-only as right-only edges, so the
+  // walk can only get stuck where it started.
+  walk[0] = start;
+  for (;;) {
+    City from = walk[walk_length - 1];
+    City to = only_left[2 * (size_t)from + left_count[from] - 1];
+    --left_count[from];
+    RemoveNeighbor(only_left, 2, left_count, to, from);
+    walk[walk_length++] = to;
+    from = to;
+    assert(right_count[from]);
+    to = only_right[2 * (size_t)from + right_count[from] - 1];
+    --right_count[from];
+    RemoveNeighbor(only_right, 2, right_count, to, from);
+    walk[walk_length++] = to;
+    if (to == start)
+      break;
+    assert(left_count[to]);
+  }
+  // Every pass through a city swaps one left edge for a right one.
+  for (i = 0; i + 1 < walk_length; i += 2) {
+    City prev = i ? walk[i - 1] : walk[walk_length - 2];
+    Relink(links, walk[i], walk[i + 1], prev);
+    Relink(links, walk[i + 1], walk[i], walk[i + 2]);
+  }
+  // Label the subtours, |positions| now holds the subtour of a city
+  // and |walk| the first city of every subtour.
+  for (i = 0; i < length; ++i)
+    positions[i] = UINT32_MAX;
+  for (i = 0; i < length; ++i) {
+    City city = i;
+    City prev = links[2 * i + 1];
+    if (positions[i] != UINT32_MAX)
+      continue;
+    walk[components] = i;
+    sizes[components] = 0;
+    do {
+      City next = NextLink(links, city, prev);
+      positions[city] = components;
+      ++sizes[components];
+      prev = city;
+      city = next;
+    } while (city != i);
+    ++components;
+  }
+  for (merges = 1; merges < components; ++merges) {
+    size_t smallest = components;
+    Join join;
+    City city;
+    City prev;
+    size_t j;
+    // Merged subtours have their size cleared.
+    for (j = 0; j < components; ++j) {
+      if (sizes[j] && (smallest == components || sizes[j] < sizes[smallest]))
+        smallest = j;
+    }
+    join.delta = INT_MAX;
+    // Joins to nearby cities first, every city if there are none.
+    for (j = scratch->nearest ? 0 : 1; j < 2 && join.delta == INT_MAX; ++j) {
+      city = walk[smallest];
+      prev = links[2 * (size_t)city + 1];
+      do {
+        City next = NextLink(links, city, prev);
+        size_t other;
+        if (j) {
+          for (other = 0; other < length; ++other)
+            TryJoin(&join, links, positions, smallest, city, next, other,
+                    graph);
+        } else {
+          size_t count = scratch->nearest->neighbors_count;
+          const City* nearest = scratch->nearest->neighbors + city * count;
+          for (other = 0; other < count; ++other)
+            TryJoin(&join, links, positions, smallest, city, next,
+                    nearest[other], graph);
+        }
+        prev = city;
+        city = next;
+      } while (city != walk[smallest]);
+    }
+    // The smallest subtour joins the other one.
+    {
+      uint32_t target = positions[join.cities[2]];
+      city = walk[smallest];
+      prev = links[2 * (size_t)city + 1];
+      do {
+        City next = NextLink(links, city, prev);
+        positions[city] = target;
+        prev = city;
+        city = next;
+      } while (city != walk[smallest]);
+      sizes[target] += sizes[smallest];
+      sizes[smallest] = 0;
+    }
+    Relink(links, join.cities[0], join.cities[1],
+           join.cities[join.crossed ? 3 : 2]);
+    Relink(links, join.cities[1], join.cities[0],
+           join.cities[join.crossed ? 2 : 3]);
+    Relink(links, join.cities[2], join.cities[3],
+           join.cities[join.crossed ? 1 : 0]);
+    Relink(links, join.cities[3], join.cities[2],
+           join.cities[join.crossed ? 0 : 1]);
+  }
+  {
+    City city = left[0];
+    City prev = links[2 * (size_t)city + 1];
+    for (i = 0; i < length; ++i) {
+      City next = NextLink(links, city, prev);
+      result[i] = city;
+      prev = city;
+      city = next;
+    }
+  }
+  assert(VerifyPermutation(result, length, scratch));
+  return Fitness(result, length, graph);
+}
+
+typedef struct CrossoverEntry {
+  const char* name;
+  CrossoverKernel kernel;
+} CrossoverEntry;
+
+typedef struct MutationEntry {
+  const char* name;
+  MutationKernel kernel;
+} MutationEntry;
+
+// Crossover kernels, indexed by |CrossoverOperator|.
+const CrossoverEntry kCrossovers[] = {
+    {"half", Crossover},
+    {"ox", OrderCrossover},
+    {"pmx", PartiallyMappedCrossover},
+    {"erx", EdgeRecombination},
+    {"eax", EdgeAssembly},
+};
+
+// Mutation kernels, indexed by |MutationOperator|.
+const MutationEntry kMutations[] = {
+    {"swap", Mutate},
+    {"inversion", InversionMutate},
+    {"scramble", ScrambleMutate},
+};
+
+int CrossoverOperatorByName(const char* name) {
+  int i;
+  for (i = 0; i < kCrossoverCount; ++i) {
+    if (!strcmp(kCrossovers[i].name, name))
+      return i;
+  }
+  return -1;
+}
+
+const char* CrossoverOperatorName(CrossoverOperator op) {
+  return kCrossovers[op].name;
+}
+
+int MutationOperatorByName(const char* name) {
+  int i;
+  for (i = 0; i < kMutationCount; ++i) {
+    if (!strcmp(kMutations[i].name, name))
+      return i;
+  }
+  return -1;
+}
+
+const char* MutationOperatorName(MutationOperator op) {
+  return kMutations[op].name;
+}
+
+// Breed a child with |kernel| and count the call in the scratch's
+// statistics. The child improves if it beats both parents. Every
+// |kOperatorTimingInterval|-th call is timed and stands for the ones
+// in between, none in a build without metrics.
+static int CountedCrossover(CrossoverKernel kernel, const Population* parents,
+                            size_t left, size_t right, City* result,
+                            const graph_t* graph, RandomChunk* chunk,
+                            Scratch* scratch) {
+  OperatorStats* stats = &(scratch->crossover_stats);
+  int parent = parents->fitness[left] < parents->fitness[right]
+                   ? parents->fitness[left]
+                   : parents->fitness[right];
+  int timed = kMetricsEnabled && stats->calls % kOperatorTimingInterval == 0;
+  uint64_t begin = timed ? MetricsNow() : 0;
+  int fitness = kernel(PopulationTour(parents, left),
+                       PopulationTour(parents, right), result,
+                       parents->length, graph, chunk, scratch);
+  if (timed)
+    stats->seconds +=
+        (MetricsNow() - begin) / 1.0e9 * kOperatorTimingInterval;
+  ++stats->calls;
+  if (fitness < parent) {
+    ++stats->improvements;
+    stats->gain += parent - fitness;
+  }
+  return fitness;
+}
+
+// Mutate |path| with |kernel| and count the call in the scratch's
+// statistics, timed like |CountedCrossover|. Returns the change in
+// fitness.
+static int CountedMutation(MutationKernel kernel, City* path, size_t length,
+                           const graph_t* graph, RandomChunk* chunk,
+                           Scratch* scratch) {
+  OperatorStats* stats = &(scratch->mutation_stats);
+  int timed = kMetricsEnabled && stats->calls % kOperatorTimingInterval == 0;
+  uint64_t begin = timed ? MetricsNow() : 0;
+  int delta = kernel(path, length, graph, chunk, scratch);
+  if (timed)
+    stats->seconds +=
+        (MetricsNow() - begin) / 1.0e9 * kOperatorTimingInterval;
+  ++stats->calls;
+  if (delta < 0) {
+    ++stats->improvements;
+    stats->gain -= delta;
+  }
+  return delta;
+}
+
+void MutateTask(void* in) {
+  size_t i;
+  MutateJob* task = (MutateJob*)in;
+  Population* paths = task->paths;
+  Scratch* scratch = task->scratches + ThreadPoolWorkerIndex(task->pool);
+  double begin = Seconds();
+  RandomChunk chunk;
+  RandomChunkInit(&chunk, task->provider, task->stream);
+  for (i = task->offset; i < task->offset + task->paths_count; ++i) {
+    City* path = PopulationTour(paths, i);
+    if (StopControlCheck(task->control))
+      break;
+    if (i != task->offset && (i - task->offset) % task->block == 0) {
+      RandomChunkDestroy(&chunk);
+      RandomChunkInit(&chunk, task->provider,
+                      task->stream + (i - task->offset) / task->block);
+    }
+    // Crossover has already scored the child, only the edges changed
+    // by the mutation need to be accounted for.
+    paths->fitness[i] += CountedMutation(task->mutate, path, paths->length,
+                                         scratch->graph, &chunk, scratch);
+    if (task->search) {
+      paths->fitness[i] += LocalSearchRun(task->search, path, paths->length,
+                                          task->search_budget,
+                                          &(scratch->search));
+    }
+    assert(paths->fitness[i] ==
+           Fitness(path, paths->length, scratch->graph));
+    assert(paths->fitness[i] > 0);
+    if (task->hashes) {
+      task->hashes[i] = TourHash(path, paths->length);
+      TourSetAdd(task->tours, task->hashes[i], i);
+    }
+  }
+  RandomChunkDestroy(&chunk);
+  task->seconds = Seconds() - begin;
 }
 
 void CrossoverTask(void* in) {
   CrossoverJob* task = (CrossoverJob*)in;
+  const Population* parents = task->parents;
+  Scratch* scratch = task->scratches + ThreadPoolWorkerIndex(task->pool);
   size_t cursor;
-  RandomChunk* chunk = RandomChunkCreate(task->provider);
-  for (cursor = 0; cursor < task->output_count; ++cursor) {
-    size_t rand1 = RandomChunkPopRandomLong(chunk) % task->paths_count;
-    size_t rand2 = RandomChunkPopRandomLong(chunk) % task->paths_count;
-    Crossover(task->paths + rand1, task->paths + rand2, task->output + cursor);
+  double begin = Seconds();
+  RandomChunk chunk;
+  RandomChunkInit(&chunk, task->provider, task->stream);
+  for (cursor = task->offset; cursor < task->offset + task->output_count;
+       ++cursor) {
+    size_t rand1;
+    size_t rand2;
+    if (StopControlCheck(task->control))
+      break;
+    if (cursor != task->offset && (cursor - task->offset) % task->block == 0) {
+      RandomChunkDestroy(&chunk);
+      RandomChunkInit(&chunk, task->provider,
+                      task->stream + (cursor - task->offset) / task->block);
+    }
+    rand1 = RandomChunkPopRandomBelow(&chunk, task->survivors_count);
+    rand2 = RandomChunkPopRandomBelow(&chunk, task->survivors_count);
+    task->output->fitness[cursor] = CountedCrossover(
+        task->crossover, parents, task->survivors[rand1],
+        task->survivors[rand2], PopulationTour(task->output, cursor),
+        scratch->graph, &chunk, scratch);
+  }
+  RandomChunkDestroy(&chunk);
+  task->seconds = Seconds() - begin;
+}
+
+// Fused schedule: every child is bred, mutated and scored in one
+// go, while it is still hot in cache.
+void BreedTask(void* in) {
+  CrossoverJob* task = (CrossoverJob*)in;
+  const Population* parents = task->parents;
+  Scratch* scratch = task->scratches + ThreadPoolWorkerIndex(task->pool);
+  size_t cursor;
+  double begin = Seconds();
+  RandomChunk chunk;
+  RandomChunkInit(&chunk, task->provider, task->stream);
+  for (cursor = task->offset; cursor < task->offset + task->output_count;
+       ++cursor) {
+    size_t rand1;
+    size_t rand2;
+    if (StopControlCheck(task->control))
+      break;
+    if (cursor != task->offset && (cursor - task->offset) % task->block == 0) {
+      RandomChunkDestroy(&chunk);
+      RandomChunkInit(&chunk, task->provider,
+                      task->stream + (cursor - task->offset) / task->block);
+    }
+    rand1 = RandomChunkPopRandomBelow(&chunk, task->survivors_count);
+    rand2 = RandomChunkPopRandomBelow(&chunk, task->survivors_count);
+    City* child = PopulationTour(task->output, cursor);
+    int fitness = CountedCrossover(task->crossover, parents,
+                                   task->survivors[rand1],
+                                   task->survivors[rand2], child,
+                                   scratch->graph, &chunk, scratch);
+    fitness += CountedMutation(task->mutate, child, parents->length,
+                               scratch->graph, &chunk, scratch);
+    if (task->search) {
+      fitness += LocalSearchRun(task->search, child, parents->length,
+                                task->search_budget, &(scratch->search));
+    }
+    assert(fitness == Fitness(child, parents->length, scratch->graph));
+    assert(fitness > 0);
+    task->output->fitness[cursor] = fitness;
+    if (task->hashes) {
+      task->hashes[cursor] = TourHash(child, parents->length);
+      TourSetAdd(task->tours, task->hashes[cursor], cursor);
+    }
   }
-  RandomChunkDelete(chunk);
-  free(task);
+  RandomChunkDestroy(&chunk);
+  task->seconds = Seconds() - begin;
 }
 
-// Swap |size| bytes at |a| and |b| (not overlapping);
-void memswap(void* a, void* b, size_t size) {
-  char* a_cast = (char*)a;
-  char* b_cast = (char*)b;
+void ImproveTask(void* in) {
+  ImproveJob* task = (ImproveJob*)in;
+  Population* paths = task->paths;
+  Scratch* scratch = task->scratches + ThreadPoolWorkerIndex(task->pool);
   size_t i;
-  for (i = 0; i < size; i++) {
-    char tmp = a_cast[i];
-    a_cast[i] = b_cast[i];
-    b_cast[i] = tmp;
+  for (i = task->offset; i < task->offset + task->paths_count; ++i) {
+    size_t index = task->indices[i];
+    City* path = PopulationTour(paths, index);
+    // Improved or not, every tour is whole and scored.
+    if (StopControlCheck(task->control))
+      break;
+    paths->fitness[index] += LocalSearchRun(task->search, path, paths->length,
+                                            task->search_budget,
+                                            &(scratch->search));
+    assert(paths->fitness[index] ==
+           Fitness(path, paths->length, task->search->graph));
   }
 }
 
-void DumpPaths(const Path* arr, size_t count) {
+void DumpPaths(const Population* population) {
   size_t path;
-  for (path = 0; path < count; path++) {
+  for (path = 0; path < population->count; path++) {
     size_t coord;
-    for (coord = 0; coord < arr[path].length; ++coord)
-      printf("%d ", arr[path].path[coord]);
-    printf("%d\n", arr[path].fitness);
+    const City* tour = PopulationTour(population, path);
+    for (coord = 0; coord < population->length; ++coord)
+      printf("%d ", tour[coord]);
+    printf("%d\n", population->fitness[path]);
   }
 }
 
+void MergeOperatorStats(OperatorStats* total, const OperatorStats* part) {
+  total->calls += part->calls;
+  total->improvements += part->improvements;
+  total->gain += part->gain;
+  total->seconds += part->seconds;
+}
+
 double timediff(struct timeval* a, struct timeval* b) {
   return ((a->tv_sec - b->tv_sec) * 1e6 + (a->tv_usec - b->tv_usec)) / 1.0e6;
 }
 
-int ShortestPath(const graph_t* graph,
-                  size_t thread_count,
-                  size_t population_size,
-                  size_t same_fitness_for,
-                  ShortestPathData *return_data) {
-  ThreadPool thread_pool;
-  int best_fitness = INT_MAX;
+void ShortestPathDefaultOptions(ShortestPathOptions* options) {
+  options->seed = 0;
+  options->selection = kSelectionTruncation;
+  options->tournament_size = 4;
+  options->schedule = kScheduleFused;
+  options->local_search = kLocalSearchOff;
+  options->local_search_neighbors = 8;
+  options->local_search_budget = 0;
+  options->model = kModelGlobal;
+  options->migration_topology = kTopologyRing;
+  options->migration_interval = 10;
+  options->migrants = 2;
+  options->port = NULL;
+  options->crossover = kCrossoverHalf;
+  options->mutation = kMutationSwap;
+  options->checkpoint_path = NULL;
+  options->checkpoint_interval = 100;
+  options->target_fitness = 0;
+  options->metrics_path = NULL;
+  options->time_limit = 0;
+  options->cancel = NULL;
+  options->progress = NULL;
+  options->progress_context = NULL;
+  options->pin_workers = 0;
+  options->duplicates = kDuplicatesKeep;
+  SeedMixDefault(&options->seeding);
+}
+
+// Population memory of the global model or of one island, kept by
+// the context from one run to the next.
+typedef struct Arenas {
+  Population populations[2];
+  size_t* survivors;
+  size_t survivors_capacity;
+  // Hashes of the children of a generation, and the set of them.
+  uint64_t* hashes;
+  size_t hashes_capacity;
+  TourSet tours;
+  // Scratch of |SelectableChildren|, as many as there are hashes.
+  uint8_t* firsts;
+  size_t* movers;
+} Arenas;
+
+// Make room for a generation of |children_size| children of |length|
+// cities, of which |population_size| survive.
+static void ArenasReserve(Arenas* self, size_t children_size,
+                          size_t population_size, size_t length) {
+  PopulationReserve(self->populations, children_size, length);
+  PopulationReserve(self->populations + 1, children_size, length);
+  if (population_size > self->survivors_capacity) {
+    free(self->survivors);
+    self->survivors = malloc(population_size * sizeof(size_t));
+    assert(self->survivors);
+    self->survivors_capacity = population_size;
+  }
+  if (children_size > self->hashes_capacity) {
+    free(self->hashes);
+    free(self->firsts);
+    free(self->movers);
+    self->hashes = malloc(children_size * sizeof(uint64_t));
+    self->firsts = malloc(children_size);
+    self->movers = malloc(children_size * sizeof(size_t));
+    assert(self->hashes && self->firsts && self->movers);
+    self->hashes_capacity = children_size;
+  }
+  TourSetReserve(&self->tours, children_size);
+}
+
+static void ArenasDestroy(Arenas* self) {
+  PopulationDestroy(self->populations);
+  PopulationDestroy(self->populations + 1);
+  free(self->survivors);
+  free(self->hashes);
+  free(self->firsts);
+  free(self->movers);
+  TourSetDestroy(&self->tours);
+}
+
+// One slice of the children of a generation in the passes of
+// |SelectableChildren|.
+typedef struct DuplicateJob {
+  Population* children;
+  const uint64_t* hashes;
+  TourSet* tours;
+  // 1 for the first child of every distinct tour, 0 for its copies.
+  uint8_t* firsts;
+  // Distinct children to be moved over the copies, in order.
+  size_t* movers;
+  size_t slice;
+  size_t slice_count;
+  size_t begin;
+  size_t end;
+  // Distinct children in the slice, and in the slices before it.
+  size_t distinct;
+  size_t distinct_before;
+  // Distinct children left where they are, and copies overwritten.
+  size_t kept;
+  size_t moved;
+  int drop;
+} DuplicateJob;
+
+// The slices of |SelectableChildren|, and their tasks on |pool|, or
+// a single slice run by the calling thread if |pool| is NULL.
+typedef struct DuplicateScan {
+  ThreadPool* pool;
+  size_t slice_count;
+  DuplicateJob* jobs;
+  ThreadTask* tasks;
+  ThreadTask** task_pointers;
+} DuplicateScan;
+
+static void DuplicateScanInit(DuplicateScan* self, ThreadPool* pool,
+                              size_t thread_count) {
+  self->pool = pool;
+  self->slice_count = pool ? thread_count * kDuplicateSlicesPerThread : 1;
+  self->jobs = malloc(self->slice_count * sizeof(DuplicateJob));
+  self->tasks = malloc(self->slice_count * sizeof(ThreadTask));
+  self->task_pointers = malloc(self->slice_count * sizeof(ThreadTask*));
+  assert(self->jobs && self->tasks && self->task_pointers);
+}
+
+static void DuplicateScanDestroy(DuplicateScan* self) {
+  free(self->jobs);
+  free(self->tasks);
+  free(self->task_pointers);
+}
+
+// Run |func| on every slice, and wait for all of them.
+static void DuplicateScanRun(DuplicateScan* self, void (*func)(void*)) {
+  size_t i;
+  if (!self->pool) {
+    for (i = 0; i < self->slice_count; ++i)
+      func(self->jobs + i);
+    return;
+  }
+  for (i = 0; i < self->slice_count; ++i) {
+    ThreadPoolCreateTask(self->tasks + i, self->jobs + i, func);
+    self->task_pointers[i] = self->tasks + i;
+  }
+  ThreadPoolAddTasks(self->pool, self->task_pointers, self->slice_count);
+  ThreadPoolWait(self->pool);
+}
+
+// First pass: mark the first child of every distinct tour.
+static void MarkFirstsTask(void* in) {
+  DuplicateJob* job = in;
+  size_t i;
+  job->distinct = 0;
+  for (i = job->begin; i < job->end; ++i) {
+    job->firsts[i] = TourSetFirst(job->tours, job->hashes[i]) == i;
+    job->distinct += job->firsts[i];
+  }
+}
+
+// Second pass: empty the set for the next generation and, when
+// dropping copies, list the distinct children past the |kept| first.
+static void CollectMoversTask(void* in) {
+  DuplicateJob* job = in;
+  size_t rank = job->distinct_before;
+  size_t i;
+  TourSetClearSlice(job->tours, job->slice, job->slice_count);
+  if (!job->drop)
+    return;
+  for (i = job->begin; i < job->end; ++i) {
+    if (!job->firsts[i])
+      continue;
+    if (rank >= job->kept)
+      job->movers[rank - job->kept] = i;
+    ++rank;
+  }
+}
+
+// Third pass: the first |moved| copies take the tours of the movers.
+// Those copies all come before the movers, so no slice reads a tour
+// another one writes.
+static void FillCopiesTask(void* in) {
+  DuplicateJob* job = in;
+  Population* children = job->children;
+  size_t copy = job->begin - job->distinct_before;
+  size_t i;
+  for (i = job->begin; i < job->end && copy < job->moved; ++i) {
+    if (job->firsts[i])
+      continue;
+    memcpy(PopulationTour(children, i),
+           PopulationTour(children, job->movers[copy]),
+           children->length * sizeof(City));
+    children->fitness[i] = children->fitness[job->movers[copy]];
+    ++copy;
+  }
+}
+
+// Apply |policy| to the |children| of a generation, whose |hashes|
+// and |tours| are filled in unless it is to keep them, and empty
+// |tours| again. Dropping copies moves the distinct children to the
+// front, where selection only looks at them, or at |min_count|
+// children if there are fewer. Returns the children selection should
+// look at, with |diversity| set to the share of distinct ones or -1.
+// |firsts| and |movers| have room for every child.
+Population SelectableChildren(DuplicateScan* scan, DuplicatePolicy policy,
+                              Population* children, const uint64_t* hashes,
+                              TourSet* tours, uint8_t* firsts,
+                              size_t* movers, size_t min_count,
+                              double* diversity) {
+  Population selectable = *children;
+  size_t distinct = 0;
+  size_t kept = 0;
+  size_t i;
+  *diversity = -1;
+  if (policy == kDuplicatesKeep)
+    return selectable;
+  for (i = 0; i < scan->slice_count; ++i) {
+    DuplicateJob* job = scan->jobs + i;
+    job->children = children;
+    job->hashes = hashes;
+    job->tours = tours;
+    job->firsts = firsts;
+    job->movers = movers;
+    job->slice = i;
+    job->slice_count = scan->slice_count;
+    job->begin = i * children->count / scan->slice_count;
+    job->end = (i + 1) * children->count / scan->slice_count;
+    job->drop = policy == kDuplicatesDrop;
+  }
+  DuplicateScanRun(scan, MarkFirstsTask);
+  for (i = 0; i < scan->slice_count; ++i) {
+    scan->jobs[i].distinct_before = distinct;
+    distinct += scan->jobs[i].distinct;
+  }
+  // Distinct children in front of the |distinct| first places stay.
+  for (i = 0; i < scan->slice_count; ++i) {
+    DuplicateJob* job = scan->jobs + i;
+    size_t j;
+    if (job->end <= distinct) {
+      kept += job->distinct;
+    } else {
+      for (j = job->begin; j < distinct; ++j)
+        kept += firsts[j];
+      break;
+    }
+  }
+  for (i = 0; i < scan->slice_count; ++i) {
+    scan->jobs[i].kept = kept;
+    scan->jobs[i].moved = distinct - kept;
+  }
+  DuplicateScanRun(scan, CollectMoversTask);
+  if (policy == kDuplicatesDrop) {
+    DuplicateScanRun(scan, FillCopiesTask);
+    selectable.count = distinct < min_count ? min_count : distinct;
+  }
+  *diversity = (double)distinct / children->count;
+  return selectable;
+}
+
+struct SolverContext {
+  size_t thread_count;
+  ThreadPool pool;
+  // One of each per worker, see |ThreadPoolWorkerIndex|. The scratch
+  // memory has room for tours of |scratch_length| cities. The global
+  // model uses the first arenas.
+  Scratch* scratches;
+  size_t scratch_length;
+  Arenas* arenas;
+  // Set by |SolverContextPin|: the NUMA node of every worker, and how
+  // many nodes they are spread over. NULL if the workers aren't
+  // pinned.
+  size_t* worker_nodes;
+  size_t node_count;
+};
+
+// Run |func| for every worker. If the workers are pinned, that is on
+// the worker itself, so that the memory it allocates and first touches
+// is placed on the worker's node.
+static void ContextOnWorkers(SolverContext* self,
+                             void (*func)(void*, size_t), void* data) {
+  size_t i;
+  if (self->worker_nodes) {
+    ThreadPoolRunOnWorkers(&self->pool, func, data);
+    return;
+  }
+  for (i = 0; i < self->thread_count; ++i)
+    func(data, i);
+}
+
+// State shared by the whole run, whichever model drives it.
+typedef struct Solver {
+  SolverContext* context;
+  const graph_t* graph;
+  const ShortestPathOptions* options;
+  size_t thread_count;
+  size_t population_size;
+  size_t same_fitness_for;
+  ThreadPool* pool;
+  RandomProvider* provider;
+  // One per worker, see |ThreadPoolWorkerIndex|.
+  Scratch* scratches;
+  LocalSearch local_search;
+  const LocalSearch* children_search;
+  const LocalSearch* elites_search;
+  StopControl control;
+  // Results, |best_path| may be NULL.
+  int best_fitness;
+  int* best_path;
+  size_t iterations;
+  size_t children;
+  // The run goes on from here if not NULL, global model only.
+  const Checkpoint* resume;
+  // When the run started, plus how long it ran before it was resumed.
+  struct timeval begin;
+  double resumed_time;
+  // Seconds until a tour reached the target fitness, -1 until then.
+  double time_to_target;
+  // Children per breed and mutate task at the end of the run.
+  size_t breed_task_size;
+  size_t mutate_task_size;
+  // Of the last generation, see |ShortestPathData|.
+  double diversity;
+  // Nanoseconds spent in every phase, see metrics.h.
+  uint64_t phase_time[kPhaseCount];
+  // Gets a line of metrics every generation if not NULL.
+  FILE* metrics;
+  // The pool outlives the run, its counters are reported relative to
+  // these, NULL in a batch run.
+  WorkerMetrics* workers_begin;
+  // Gets the progress reports, NULL for none.
+  ProgressLog* log;
+} Solver;
+
+// Seconds the run has taken so far, including before it was resumed.
+double SolverElapsed(const Solver* solver) {
+  struct timeval begin = solver->begin;
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return solver->resumed_time + timediff(&now, &begin);
+}
+
+const char* const kPhaseNames[] = {
+    "setup", "breed", "mutate", "select", "improve", "migrate", "output",
+    "teardown",
+};
+
+const char* SolverPhaseName(SolverPhase phase) {
+  return kPhaseNames[phase];
+}
+
+// Charge the time since |*lap| to |phase| and start the next lap.
+static inline void Lap(uint64_t* phase_time, SolverPhase phase,
+                       uint64_t* lap) {
+  uint64_t now = MetricsNow();
+  phase_time[phase] += now - *lap;
+  *lap = now;
+}
+
+// Counters of |worker| since the run started.
+void SolverWorkerMetrics(const Solver* solver, size_t worker,
+                         WorkerMetrics* metrics) {
+  const WorkerMetrics* begin = solver->workers_begin + worker;
+  ThreadPoolGetMetrics(solver->pool, worker, metrics);
+  metrics->tasks -= begin->tasks;
+  metrics->steals -= begin->steals;
+  metrics->streams -= begin->streams;
+  metrics->busy -= begin->busy;
+  metrics->idle -= begin->idle;
+  metrics->lock_wait -= begin->lock_wait;
+}
+
+// Append the state of the run to the metrics file as one line of
+// JSON. Phase times and worker counters add up from the start.
+void WriteMetrics(Solver* solver) {
+  FILE* file = solver->metrics;
+  size_t i;
+  fprintf(file, "{\"generation\": %lu, \"time\": %lf, \"best\": %d, "
+          "\"children\": %lu, \"diversity\": %lf, \"phases\": {",
+          solver->iterations, SolverElapsed(solver), solver->best_fitness,
+          solver->children, solver->diversity);
+  for (i = 0; i < kPhaseCount; ++i) {
+    fprintf(file, "%s\"%s\": %lf", i ? ", " : "", kPhaseNames[i],
+            solver->phase_time[i] / 1.0e9);
+  }
+  fprintf(file, "}, \"workers\": [");
+  for (i = 0; i < solver->thread_count; ++i) {
+    WorkerMetrics worker;
+    SolverWorkerMetrics(solver, i, &worker);
+    fprintf(file, "%s{\"tasks\": %lu, \"steals\": %lu, \"streams\": %lu, "
+            "\"busy\": %lf, \"idle\": %lf, \"lock_wait\": %lf}",
+            i ? ", " : "", worker.tasks, worker.steals, worker.streams,
+            worker.busy, worker.idle, worker.lock_wait);
+  }
+  fprintf(file, "]}\n");
+}
+
+// Hand the state of the run at the start of a generation to the
+// checkpoint writer. Skipped if the writer is still busy with the
+// previous checkpoint, unless |wait| is set.
+void TakeCheckpoint(Solver* solver, CheckpointWriter* writer,
+                    const Population* parents, const size_t* survivors,
+                    uint64_t next_stream, size_t same_best_for,
+                    const City* best_tour, int wait) {
+  Checkpoint* snapshot = CheckpointWriterBegin(writer, wait);
+  size_t i;
+  if (!snapshot)
+    return;
+  snapshot->seed = solver->options->seed;
+  snapshot->next_stream = next_stream;
+  snapshot->iterations = solver->iterations;
+  snapshot->children = solver->children;
+  snapshot->same_best_for = same_best_for;
+  snapshot->time = SolverElapsed(solver);
+  snapshot->best_fitness = solver->best_fitness;
+  for (i = 0; i < snapshot->count; ++i) {
+    memcpy(snapshot->tours + i * snapshot->length,
+           PopulationTour(parents, survivors[i]),
+           snapshot->length * sizeof(City));
+    snapshot->fitness[i] = parents->fitness[survivors[i]];
+  }
+  memcpy(snapshot->best_path, best_tour, snapshot->length * sizeof(City));
+  CheckpointWriterCommit(writer);
+}
+
+// Elites may have been improved after selection, find the best of
+// them again. Ties go to the lowest index, as in selection.
+void FindBestSurvivor(const Population* children, const size_t* survivors,
+                      size_t survivors_count, SelectionStats* stats) {
+  size_t i;
+  for (i = 0; i < survivors_count; ++i) {
+    int fitness = children->fitness[survivors[i]];
+    if (fitness < stats->best ||
+        (fitness == stats->best && survivors[i] < stats->best_index)) {
+      stats->best = fitness;
+      stats->best_index = survivors[i];
+    }
+  }
+}
+
+// A run stopped before its first generation was over still has a
+// tour to return: the best of the |survivors| in the seeded |parents|
+// it started from. Returns its index in |parents|.
+static size_t FallBack(const Population* parents, const size_t* survivors,
+                       size_t survivors_count) {
+  SelectionStats stats;
+  stats.best = INT_MAX;
+  stats.best_index = SIZE_MAX;
+  FindBestSurvivor(parents, survivors, survivors_count, &stats);
+  return stats.best_index;
+}
+
+// Picks the number of children per task for one phase of the global
+// model. Every |block| children draw from a random stream of their
+// own, whichever task they end up in, so the choice never changes the
+// outcome of a run; blocks shrink on graphs of more than
+// |kStreamBlockCities| cities, where every child costs more. Tasks
+// start out one block each and are resized over the first
+// |kTuningGenerations| generations to take about |kTaskTargetSeconds|,
+// but never so large that a worker gets less than |kMinTasksPerThread|
+// of them or that their tours don't fit in half the L2 cache.
+typedef struct TaskTuner {
+  size_t block;
+  size_t blocks_per_task;
+  size_t max_blocks_per_task;
+  size_t generations;
+} TaskTuner;
+
+static size_t L2CacheSize(void) {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (size > 0)
+    return size;
+#endif
+  return 256 * 1024;
+}
+
+void TaskTunerInit(TaskTuner* self, size_t block, size_t length,
+                   size_t children, size_t thread_count) {
+  size_t cache_blocks;
+  if (length > kStreamBlockCities)
+    block = block * kStreamBlockCities / length;
+  if (!block)
+    block = 1;
+  self->block = block;
+  self->blocks_per_task = 1;
+  self->max_blocks_per_task =
+      (children + block - 1) / block / (thread_count * kMinTasksPerThread);
+  cache_blocks = L2CacheSize() / 2 / (block * length * sizeof(City));
+  if (cache_blocks < self->max_blocks_per_task)
+    self->max_blocks_per_task = cache_blocks;
+  if (!self->max_blocks_per_task)
+    self->max_blocks_per_task = 1;
+  self->generations = 0;
+}
+
+static inline size_t TaskTunerTaskSize(const TaskTuner* self) {
+  return self->block * self->blocks_per_task;
+}
+
+// Resize the tasks after a phase whose |tasks| tasks took |seconds|
+// in all.
+void TaskTunerUpdate(TaskTuner* self, double seconds, size_t tasks) {
+  double block_seconds;
+  size_t wanted;
+  if (self->generations >= kTuningGenerations || !tasks || seconds <= 0)
+    return;
+  ++self->generations;
+  block_seconds = seconds / tasks / self->blocks_per_task;
+  wanted = (size_t)(kTaskTargetSeconds / block_seconds + 0.5);
+  if (wanted > self->max_blocks_per_task)
+    wanted = self->max_blocks_per_task;
+  self->blocks_per_task = wanted ? wanted : 1;
+}
+
+// First touch the populations of the global model with pinned
+// workers, each the slice of children |ThreadPoolAddTasks| hands it
+// first, so those pages are placed on the worker's node.
+static void TouchSliceOn(void* in, size_t worker) {
+  SolverContext* context = in;
+  size_t j;
+  for (j = 0; j < 2; ++j) {
+    Population* population = context->arenas->populations + j;
+    size_t begin = population->count * worker / context->thread_count;
+    size_t end = population->count * (worker + 1) / context->thread_count;
+    memset(PopulationTour(population, begin), 0,
+           (end - begin) * population->length * sizeof(City));
+    memset(population->fitness + begin, 0, (end - begin) * sizeof(int));
+  }
+}
+
+// Global model: one population, and every phase of a generation is
+// split into tasks over all the workers.
+void RunGlobal(Solver* solver) {
+  const graph_t* graph = solver->graph;
+  const ShortestPathOptions* options = solver->options;
+  size_t population_size = solver->population_size;
+  int fused = options->schedule == kScheduleFused;
+  int hashing = options->duplicates != kDuplicatesKeep;
+  Selection selection;
+  DuplicateScan duplicates;
   size_t current_same_best = 0;
-  size_t iterations = 0;
   size_t children_size = population_size * kReproductionFactor;
-  Path* population = malloc(population_size * sizeof(Path));
-  Path* children = malloc(children_size * sizeof(Path));
-  RandomProvider* provider = RandomProviderCreate();
-  struct timeval begin;
-  struct timeval end;
-  gettimeofday(&begin, NULL);
-  ThreadPoolInit(&thread_pool, thread_count);
+  // Parents live in the arena the previous generation was bred
+  // into, so moving on to the next generation only flips the two
+  // pointers and replaces |survivors|.
+  Arenas* arenas = solver->context->arenas;
+  Population* parents = arenas->populations;
+  Population* children = arenas->populations + 1;
+  size_t* survivors;
+  TaskTuner breed_tuner;
+  TaskTuner mutate_tuner;
+  // Job and task records are allocated once and reused by every
+  // generation. Tasks are never smaller than a block, so there's never
+  // more tasks in a phase than |max_tasks|.
+  size_t max_tasks;
+  CrossoverJob* crossover_jobs;
+  MutateJob* mutate_jobs;
+  ImproveJob* improve_jobs;
+  ThreadTask* task_records;
+  ThreadTask** phase_tasks;
+  // Every job gets its own random stream. Streams are handed out in
+  // order by this thread, so the result does not depend on which
+  // worker happens to run which job.
+  uint64_t next_stream = 0;
+  // Checkpoints need the best tour, |solver->best_path| may be NULL.
+  CheckpointWriter checkpoint;
+  City* best_tour = NULL;
+  TaskTunerInit(&breed_tuner,
+                fused ? kPathsPerBreedTask : kPathsPerCrossoverTask, graph->n,
+                children_size, solver->thread_count);
+  TaskTunerInit(&mutate_tuner, kPathsPerMutationTask, graph->n,
+                children_size, solver->thread_count);
+  max_tasks = children_size / (fused ? breed_tuner.block
+                                     : mutate_tuner.block < breed_tuner.block
+                                           ? mutate_tuner.block
+                                           : breed_tuner.block) +
+              1;
+  if (max_tasks <= population_size / kPathsPerImproveTask)
+    max_tasks = population_size / kPathsPerImproveTask + 1;
+  crossover_jobs = malloc(max_tasks * sizeof(CrossoverJob));
+  mutate_jobs = malloc(max_tasks * sizeof(MutateJob));
+  improve_jobs = malloc(max_tasks * sizeof(ImproveJob));
+  task_records = malloc(max_tasks * sizeof(ThreadTask));
+  phase_tasks = malloc(max_tasks * sizeof(ThreadTask*));
+  assert(crossover_jobs && mutate_jobs && improve_jobs && task_records &&
+         phase_tasks);
+  SelectionInit(&selection, solver->pool, options->selection,
+                options->tournament_size, children_size, population_size);
+  DuplicateScanInit(&duplicates, solver->pool, solver->thread_count);
+  ArenasReserve(arenas, children_size, population_size, graph->n);
+  if (solver->context->worker_nodes)
+    ThreadPoolRunOnWorkers(solver->pool, TouchSliceOn, solver->context);
+  survivors = arenas->survivors;
   {
     size_t i;
-    for (i = 0; i < population_size; ++i) {
-      size_t j;
-      population[i].length = graph->n;
-      population[i].path = (int*)malloc(sizeof(int) * graph->n);
-      for (j = 0; j < graph->n; ++j) {
-        population[i].path[j] = j;
-      }
-    }
-    for (i = 0; i < children_size; ++i) {
-      children[i].path = (int*)malloc(sizeof(int) * graph->n);
+    // A resumed run takes its parents from the checkpoint.
+    if (!solver->resume)
+      SeedPopulation(parents, population_size, graph, &options->seeding,
+                     solver->pool, solver->provider, &next_stream,
+                     &solver->control);
+    for (i = 0; i < population_size; ++i)
+      survivors[i] = i;
+  }
+  // Without a writer the run goes on, taking no checkpoints.
+  if (options->checkpoint_path &&
+      !CheckpointWriterInit(&checkpoint, options->checkpoint_path,
+                            population_size, graph->n)) {
+    best_tour = malloc(graph->n * sizeof(City));
+    assert(best_tour);
+  }
+  if (solver->resume) {
+    const Checkpoint* resume = solver->resume;
+    size_t i;
+    assert(resume->count == population_size && resume->length == graph->n);
+    memcpy(parents->tours, resume->tours,
+           population_size * graph->n * sizeof(City));
+    memcpy(parents->fitness, resume->fitness, population_size * sizeof(int));
+    next_stream = resume->next_stream;
+    current_same_best = resume->same_best_for;
+    if (best_tour) {
+      for (i = 0; i < graph->n; ++i)
+        best_tour[i] = resume->best_path[i];
     }
   }
-  while (current_same_best < same_fitness_for) {
-    // Crossover
+  while (current_same_best < solver->same_fitness_for &&
+         !StopControlCheck(&solver->control)) {
+    uint64_t lap = MetricsNow();
+    // A generation cut short is thrown away, and its random streams
+    // handed out again, so that a checkpoint taken after that resumes
+    // as if the run had never been stopped.
+    uint64_t generation_stream = next_stream;
+    // Crossover, which also does the mutation in the fused schedule.
     {
       size_t child_offset = 0;
+      size_t task_count = 0;
+      size_t task_size = TaskTunerTaskSize(&breed_tuner);
+      double seconds = 0;
+      size_t i;
 
       while (child_offset < children_size) {
         size_t chunk_size;
-        if (children_size - child_offset < kPathsPerCrossoverTask) {
+        if (children_size - child_offset < task_size) {
           chunk_size = children_size - child_offset;
         } else {
-          chunk_size = kPathsPerCrossoverTask;
+          chunk_size = task_size;
         }
-        CrossoverJob* job_task = (CrossoverJob*)malloc(sizeof(CrossoverJob));
-        ThreadTask* pool_task = (ThreadTask*)malloc(sizeof(ThreadTask));
-        job_task->provider = provider;
-        job_task->paths = population;
-        job_task->paths_count = population_size;
-        job_task->output = children + child_offset;
+        CrossoverJob* job_task = crossover_jobs + task_count;
+        ThreadTask* pool_task = task_records + task_count;
+        job_task->provider = solver->provider;
+        job_task->stream = next_stream;
+        job_task->block = breed_tuner.block;
+        next_stream += (chunk_size + breed_tuner.block - 1) / breed_tuner.block;
+        job_task->parents = parents;
+        job_task->survivors = survivors;
+        job_task->survivors_count = population_size;
+        job_task->output = children;
+        job_task->offset = child_offset;
         job_task->output_count = chunk_size;
+        job_task->pool = solver->pool;
+        job_task->scratches = solver->scratches;
+        job_task->crossover = kCrossovers[options->crossover].kernel;
+        job_task->mutate = kMutations[options->mutation].kernel;
+        job_task->search = solver->children_search;
+        job_task->search_budget = options->local_search_budget;
+        job_task->control = &solver->control;
+        job_task->hashes = hashing && fused ? arenas->hashes : NULL;
+        job_task->tours = &arenas->tours;
         child_offset += chunk_size;
-        ThreadPoolCreateTask(pool_task, job_task, CrossoverTask);
-        ThreadPoolAddTask(&thread_pool, pool_task);
+        ThreadPoolCreateTask(pool_task, job_task,
+                             fused ? BreedTask : CrossoverTask);
+        phase_tasks[task_count++] = pool_task;
       }
 
-      ThreadPoolShutdown(&thread_pool);
-      ThreadPoolStart(&thread_pool);
-      ThreadPoolJoin(&thread_pool);
+      ThreadPoolAddTasks(solver->pool, phase_tasks, task_count);
+      ThreadPoolWait(solver->pool);
+      Lap(solver->phase_time, kPhaseBreed, &lap);
+      for (i = 0; i < task_count; ++i)
+        seconds += crossover_jobs[i].seconds;
+      TaskTunerUpdate(&breed_tuner, seconds, task_count);
+    }
+    if (StopControlStopped(&solver->control)) {
+      next_stream = generation_stream;
+      break;
     }
-    ThreadPoolReset(&thread_pool);
     // Mutation
-    {
+    if (!fused) {
       size_t child_offset = 0;
+      size_t task_count = 0;
+      size_t task_size = TaskTunerTaskSize(&mutate_tuner);
+      double seconds = 0;
+      size_t i;
 
       while (child_offset < children_size) {
         size_t chunk_size;
-        if (children_size - child_offset < kPathsPerMutationTask) {
+        if (children_size - child_offset < task_size) {
           chunk_size = children_size - child_offset;
         } else {
-          chunk_size = kPathsPerMutationTask;
+          chunk_size = task_size;
         }
-        MutateJob* job_task = (MutateJob*)malloc(sizeof(MutateJob));
-        ThreadTask* pool_task = (ThreadTask*)malloc(sizeof(ThreadTask));
-        job_task->provider = provider;
-        job_task->paths = children + child_offset;
+        MutateJob* job_task = mutate_jobs + task_count;
+        ThreadTask* pool_task = task_records + task_count;
+        job_task->provider = solver->provider;
+        job_task->stream = next_stream;
+        job_task->block = mutate_tuner.block;
+        next_stream +=
+            (chunk_size + mutate_tuner.block - 1) / mutate_tuner.block;
+        job_task->paths = children;
+        job_task->offset = child_offset;
         job_task->paths_count = chunk_size;
-        job_task->graph = graph;
+        job_task->pool = solver->pool;
+        job_task->scratches = solver->scratches;
+        job_task->mutate = kMutations[options->mutation].kernel;
+        job_task->search = solver->children_search;
+        job_task->search_budget = options->local_search_budget;
+        job_task->control = &solver->control;
+        job_task->hashes = hashing ? arenas->hashes : NULL;
+        job_task->tours = &arenas->tours;
         child_offset += chunk_size;
         ThreadPoolCreateTask(pool_task, job_task, MutateTask);
-        ThreadPoolAddTask(&thread_pool, pool_task);
+        phase_tasks[task_count++] = pool_task;
       }
 
-      ThreadPoolShutdown(&thread_pool);
-      ThreadPoolStart(&thread_pool);
-      ThreadPoolJoin(&thread_pool);
+      ThreadPoolAddTasks(solver->pool, phase_tasks, task_count);
+      ThreadPoolWait(solver->pool);
+      Lap(solver->phase_time, kPhaseMutate, &lap);
+      if (StopControlStopped(&solver->control)) {
+        next_stream = generation_stream;
+        break;
+      }
+      for (i = 0; i < task_count; ++i)
+        seconds += mutate_jobs[i].seconds;
+      TaskTunerUpdate(&mutate_tuner, seconds, task_count);
     }
-    ThreadPoolReset(&thread_pool);
-    // Selection: take the top 25% of the children.
+    // Selection: take a quarter of the children.
     {
       size_t i;
-      double average_fitness = 0;
-      qsort(children, children_size, sizeof(Path), PathCompare);
-      assert(children[0].fitness == Fitness(children, graph));
-      for (i = 0; i < children_size; ++i) {
-        average_fitness += children[i].fitness;
+      SelectionStats stats;
+      const City* best;
+      Population selectable = SelectableChildren(
+          &duplicates, options->duplicates, children, arenas->hashes,
+          &arenas->tours, arenas->firsts, arenas->movers, population_size,
+          &solver->diversity);
+      SelectionRun(&selection, &selectable, solver->provider, &next_stream,
+                   survivors, &stats);
+      Lap(solver->phase_time, kPhaseSelect, &lap);
+      // Memetic mode on the elites: improve the survivors in place,
+      // the best child is among them.
+      if (solver->elites_search) {
+        size_t offset = 0;
+        size_t task_count = 0;
+        while (offset < population_size) {
+          ImproveJob* job_task = improve_jobs + task_count;
+          ThreadTask* pool_task = task_records + task_count;
+          job_task->search = solver->elites_search;
+          job_task->search_budget = options->local_search_budget;
+          job_task->control = &solver->control;
+          job_task->paths = children;
+          job_task->indices = survivors;
+          job_task->offset = offset;
+          job_task->paths_count = population_size - offset;
+          if (job_task->paths_count > kPathsPerImproveTask)
+            job_task->paths_count = kPathsPerImproveTask;
+          job_task->pool = solver->pool;
+          job_task->scratches = solver->scratches;
+          offset += job_task->paths_count;
+          ThreadPoolCreateTask(pool_task, job_task, ImproveTask);
+          phase_tasks[task_count++] = pool_task;
+        }
+        ThreadPoolAddTasks(solver->pool, phase_tasks, task_count);
+        ThreadPoolWait(solver->pool);
+        FindBestSurvivor(children, survivors, population_size, &stats);
+        Lap(solver->phase_time, kPhaseImprove, &lap);
+      }
+      best = PopulationTour(children, stats.best_index);
+      assert(stats.best == Fitness(best, graph->n, graph));
+      if (solver->log) {
+        ProgressReport report;
+        report.island = -1;
+        report.generation = solver->iterations;
+        report.best = stats.best;
+        report.worst = stats.worst;
+        report.average = stats.average;
+        report.diversity = solver->diversity;
+        report.time = SolverElapsed(solver);
+        ProgressLogPush(solver->log, &report);
       }
-      average_fitness /= children_size;
-      printf("Iteration %lu best: %d worst: %d average: %lf\n", iterations,
-             children[0].fitness, children[children_size - 1].fitness,
-             average_fitness);
-      if (children[0].fitness < best_fitness) {
-        if (return_data) {
-          memcpy(return_data->best_path, children[0].path, sizeof(int) * graph->n);
+      if (stats.best < solver->best_fitness) {
+        if (solver->best_path) {
+          for (i = 0; i < graph->n; ++i) {
+            solver->best_path[i] = best[i];
+          }
         }
-        best_fitness = children[0].fitness;
+        if (best_tour)
+          memcpy(best_tour, best, graph->n * sizeof(City));
+        if (stats.best <= options->target_fitness &&
+            solver->time_to_target < 0)
+          solver->time_to_target = SolverElapsed(solver);
+        solver->best_fitness = stats.best;
         current_same_best = 0;
       } else {
         ++current_same_best;
       }
-      memswap(population, children, population_size * sizeof(Path));
+      {
+        Population* temp = parents;
+        parents = children;
+        children = temp;
+      }
+      Lap(solver->phase_time, kPhaseSelect, &lap);
     }
-    ++iterations;
+    ++solver->iterations;
+    solver->children += children_size;
+    if (best_tour && solver->iterations % options->checkpoint_interval == 0)
+      TakeCheckpoint(solver, &checkpoint, parents, survivors, next_stream,
+                     current_same_best, best_tour, 0);
+    if (solver->metrics)
+      WriteMetrics(solver);
+    Lap(solver->phase_time, kPhaseOutput, &lap);
   }
-  RandomProviderDelete(provider);
-  ThreadPoolDestroy(&thread_pool);
-  {
-    size_t i;
-    for (i = 0; i < population_size; ++i) {
-      free(population[i].path);
+  // The last checkpoint lets the run be resumed with a longer
+  // |same_fitness_for|.
+  if (best_tour) {
+    TakeCheckpoint(solver, &checkpoint, parents, survivors, next_stream,
+                   current_same_best, best_tour, 1);
+    CheckpointWriterDestroy(&checkpoint);
+    free(best_tour);
+  }
+  if (solver->best_fitness == INT_MAX) {
+    size_t best = FallBack(parents, survivors, population_size);
+    const City* tour = PopulationTour(parents, best);
+    solver->best_fitness = parents->fitness[best];
+    if (solver->best_path) {
+      size_t i;
+      for (i = 0; i < graph->n; ++i)
+        solver->best_path[i] = tour[i];
+    }
+  }
+  solver->breed_task_size = TaskTunerTaskSize(&breed_tuner);
+  solver->mutate_task_size = fused ? 0 : TaskTunerTaskSize(&mutate_tuner);
+  SelectionDestroy(&selection);
+  DuplicateScanDestroy(&duplicates);
+  free(crossover_jobs);
+  free(mutate_jobs);
+  free(improve_jobs);
+  free(task_records);
+  free(phase_tasks);
+}
+
+struct Island;
+
+// A tour on its way between two islands. Every island owns a few of
+// these; they travel through the mailboxes and go back to their
+// owner's free list once the receiver has copied the tour out.
+typedef struct Migrant {
+  struct Island* owner;
+  int fitness;
+  City* tour;
+} Migrant;
+
+// Island model: every island is one long pool task that breeds,
+// selects and improves its own population, sharing nothing with the
+// other islands but the migrants. Islands don't wait for each other,
+// so unlike the global model, runs are not reproducible.
+typedef struct Island {
+  Solver* solver;
+  struct Island* islands;
+  size_t island_count;
+  size_t index;
+  // The first two populations of |Arenas|, and its hashes.
+  Population* arenas;
+  size_t* survivors;
+  uint64_t* hashes;
+  TourSet* tours;
+  uint8_t* firsts;
+  size_t* movers;
+  Selection selection;
+  DuplicateScan duplicates;
+  // Migrants sent to this island.
+  Queue mailbox;
+  // Migrants owned by this island that are not travelling.
+  Queue free_migrants;
+  Migrant* migrants;
+  City* migrant_tours;
+  size_t migrants_count;
+  // The best survivors picked by |SendMigrants|, |migrants| of them.
+  size_t* elites;
+  atomic_int done;
+  uint64_t next_stream;
+  // Tour received through the migration port.
+  City* incoming;
+  // Results.
+  size_t generations;
+  int best_fitness;
+  City* best_path;
+  double time_to_target;
+  double diversity;
+  uint64_t phase_time[kPhaseCount];
+} Island;
+
+// Migrants every island owns, per tour sent at a time.
+const size_t kMigrantsInFlight = 4;
+// Every island draws its random streams from its own range.
+const int kIslandStreamShift = 40;
+// Progress reports that may wait to be printed.
+const size_t kProgressLogCapacity = 1024;
+
+// Let |tour| replace the worst survivor if it is better.
+void AdoptTour(Island* island, Population* parents, const City* tour,
+               int fitness) {
+  size_t population_size = island->solver->population_size;
+  size_t worst = 0;
+  size_t i;
+  for (i = 1; i < population_size; ++i) {
+    if (parents->fitness[island->survivors[i]] >
+        parents->fitness[island->survivors[worst]])
+      worst = i;
+  }
+  if (fitness < parents->fitness[island->survivors[worst]]) {
+    size_t index = island->survivors[worst];
+    memcpy(PopulationTour(parents, index), tour,
+           parents->length * sizeof(City));
+    parents->fitness[index] = fitness;
+  }
+}
+
+// Let migrants replace the worst survivors they are better than.
+void ReceiveMigrants(Island* island, Population* parents) {
+  Migrant* migrant;
+  while ((migrant = QueuePop(&island->mailbox))) {
+    AdoptTour(island, parents, migrant->tour, migrant->fitness);
+    QueuePush(&migrant->owner->free_migrants, migrant);
+  }
+}
+
+// Trade tours with other processes through the migration port, see
+// |MigrationPort|. Only the first island does this.
+void ExchangeThroughPort(Island* island, Population* parents) {
+  Solver* solver = island->solver;
+  const MigrationPort* port = solver->options->port;
+  const graph_t* graph = solver->graph;
+  int result = port->exchange(port->context, island->best_path,
+                              island->best_fitness, island->generations,
+                              island->incoming);
+  if (result < 0) {
+    atomic_store(&solver->control.stopped, 1);
+  } else if (result > 0) {
+    int fitness = Fitness(island->incoming, graph->n, graph);
+    AdoptTour(island, parents, island->incoming, fitness);
+    if (fitness < island->best_fitness) {
+      memcpy(island->best_path, island->incoming, graph->n * sizeof(City));
+      island->best_fitness = fitness;
+    }
+  }
+}
+
+// Send copies of the best survivors to the next island on the
+// topology. Migration is skipped when no free migrant is left.
+void SendMigrants(Island* island, const Population* children) {
+  const ShortestPathOptions* options = island->solver->options;
+  size_t population_size = island->solver->population_size;
+  size_t count = options->migrants;
+  size_t* elites = island->elites;
+  size_t elites_count = 0;
+  Island* target;
+  size_t i;
+  // Nothing to send, and no last elite to compare with.
+  if (!count)
+    return;
+  if (options->migration_topology == kTopologyRing) {
+    target = island->islands + (island->index + 1) % island->island_count;
+  } else {
+    RandomChunk chunk;
+    size_t other;
+    RandomChunkInit(&chunk, island->solver->provider, island->next_stream++);
+    other = RandomChunkPopRandomBelow(&chunk, island->island_count - 1);
+    target = island->islands + other + (other >= island->index);
+    RandomChunkDestroy(&chunk);
+  }
+  if (atomic_load(&target->done))
+    return;
+  // The few best survivors, by insertion into a short sorted list.
+  for (i = 0; i < population_size; ++i) {
+    size_t index = island->survivors[i];
+    size_t j;
+    if (elites_count == count &&
+        children->fitness[index] >= children->fitness[elites[count - 1]])
+      continue;
+    j = elites_count < count ? elites_count++ : count - 1;
+    for (; j && children->fitness[elites[j - 1]] > children->fitness[index];
+         --j)
+      elites[j] = elites[j - 1];
+    elites[j] = index;
+  }
+  for (i = 0; i < elites_count; ++i) {
+    Migrant* migrant = QueuePop(&island->free_migrants);
+    if (!migrant)
+      break;
+    memcpy(migrant->tour, PopulationTour(children, elites[i]),
+           children->length * sizeof(City));
+    migrant->fitness = children->fitness[elites[i]];
+    if (!QueuePush(&target->mailbox, migrant))
+      QueuePush(&island->free_migrants, migrant);
+  }
+}
+
+void IslandTask(void* in) {
+  Island* island = in;
+  Solver* solver = island->solver;
+  const graph_t* graph = solver->graph;
+  const ShortestPathOptions* options = solver->options;
+  size_t population_size = solver->population_size;
+  size_t children_size = population_size * kReproductionFactor;
+  Population* parents = island->arenas;
+  Population* children = island->arenas + 1;
+  const MigrationPort* port = island->index ? NULL : options->port;
+  size_t current_same_best = 0;
+  // With a migration port the other side decides when to stop.
+  while (!StopControlCheck(&solver->control) &&
+         (options->port || current_same_best < solver->same_fitness_for)) {
+    SelectionStats stats;
+    CrossoverJob breed;
+    Population selectable;
+    uint64_t lap = MetricsNow();
+    ReceiveMigrants(island, parents);
+    Lap(island->phase_time, kPhaseMigrate, &lap);
+    // The whole generation is bred by this task in one go.
+    breed.provider = solver->provider;
+    breed.stream = island->next_stream++;
+    breed.block = children_size;
+    breed.parents = parents;
+    breed.survivors = island->survivors;
+    breed.survivors_count = population_size;
+    breed.output = children;
+    breed.offset = 0;
+    breed.output_count = children_size;
+    breed.pool = solver->pool;
+    breed.scratches = solver->scratches;
+    breed.crossover = kCrossovers[options->crossover].kernel;
+    breed.mutate = kMutations[options->mutation].kernel;
+    breed.search = solver->children_search;
+    breed.search_budget = options->local_search_budget;
+    breed.control = &solver->control;
+    breed.hashes =
+        options->duplicates != kDuplicatesKeep ? island->hashes : NULL;
+    breed.tours = island->tours;
+    BreedTask(&breed);
+    if (StopControlStopped(&solver->control))
+      break;
+    Lap(island->phase_time, kPhaseBreed, &lap);
+    selectable = SelectableChildren(
+        &island->duplicates, options->duplicates, children, island->hashes,
+        island->tours, island->firsts, island->movers, population_size,
+        &island->diversity);
+    SelectionRun(&island->selection, &selectable, solver->provider,
+                 &island->next_stream, island->survivors, &stats);
+    Lap(island->phase_time, kPhaseSelect, &lap);
+    if (solver->elites_search) {
+      ImproveJob improve;
+      improve.search = solver->elites_search;
+      improve.search_budget = options->local_search_budget;
+      improve.control = &solver->control;
+      improve.paths = children;
+      improve.indices = island->survivors;
+      improve.offset = 0;
+      improve.paths_count = population_size;
+      improve.pool = solver->pool;
+      improve.scratches = solver->scratches;
+      ImproveTask(&improve);
+      FindBestSurvivor(children, island->survivors, population_size, &stats);
+      Lap(island->phase_time, kPhaseImprove, &lap);
+    }
+    if (stats.best < island->best_fitness) {
+      memcpy(island->best_path, PopulationTour(children, stats.best_index),
+             graph->n * sizeof(City));
+      island->best_fitness = stats.best;
+      current_same_best = 0;
+      if (stats.best <= options->target_fitness &&
+          island->time_to_target < 0)
+        island->time_to_target = SolverElapsed(solver);
+      if (solver->log) {
+        ProgressReport report;
+        report.island = island->index;
+        report.generation = island->generations;
+        report.best = stats.best;
+        report.worst = stats.worst;
+        report.average = stats.average;
+        report.diversity = island->diversity;
+        report.time = SolverElapsed(solver);
+        ProgressLogPush(solver->log, &report);
+      }
+    } else {
+      ++current_same_best;
+    }
+    ++island->generations;
+    Lap(island->phase_time, kPhaseSelect, &lap);
+    if (island->island_count > 1 &&
+        island->generations % options->migration_interval == 0)
+      SendMigrants(island, children);
+    if (port && island->generations % options->migration_interval == 0)
+      ExchangeThroughPort(island, children);
+    Lap(island->phase_time, kPhaseMigrate, &lap);
+    {
+      Population* temp = parents;
+      parents = children;
+      children = temp;
+    }
+  }
+  if (island->best_fitness == INT_MAX) {
+    size_t best = FallBack(parents, island->survivors, population_size);
+    memcpy(island->best_path, PopulationTour(parents, best),
+           graph->n * sizeof(City));
+    island->best_fitness = parents->fitness[best];
+  }
+  atomic_store(&island->done, 1);
+}
+
+// Set up island |index| of the |island_count| in |islands|, with its
+// populations in |arenas|, seeding them with tasks on |pool| if it is
+// not NULL.
+void IslandInit(Island* island, Solver* solver, Island* islands,
+                size_t island_count, size_t index, Arenas* arenas,
+                ThreadPool* pool) {
+  const graph_t* graph = solver->graph;
+  const ShortestPathOptions* options = solver->options;
+  size_t population_size = solver->population_size;
+  size_t children_size = population_size * kReproductionFactor;
+  size_t in_flight = options->migrants * kMigrantsInFlight;
+  size_t j;
+  memset(island, 0, sizeof(Island));
+  island->solver = solver;
+  island->islands = islands;
+  island->island_count = island_count;
+  island->index = index;
+  ArenasReserve(arenas, children_size, population_size, graph->n);
+  island->arenas = arenas->populations;
+  island->survivors = arenas->survivors;
+  island->hashes = arenas->hashes;
+  island->tours = &arenas->tours;
+  island->firsts = arenas->firsts;
+  island->movers = arenas->movers;
+  // Like selection, inside the island task.
+  DuplicateScanInit(&island->duplicates, NULL, 1);
+  island->best_path = malloc(graph->n * sizeof(City));
+  island->incoming = malloc(graph->n * sizeof(City));
+  assert(island->best_path && island->incoming);
+  // Selection runs inside the island task.
+  SelectionInit(&island->selection, NULL, options->selection,
+                options->tournament_size, children_size, population_size);
+  QueueInit(&island->mailbox, island_count * in_flight);
+  QueueInit(&island->free_migrants, in_flight);
+  island->migrants = malloc(in_flight * sizeof(Migrant));
+  island->migrant_tours = malloc(in_flight * graph->n * sizeof(City));
+  island->elites = malloc(options->migrants * sizeof(size_t));
+  // Without --migrants these may be NULL, malloc(0) is allowed to.
+  assert(!in_flight ||
+         (island->migrants && island->migrant_tours && island->elites));
+  island->migrants_count = in_flight;
+  for (j = 0; j < in_flight; ++j) {
+    island->migrants[j].owner = island;
+    island->migrants[j].tour = island->migrant_tours + j * graph->n;
+    QueuePush(&island->free_migrants, island->migrants + j);
+  }
+  atomic_init(&island->done, 0);
+  island->next_stream = (uint64_t)(index + 1) << kIslandStreamShift;
+  island->best_fitness = INT_MAX;
+  island->time_to_target = -1;
+  island->diversity = -1;
+  SeedPopulation(island->arenas, population_size, graph, &options->seeding,
+                 pool, solver->provider, &island->next_stream,
+                 &solver->control);
+  for (j = 0; j < population_size; ++j)
+    island->survivors[j] = j;
+}
+
+// The populations belong to the context and are left alone.
+void IslandDestroy(Island* island) {
+  SelectionDestroy(&island->selection);
+  DuplicateScanDestroy(&island->duplicates);
+  QueueDestroy(&island->mailbox);
+  QueueDestroy(&island->free_migrants);
+  free(island->best_path);
+  free(island->incoming);
+  free(island->migrants);
+  free(island->migrant_tours);
+  free(island->elites);
+}
+
+// Add the results of |island| to the run's.
+void CollectIsland(Solver* solver, const Island* island) {
+  const graph_t* graph = solver->graph;
+  size_t children_size = solver->population_size * kReproductionFactor;
+  size_t j;
+  if (island->best_fitness < solver->best_fitness) {
+    solver->best_fitness = island->best_fitness;
+    if (solver->best_path) {
+      for (j = 0; j < graph->n; ++j)
+        solver->best_path[j] = island->best_path[j];
     }
-    for (i = 0; i < children_size; ++i) {
-      free(children[i].path);
+  }
+  if (island->generations > solver->iterations)
+    solver->iterations = island->generations;
+  for (j = 0; j < kPhaseCount; ++j)
+    solver->phase_time[j] += island->phase_time[j];
+  if (island->time_to_target >= 0 &&
+      (solver->time_to_target < 0 ||
+       island->time_to_target < solver->time_to_target))
+    solver->time_to_target = island->time_to_target;
+  solver->children += island->generations * children_size;
+  if (island->diversity >= 0) {
+    if (solver->diversity < 0)
+      solver->diversity = 0;
+    solver->diversity += island->diversity / island->island_count;
+  }
+}
+
+static void ReserveIslandOn(void* in, size_t worker) {
+  Solver* solver = in;
+  ArenasReserve(solver->context->arenas + worker,
+                solver->population_size * kReproductionFactor,
+                solver->population_size, solver->graph->n);
+}
+
+// Island model: one island per worker, each with an even share of
+// the population.
+void RunIslands(Solver* solver) {
+  size_t island_count = solver->thread_count;
+  Island* islands = malloc(island_count * sizeof(Island));
+  ThreadTask* tasks = malloc(island_count * sizeof(ThreadTask));
+  ThreadTask** task_pointers = malloc(island_count * sizeof(ThreadTask*));
+  size_t i;
+  assert(islands && tasks && task_pointers);
+  assert(solver->population_size / island_count &&
+         solver->options->migration_interval);
+  solver->population_size /= island_count;
+  // Island i starts out on worker i, which may as well own its memory.
+  ContextOnWorkers(solver->context, ReserveIslandOn, solver);
+  for (i = 0; i < island_count; ++i) {
+    IslandInit(islands + i, solver, islands, island_count, i,
+               solver->context->arenas + i, solver->pool);
+    ThreadPoolCreateTask(tasks + i, islands + i, IslandTask);
+    task_pointers[i] = tasks + i;
+  }
+  ThreadPoolAddTasks(solver->pool, task_pointers, island_count);
+  ThreadPoolWait(solver->pool);
+  for (i = 0; i < island_count; ++i)
+    CollectIsland(solver, islands + i);
+  for (i = 0; i < island_count; ++i)
+    IslandDestroy(islands + i);
+  free(islands);
+  free(tasks);
+  free(task_pointers);
+}
+
+SolverContext* SolverContextCreate(size_t thread_count) {
+  SolverContext* self = malloc(sizeof(SolverContext));
+  assert(self && thread_count);
+  self->thread_count = thread_count;
+  self->scratches = malloc(thread_count * sizeof(Scratch));
+  self->scratch_length = 0;
+  self->arenas = calloc(thread_count, sizeof(Arenas));
+  assert(self->scratches && self->arenas);
+  self->worker_nodes = NULL;
+  self->node_count = 1;
+  ThreadPoolInit(&self->pool, thread_count);
+  ThreadPoolStart(&self->pool);
+  return self;
+}
+
+void SolverContextDelete(SolverContext* self) {
+  size_t i;
+  ThreadPoolShutdown(&self->pool);
+  ThreadPoolJoin(&self->pool);
+  ThreadPoolDestroy(&self->pool);
+  for (i = 0; i < self->thread_count; ++i) {
+    if (self->scratch_length)
+      ScratchDestroy(self->scratches + i);
+    ArenasDestroy(self->arenas + i);
+  }
+  free(self->scratches);
+  free(self->arenas);
+  free(self->worker_nodes);
+  free(self);
+}
+
+typedef struct PinJob {
+  const Topology* topology;
+  size_t* worker_nodes;
+  atomic_int failed;
+} PinJob;
+
+static void PinOn(void* in, size_t worker) {
+  PinJob* job = in;
+  size_t cpu = worker % job->topology->cpu_count;
+  if (TopologyPin(job->topology->cpus[cpu]))
+    atomic_store(&job->failed, 1);
+  job->worker_nodes[worker] = job->topology->nodes[cpu];
+}
+
+int SolverContextPin(SolverContext* self) {
+  Topology topology;
+  PinJob job;
+  size_t i;
+  if (TopologyInit(&topology))
+    return -1;
+  job.topology = &topology;
+  job.worker_nodes = malloc(self->thread_count * sizeof(size_t));
+  assert(job.worker_nodes);
+  atomic_init(&job.failed, 0);
+  ThreadPoolRunOnWorkers(&self->pool, PinOn, &job);
+  TopologyDestroy(&topology);
+  if (atomic_load(&job.failed)) {
+    free(job.worker_nodes);
+    return -1;
+  }
+  free(self->worker_nodes);
+  self->worker_nodes = job.worker_nodes;
+  self->node_count = 1;
+  for (i = 0; i < self->thread_count; ++i) {
+    if (self->worker_nodes[i] >= self->node_count)
+      self->node_count = self->worker_nodes[i] + 1;
+  }
+  return 0;
+}
+
+typedef struct ReserveScratchJob {
+  SolverContext* context;
+  size_t length;
+} ReserveScratchJob;
+
+static void ReserveScratchOn(void* in, size_t worker) {
+  ReserveScratchJob* job = in;
+  Scratch* scratch = job->context->scratches + worker;
+  if (job->length > job->context->scratch_length) {
+    if (job->context->scratch_length)
+      ScratchDestroy(scratch);
+    ScratchInit(scratch, job->length);
+  }
+  scratch->nearest = NULL;
+  memset(&(scratch->crossover_stats), 0, sizeof(OperatorStats));
+  memset(&(scratch->mutation_stats), 0, sizeof(OperatorStats));
+}
+
+// Grow the scratch memory of every worker to tours of |length|
+// cities, and clear what is left of the previous run. Must not be
+// called while the pool is running tasks.
+void ContextReserveScratch(SolverContext* self, size_t length) {
+  ReserveScratchJob job;
+  job.context = self;
+  job.length = length;
+  ContextOnWorkers(self, ReserveScratchOn, &job);
+  if (length > self->scratch_length)
+    self->scratch_length = length;
+}
+
+typedef struct ReplicateJob {
+  const SolverContext* context;
+  const graph_t* graph;
+  graph_t** replicas;
+} ReplicateJob;
+
+// The first worker of every node copies the graph for its node.
+static void ReplicateOn(void* in, size_t worker) {
+  ReplicateJob* job = in;
+  const size_t* nodes = job->context->worker_nodes;
+  size_t i;
+  for (i = 0; i < worker; ++i) {
+    if (nodes[i] == nodes[worker])
+      return;
+  }
+  job->replicas[nodes[worker]] = graph_copy(job->graph);
+}
+
+// Everything but the model specific parts of a new run.
+void SolverInit(Solver* solver, SolverContext* context,
+                const graph_t* graph, size_t population_size,
+                size_t same_fitness_for, const ShortestPathOptions* options,
+                ShortestPathData* return_data) {
+  gettimeofday(&solver->begin, NULL);
+  solver->context = context;
+  solver->graph = graph;
+  solver->options = options;
+  solver->thread_count = context->thread_count;
+  solver->population_size = population_size;
+  solver->same_fitness_for = same_fitness_for;
+  solver->pool = &context->pool;
+  solver->provider = RandomProviderCreate(options->seed);
+  solver->scratches = context->scratches;
+  solver->children_search = NULL;
+  solver->elites_search = NULL;
+  atomic_init(&solver->control.stopped, 0);
+  solver->control.cancel = options->cancel;
+  solver->control.deadline =
+      options->time_limit > 0 ? Seconds() + options->time_limit : 0;
+  solver->best_fitness = INT_MAX;
+  solver->best_path = return_data ? return_data->best_path : NULL;
+  solver->iterations = 0;
+  solver->children = 0;
+  solver->resume = NULL;
+  solver->resumed_time = 0;
+  solver->time_to_target = -1;
+  solver->breed_task_size = 0;
+  solver->mutate_task_size = 0;
+  solver->diversity = -1;
+  memset(solver->phase_time, 0, sizeof(solver->phase_time));
+  solver->metrics = NULL;
+  solver->workers_begin = NULL;
+  solver->log = NULL;
+}
+
+// Local search assumes that a tour and its reverse weigh the same.
+// Its neighbour lists are also used by EAX to join subtours.
+int WantsNeighbors(const graph_t* graph, const ShortestPathOptions* options) {
+  return graph->symmetric && (options->local_search != kLocalSearchOff ||
+                              options->crossover == kCrossoverEdgeAssembly);
+}
+
+// Build the neighbour lists of the run with |pool|, which may be
+// NULL, and hand them to the local search the options ask for.
+void SolverInitNeighbors(Solver* solver, ThreadPool* pool) {
+  const ShortestPathOptions* options = solver->options;
+  LocalSearchInit(&solver->local_search, solver->graph,
+                  options->local_search_neighbors, pool);
+  if (options->local_search == kLocalSearchChildren)
+    solver->children_search = &solver->local_search;
+  else if (options->local_search == kLocalSearchElites)
+    solver->elites_search = &solver->local_search;
+}
+
+// Progress as the solver has always printed it, the default
+// |ProgressCallback|.
+void PrintProgress(void* context, const ProgressReport* report) {
+  (void)context;
+  if (report->island < 0) {
+    printf("Iteration %lu best: %d worst: %d average: %lf",
+           report->generation, report->best, report->worst,
+           report->average);
+  } else {
+    printf("Island %d generation %lu best: %d", report->island,
+           report->generation, report->best);
+  }
+  if (report->diversity >= 0)
+    printf(" diversity: %lf", report->diversity);
+  printf("\n");
+}
+
+// Fill in |return_data| but for the worker counters, with the
+// operator statistics of |scratch_count| scratches.
+void SolverReport(Solver* solver, const Scratch* scratches,
+                  size_t scratch_count, ShortestPathData* return_data) {
+  size_t i;
+  return_data->iterations = solver->iterations;
+  return_data->children = solver->children;
+  return_data->time = SolverElapsed(solver);
+  return_data->time_to_target = solver->time_to_target;
+  return_data->stopped = StopControlStopped(&solver->control);
+  return_data->breed_task_size = solver->breed_task_size;
+  return_data->mutate_task_size = solver->mutate_task_size;
+  return_data->diversity = solver->diversity;
+  for (i = 0; i < kPhaseCount; ++i)
+    return_data->phase_time[i] = solver->phase_time[i] / 1.0e9;
+  memset(&(return_data->crossover), 0, sizeof(OperatorStats));
+  memset(&(return_data->mutation), 0, sizeof(OperatorStats));
+  for (i = 0; i < scratch_count; ++i) {
+    MergeOperatorStats(&(return_data->crossover),
+                       &(scratches[i].crossover_stats));
+    MergeOperatorStats(&(return_data->mutation),
+                       &(scratches[i].mutation_stats));
+  }
+}
+
+// Tours store cities as |City|, too narrow for some graphs.
+int TooManyCities(const graph_t* graph) {
+  if ((size_t)graph->n <= kMaxCities)
+    return 0;
+  fprintf(stderr, "%d cities are more than the %lu a tour can hold, "
+          "build with -DSALESMAN_WIDE_CITIES\n", graph->n, kMaxCities);
+  return 1;
+}
+
+int SolverContextRun(SolverContext* context, const graph_t* graph,
+                     size_t population_size, size_t same_fitness_for,
+                     const ShortestPathOptions* options,
+                     const Checkpoint* resume,
+                     ShortestPathData* return_data) {
+  Solver solver;
+  size_t thread_count = context->thread_count;
+  size_t i;
+  int neighbors = WantsNeighbors(graph, options);
+  FILE* metrics = NULL;
+  ProgressLog log;
+  ReplicateJob job = {NULL, NULL, NULL};
+  uint64_t lap = MetricsNow();
+  if (TooManyCities(graph))
+    return -1;
+  // Checkpoints need the generations to be in step.
+  assert(options->model == kModelGlobal ||
+         (!options->checkpoint_path && !resume));
+  assert(!options->checkpoint_path || options->checkpoint_interval);
+  if (options->metrics_path) {
+    metrics = fopen(options->metrics_path, "w");
+    if (!metrics) {
+      fprintf(stderr, "cannot open %s for writing\n", options->metrics_path);
+      return -1;
+    }
+  }
+  SolverInit(&solver, context, graph, population_size, same_fitness_for,
+             options, return_data);
+  solver.metrics = metrics;
+  solver.resume = resume;
+  // The run goes on without progress reports if their thread can't
+  // be started.
+  if (!ProgressLogInit(&log, kProgressLogCapacity,
+                       options->progress ? options->progress : PrintProgress,
+                       options->progress_context))
+    solver.log = &log;
+  if (resume) {
+    solver.best_fitness = resume->best_fitness;
+    solver.iterations = resume->iterations;
+    solver.children = resume->children;
+    solver.resumed_time = resume->time;
+    if (solver.best_path) {
+      for (i = 0; i < graph->n; ++i)
+        solver.best_path[i] = resume->best_path[i];
     }
   }
-  free(population);
-  free(children);
-  gettimeofday(&end, NULL);
+  solver.workers_begin = malloc(thread_count * sizeof(WorkerMetrics));
+  assert(solver.workers_begin);
+  for (i = 0; i < thread_count; ++i)
+    ThreadPoolGetMetrics(solver.pool, i, solver.workers_begin + i);
+  ContextReserveScratch(context, graph->n);
+  // Workers spread over several nodes get a copy of the weights on
+  // their own.
+  if (context->node_count > 1) {
+    job.context = context;
+    job.graph = graph;
+    job.replicas = calloc(context->node_count, sizeof(graph_t*));
+    assert(job.replicas);
+    ThreadPoolRunOnWorkers(&context->pool, ReplicateOn, &job);
+  }
+  for (i = 0; i < thread_count; ++i) {
+    solver.scratches[i].graph =
+        job.replicas ? job.replicas[context->worker_nodes[i]] : graph;
+  }
+  if (neighbors) {
+    SolverInitNeighbors(&solver, solver.pool);
+    for (i = 0; i < thread_count; ++i)
+      solver.scratches[i].nearest = &solver.local_search;
+  }
+  Lap(solver.phase_time, kPhaseSetup, &lap);
+  if (options->model == kModelIslands)
+    RunIslands(&solver);
+  else
+    RunGlobal(&solver);
+  // Phases were charged by the run itself.
+  lap = MetricsNow();
+  if (solver.log) {
+    if (ProgressLogDropped(&log))
+      fprintf(stderr, "%lu progress reports dropped\n",
+              ProgressLogDropped(&log));
+    ProgressLogDestroy(&log);
+  }
+  RandomProviderDelete(solver.provider);
+  if (neighbors)
+    LocalSearchDestroy(&solver.local_search);
+  if (job.replicas) {
+    for (i = 0; i < context->node_count; ++i) {
+      if (job.replicas[i])
+        graph_destroy(job.replicas[i]);
+    }
+    free(job.replicas);
+  }
+  Lap(solver.phase_time, kPhaseTeardown, &lap);
+  if (solver.metrics) {
+    WriteMetrics(&solver);
+    fclose(solver.metrics);
+  }
   if (return_data) {
-    return_data->iterations = iterations;
-    return_data->time = timediff(&end, &begin);
+    SolverReport(&solver, solver.scratches, thread_count, return_data);
+    if (return_data->workers) {
+      for (i = 0; i < thread_count; ++i)
+        SolverWorkerMetrics(&solver, i, return_data->workers + i);
+    }
+  }
+  free(solver.workers_begin);
+  return solver.best_fitness;
+}
+
+int SolverContextSolve(SolverContext* self, const graph_t* graph,
+                       size_t population_size, size_t same_fitness_for,
+                       const ShortestPathOptions* options,
+                       ShortestPathData* return_data) {
+  ShortestPathOptions default_options;
+  if (!options) {
+    ShortestPathDefaultOptions(&default_options);
+    options = &default_options;
   }
+  return SolverContextRun(self, graph, population_size, same_fitness_for,
+                          options, NULL, return_data);
+}
+
+typedef struct BatchJob {
+  SolverContext* context;
+  const graph_t* graph;
+  size_t population_size;
+  size_t same_fitness_for;
+  const ShortestPathOptions* options;
+  ShortestPathData* return_data;
+  int best_fitness;
+} BatchJob;
+
+// One graph of a batch, solved as a single island by the worker that
+// runs the task, with that worker's scratch and arenas.
+void BatchTask(void* in) {
+  BatchJob* job = in;
+  SolverContext* context = job->context;
+  size_t worker = ThreadPoolWorkerIndex(&context->pool);
+  Scratch* scratch = context->scratches + worker;
+  int neighbors = WantsNeighbors(job->graph, job->options);
+  Solver solver;
+  Island island;
+  uint64_t lap = MetricsNow();
+  SolverInit(&solver, context, job->graph, job->population_size,
+             job->same_fitness_for, job->options, job->return_data);
+  scratch->nearest = NULL;
+  scratch->graph = job->graph;
+  memset(&(scratch->crossover_stats), 0, sizeof(OperatorStats));
+  memset(&(scratch->mutation_stats), 0, sizeof(OperatorStats));
+  if (neighbors) {
+    SolverInitNeighbors(&solver, NULL);
+    scratch->nearest = &solver.local_search;
+  }
+  IslandInit(&island, &solver, &island, 1, 0, context->arenas + worker,
+             NULL);
+  Lap(solver.phase_time, kPhaseSetup, &lap);
+  IslandTask(&island);
+  CollectIsland(&solver, &island);
+  lap = MetricsNow();
+  IslandDestroy(&island);
+  RandomProviderDelete(solver.provider);
+  if (neighbors)
+    LocalSearchDestroy(&solver.local_search);
+  scratch->nearest = NULL;
+  Lap(solver.phase_time, kPhaseTeardown, &lap);
+  if (job->return_data)
+    SolverReport(&solver, scratch, 1, job->return_data);
+  job->best_fitness = solver.best_fitness;
+}
+
+int SolverContextSolveBatch(SolverContext* self, const graph_t* const* graphs,
+                            size_t count, size_t population_size,
+                            size_t same_fitness_for,
+                            const ShortestPathOptions* options,
+                            int* best_fitness,
+                            ShortestPathData* return_data) {
+  ShortestPathOptions default_options;
+  BatchJob* jobs;
+  ThreadTask* tasks;
+  ThreadTask** task_pointers;
+  size_t length = 0;
+  size_t i;
+  for (i = 0; i < count; ++i) {
+    if (TooManyCities(graphs[i]))
+      return -1;
+    if (graphs[i]->n > length)
+      length = graphs[i]->n;
+  }
+  jobs = malloc(count * sizeof(BatchJob));
+  tasks = malloc(count * sizeof(ThreadTask));
+  task_pointers = malloc(count * sizeof(ThreadTask*));
+  assert(jobs && tasks && task_pointers);
+  if (!options) {
+    ShortestPathDefaultOptions(&default_options);
+    options = &default_options;
+  }
+  assert(!options->checkpoint_path && !options->metrics_path &&
+         !options->port);
+  // Tasks can't grow the scratch memory, other workers may be using
+  // it.
+  ContextReserveScratch(self, length);
+  for (i = 0; i < count; ++i) {
+    jobs[i].context = self;
+    jobs[i].graph = graphs[i];
+    jobs[i].population_size = population_size;
+    jobs[i].same_fitness_for = same_fitness_for;
+    jobs[i].options = options;
+    jobs[i].return_data = return_data ? return_data + i : NULL;
+    ThreadPoolCreateTask(tasks + i, jobs + i, BatchTask);
+    task_pointers[i] = tasks + i;
+  }
+  ThreadPoolAddTasks(&self->pool, task_pointers, count);
+  ThreadPoolWait(&self->pool);
+  for (i = 0; i < count; ++i)
+    best_fitness[i] = jobs[i].best_fitness;
+  free(jobs);
+  free(tasks);
+  free(task_pointers);
+  return 0;
+}
+
+int ShortestPath(const graph_t* graph,
+                  size_t thread_count,
+                  size_t population_size,
+                  size_t same_fitness_for,
+                  const ShortestPathOptions* options,
+                  ShortestPathData *return_data) {
+  SolverContext* context = SolverContextCreate(thread_count);
+  int best_fitness;
+  if (options && options->pin_workers)
+    SolverContextPin(context);
+  best_fitness = SolverContextSolve(context, graph, population_size,
+                                    same_fitness_for, options, return_data);
+  SolverContextDelete(context);
   return best_fitness;
-}
\ No newline at end of file
+}
+
+int ShortestPathResume(const graph_t* graph,
+                       size_t thread_count,
+                       const char* checkpoint_path,
+                       size_t same_fitness_for,
+                       const ShortestPathOptions* options,
+                       ShortestPathData* return_data) {
+  ShortestPathOptions resume_options;
+  SolverContext* context;
+  Checkpoint checkpoint;
+  int best_fitness;
+  if (CheckpointLoad(&checkpoint, checkpoint_path))
+    return -1;
+  if (checkpoint.length != graph->n) {
+    fprintf(stderr, "%s is for a graph of %lu cities, not %d\n",
+            checkpoint_path, checkpoint.length, graph->n);
+    CheckpointDestroy(&checkpoint);
+    return -1;
+  }
+  if (options)
+    resume_options = *options;
+  else
+    ShortestPathDefaultOptions(&resume_options);
+  resume_options.seed = checkpoint.seed;
+  context = SolverContextCreate(thread_count);
+  if (resume_options.pin_workers)
+    SolverContextPin(context);
+  best_fitness = SolverContextRun(context, graph, checkpoint.count,
+                                  same_fitness_for, &resume_options,
+                                  &checkpoint, return_data);
+  SolverContextDelete(context);
+  CheckpointDestroy(&checkpoint);
+  return best_fitness;
+}
@@ -1,13 +1,291 @@
+#ifndef SALESMAN_H
+#define SALESMAN_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
 #include "graph.h"
+#include "local_search.h"
+#include "progress_log.h"
+#include "seeding.h"
+#include "selection.h"
+#include "thread_pool.h"
+
+// How an operator did over a run, summed over all the workers. A
+// crossover improves on its parents when the child is better than
+// both of them, a mutation when the tour gets shorter; |gain| adds
+// up by how much. |seconds| is the time spent in the operator,
+// estimated from a sample of the calls, 0 in a build with
+// SALESMAN_NO_METRICS.
+typedef struct OperatorStats {
+  size_t calls;
+  size_t improvements;
+  int64_t gain;
+  double seconds;
+} OperatorStats;
+
+// Where the time of a run goes. The global model times the phases
+// of every generation on the calling thread, the island model sums
+// them up over the islands.
+typedef enum SolverPhase {
+  // Scratch memory, populations and neighbour lists.
+  kPhaseSetup,
+  // Crossover, and in the fused schedule mutation too.
+  kPhaseBreed,
+  kPhaseMutate,
+  kPhaseSelect,
+  // Local search on the elites.
+  kPhaseImprove,
+  kPhaseMigrate,
+  // Checkpoints and the metrics file.
+  kPhaseOutput,
+  // Freeing what the run allocated.
+  kPhaseTeardown,
+  kPhaseCount,
+} SolverPhase;
+
+const char* SolverPhaseName(SolverPhase phase);
 
 typedef struct PathData {
 	size_t iterations;
+	// Children bred (and scored) over the whole run.
+	size_t children;
 	double time;
 	int* best_path;
+	// Seconds until the target fitness was reached, -1 if it never was.
+	double time_to_target;
+	// 1 if the run was stopped by its time limit, |cancel| or the
+	// migration port rather than by |same_fitness_for|.
+	int stopped;
+	// Children per task of the breed and mutate phases at the end of
+	// the run, picked by the task tuner of the global model; 0 for a
+	// phase that did not run and in the island model, whose islands
+	// breed each generation in a task of their own.
+	size_t breed_task_size;
+	size_t mutate_task_size;
+	// Share of distinct tours among the children of the last
+	// generation, averaged over the islands; -1 if duplicates were not
+	// looked for.
+	double diversity;
+	OperatorStats crossover;
+	OperatorStats mutation;
+	// Seconds spent in every phase, all zero in a build with
+	// -DSALESMAN_NO_METRICS.
+	double phase_time[kPhaseCount];
+	// May be NULL, otherwise gets the counters of every worker.
+	WorkerMetrics* workers;
 } ShortestPathData;
 
+// Crossover operators. Every child gets its fitness from the
+// kernel that bred it.
+typedef enum CrossoverOperator {
+  // The first half of the left parent, then the rest of the cities
+  // in the order of the right parent.
+  kCrossoverHalf,
+  // Order crossover (OX).
+  kCrossoverOrder,
+  // Partially mapped crossover (PMX).
+  kCrossoverPartiallyMapped,
+  // Edge recombination (ERX).
+  kCrossoverEdgeRecombination,
+  // Edge assembly crossover (EAX) with one AB-cycle per child.
+  kCrossoverEdgeAssembly,
+  kCrossoverCount,
+} CrossoverOperator;
+
+// Mutation operators, applied once to every child.
+typedef enum MutationOperator {
+  // Swap two random cities.
+  kMutationSwap,
+  // Reverse the cities between two random positions.
+  kMutationInversion,
+  // Shuffle a short run of cities.
+  kMutationScramble,
+  kMutationCount,
+} MutationOperator;
+
+// Operators by the names "half", "ox", "pmx", "erx", "eax" and
+// "swap", "inversion", "scramble". Return -1 for an unknown name.
+int CrossoverOperatorByName(const char* name);
+const char* CrossoverOperatorName(CrossoverOperator op);
+int MutationOperatorByName(const char* name);
+const char* MutationOperatorName(MutationOperator op);
+
+typedef enum GenerationSchedule {
+  // Every task breeds, mutates and scores its children in one go.
+  kScheduleFused,
+  // A crossover phase over all the children, then a mutation phase.
+  kScheduleTwoPhase,
+} GenerationSchedule;
+
+typedef enum ParallelModel {
+  // One population, every generation is split over all the threads.
+  kModelGlobal,
+  // Every thread evolves an island with its share of the population
+  // on its own, and the best tours migrate between the islands.
+  kModelIslands,
+} ParallelModel;
+
+// What becomes of children that repeat a tour of their generation,
+// told apart by |TourHash|.
+typedef enum DuplicatePolicy {
+  // Not looked for.
+  kDuplicatesKeep,
+  // Counted, the share of distinct children is reported as the
+  // diversity of every generation, but selected like any other child.
+  kDuplicatesCount,
+  // Counted, and only the first child with every tour may be
+  // selected, as long as there are enough of them.
+  kDuplicatesDrop,
+} DuplicatePolicy;
+
+typedef enum MigrationTopology {
+  // Island i sends to island i + 1.
+  kTopologyRing,
+  // Every migration goes to a randomly picked island.
+  kTopologyRandom,
+} MigrationTopology;
+
+// Lets the islands of one run trade tours with the outside world,
+// such as other processes (see cluster.h). |exchange| is called by
+// the first island every migration interval with its best tour so
+// far. It returns 1 after writing a tour to adopt into |incoming|,
+// 0 if there is none, and -1 to stop the run.
+typedef struct MigrationPort {
+  void* context;
+  int (*exchange)(void* context, const City* best, int best_fitness,
+                  size_t generations, City* incoming);
+} MigrationPort;
+
+// Knobs of the solver that have a sensible default, see
+// |ShortestPathDefaultOptions|.
+typedef struct ShortestPathOptions {
+  // Runs with the same seed and arguments find the same path.
+  uint64_t seed;
+  SelectionMethod selection;
+  size_t tournament_size;
+  GenerationSchedule schedule;
+  // Memetic mode: which tours get improved by 2-opt and Or-opt,
+  // looking at the |local_search_neighbors| nearest cities, for at
+  // most |local_search_budget| cities per tour (0 means until no move
+  // helps). Needs a symmetric graph.
+  LocalSearchTarget local_search;
+  size_t local_search_neighbors;
+  size_t local_search_budget;
+  // Island model: every |migration_interval| generations, an island
+  // sends copies of its |migrants| best tours to another island.
+  // Islands run unsynchronised, so their runs are not reproducible.
+  ParallelModel model;
+  MigrationTopology migration_topology;
+  size_t migration_interval;
+  size_t migrants;
+  // Island model only, replaces the |same_fitness_for| stopping rule
+  // when not NULL.
+  const MigrationPort* port;
+  CrossoverOperator crossover;
+  MutationOperator mutation;
+  DuplicatePolicy duplicates;
+  // Kinds of tours the first generation starts from. Resumed runs
+  // start from their checkpoint instead.
+  SeedMix seeding;
+  // Global model only: every |checkpoint_interval| generations, and
+  // once more at the end, the state of the run is written to
+  // |checkpoint_path| in the background. A generation never waits for
+  // the disk, a checkpoint is skipped if the last one is still being
+  // written. NULL turns checkpoints off.
+  const char* checkpoint_path;
+  size_t checkpoint_interval;
+  // The time until the best tour is this good or better is measured,
+  // see |ShortestPathData|. It does not stop the run.
+  int target_fitness;
+  // If not NULL, a line of JSON with the phase times and worker
+  // counters so far is written to this file after every generation
+  // of the global model, and once more at the end of the run.
+  const char* metrics_path;
+  // Anytime mode: the run stops after |time_limit| seconds (0 for no
+  // limit), or as soon as |*cancel| is set, which is safe to do from
+  // a signal handler. Tasks check between tours, so the run returns
+  // the best tour of its last whole generation shortly after that;
+  // before the first one is over, that is the starting tour.
+  double time_limit;
+  atomic_int* cancel;
+  // Gets the progress of the run from a thread of its own, so the
+  // solver never waits for it, see |ProgressLog|. Reports are only
+  // dropped if it can't keep up. NULL prints the iteration lines to
+  // stdout.
+  ProgressCallback progress;
+  void* progress_context;
+  // Pin the workers of the context |ShortestPath| creates, see
+  // |SolverContextPin|. If that fails, the run goes on unpinned.
+  int pin_workers;
+} ShortestPathOptions;
+
+void ShortestPathDefaultOptions(ShortestPathOptions* options);
+
+// |options| may be NULL to use the defaults. Returns the best fitness,
+// or -1 after printing what went wrong to stderr, e.g. if the graph
+// has more cities than a tour can hold.
 int ShortestPath(const graph_t* graph,
                   size_t thread_count,
                   size_t population_size,
                   size_t same_fitness_for,
-                  ShortestPathData *return_data);
\ No newline at end of file
+                  const ShortestPathOptions* options,
+                  ShortestPathData *return_data);
+
+// Keeps the thread pool, the per-worker scratch memory and the
+// population arenas from one run to the next, so that solving many
+// graphs only starts the threads once. Memory grows to fit the
+// largest run so far and is reused after that. Runs on one context
+// must not overlap.
+typedef struct SolverContext SolverContext;
+
+SolverContext* SolverContextCreate(size_t thread_count);
+void SolverContextDelete(SolverContext* self);
+
+// Pin worker i to the i-th CPU the process may run on, taking the
+// NUMA nodes one after the other (see topology.h). From then on every
+// worker allocates its own scratch memory and island populations, the
+// global model's populations are first touched slice by slice by the
+// workers that breed them, and workers on different nodes read the
+// weights from a copy on their own. Memory reserved by earlier runs
+// stays where it is, so pin right after |SolverContextCreate|.
+// Returns 0, or -1 after printing what went wrong to stderr.
+int SolverContextPin(SolverContext* self);
+
+// |ShortestPath| on the threads of the context. Worker counters in
+// |return_data| only cover this run.
+int SolverContextSolve(SolverContext* self, const graph_t* graph,
+                       size_t population_size, size_t same_fitness_for,
+                       const ShortestPathOptions* options,
+                       ShortestPathData* return_data);
+
+// Solve |count| independent graphs, one pool task each, for
+// throughput on many small graphs. Every graph is evolved by a single
+// population of |population_size| on the worker that picks it up, as
+// an island model run with one island: its result only depends on
+// the graph and the options, not on the thread count. No progress is
+// reported, and checkpoints, metrics files and migration ports are not
+// supported. |options->time_limit| applies to every graph on its
+// own. The best fitness of graph i goes to |best_fitness[i]|;
+// |return_data| is NULL or |count| entries, whose |workers| are left
+// alone. Returns 0, or -1 after printing what went wrong to stderr if
+// a graph has more cities than a tour can hold.
+int SolverContextSolveBatch(SolverContext* self, const graph_t* const* graphs,
+                            size_t count, size_t population_size,
+                            size_t same_fitness_for,
+                            const ShortestPathOptions* options,
+                            int* best_fitness,
+                            ShortestPathData* return_data);
+
+// Carry on with the run saved at |checkpoint_path|, which has to have
+// been made on |graph| with the same |options|. The population size
+// and seed come from the checkpoint. Returns -1 if the checkpoint
+// can't be read.
+int ShortestPathResume(const graph_t* graph,
+                       size_t thread_count,
+                       const char* checkpoint_path,
+                       size_t same_fitness_for,
+                       const ShortestPathOptions* options,
+                       ShortestPathData* return_data);
+
+#endif
@@ -0,0 +1,14 @@
+# Compare the global and the island model from 1 to 64 threads.
+# Usage: sh scaling.sh [population] [same_fitness_for] [graph file]
+population=${1:-20000}
+same=${2:-10}
+graph=${3:-graph.txt}
+echo "model threads iterations time best children_per_second"
+for model in global islands
+do
+	for threads in 1 2 4 8 16 32 64
+	do
+		./main $threads $population $same --file $graph --seed 1 --model $model > /dev/null
+		head -1 stats.txt | awk -v model=$model '{print model, $1, $5, $6, $7, $8}'
+	done
+done
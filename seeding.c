@@ -0,0 +1,541 @@
+#include "seeding.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "local_search.h"
+#include "random_chunk.h"
+#include "stop_control.h"
+
+// Tours per task, every task draws from a random stream of its own.
+const size_t kSeedToursPerTask = 8;
+// Candidate neighbours of every city for nearest neighbour and greedy
+// edge tours.
+const size_t kSeedNeighbors = 8;
+// One step in this many takes the second nearest city.
+const size_t kNearestNeighborDetour = 8;
+// Greedy edge weights are scaled by a random factor in
+// [1, 1 + |kGreedyNoise| / 1024).
+const size_t kGreedyNoise = 128;
+// Bits per coordinate of the Hilbert curve.
+#define kCurveBits 16
+
+static const char* const kSeedKindNames[kSeedKindCount] = {
+    "identity", "nearest", "greedy", "curve", "shuffle",
+};
+
+typedef struct SeedEdge {
+  int64_t key;
+  City a;
+  City b;
+} SeedEdge;
+
+typedef struct SeedKey {
+  uint64_t key;
+  City city;
+} SeedKey;
+
+// Memory of the seeding tasks of one worker, allocated by the first
+// of them to run there.
+typedef struct SeedWorkspace {
+  uint8_t* visited;
+  // Cities still to be visited, and the position of every city in
+  // there.
+  City* remaining;
+  uint32_t* positions;
+  size_t remaining_count;
+  // Greedy edge: the two neighbours of every city in the matching,
+  // their number and the union-find parents of the fragments.
+  City* adjacent;
+  uint8_t* degrees;
+  uint32_t* parents;
+  SeedEdge* edges;
+  SeedKey* keys;
+} SeedWorkspace;
+
+typedef struct SeedJob {
+  Population* population;
+  // Tours [offset, offset + tours_count) of the |count| seeded.
+  size_t offset;
+  size_t tours_count;
+  size_t count;
+  const graph_t* graph;
+  const SeedMix* mix;
+  unsigned total;
+  // Nearest cities of every city, NULL on asymmetric graphs.
+  const LocalSearch* neighbors;
+  RandomProvider* provider;
+  uint64_t stream;
+  StopControl* control;
+  // One per worker of |pool|, or a single one without a pool.
+  const ThreadPool* pool;
+  SeedWorkspace* workspaces;
+} SeedJob;
+
+void SeedMixDefault(SeedMix* self) {
+  memset(self, 0, sizeof(SeedMix));
+  self->shares[kSeedIdentity] = 1;
+}
+
+int SeedMixParse(SeedMix* self, const char* text) {
+  const char* cursor = text;
+  unsigned total = 0;
+  memset(self, 0, sizeof(SeedMix));
+  while (*cursor) {
+    size_t length = strcspn(cursor, ":");
+    unsigned share;
+    int used = 0;
+    int kind;
+    for (kind = 0; kind < kSeedKindCount; ++kind) {
+      if (strlen(kSeedKindNames[kind]) == length &&
+          !strncmp(cursor, kSeedKindNames[kind], length))
+        break;
+    }
+    if (kind == kSeedKindCount || cursor[length] != ':' ||
+        sscanf(cursor + length + 1, "%u%n", &share, &used) != 1 ||
+        (cursor[length + 1 + used] && cursor[length + 1 + used] != ',')) {
+      fprintf(stderr, "bad seeding mix %s\n", text);
+      return -1;
+    }
+    self->shares[kind] = share;
+    total += share;
+    cursor += length + 1 + used;
+    if (*cursor == ',')
+      ++cursor;
+  }
+  if (!total) {
+    fprintf(stderr, "seeding mix %s has no shares\n", text);
+    return -1;
+  }
+  return 0;
+}
+
+int SeedMixIsIdentity(const SeedMix* self) {
+  int kind;
+  for (kind = 0; kind < kSeedKindCount; ++kind) {
+    if (kind != kSeedIdentity && self->shares[kind])
+      return 0;
+  }
+  return 1;
+}
+
+// Tour |index| is of the kind whose share covers it.
+static SeedKind SeedKindOf(const SeedJob* job, size_t index) {
+  size_t point = index * job->total / job->count;
+  int kind;
+  for (kind = 0; kind < kSeedKindCount - 1; ++kind) {
+    if (point < job->mix->shares[kind])
+      break;
+    point -= job->mix->shares[kind];
+  }
+  return kind;
+}
+
+static int SeedTourLength(const City* tour, size_t length,
+                          const graph_t* graph) {
+  int result = graph_weight_unchecked(graph, tour[length - 1], tour[0]);
+  size_t i;
+  for (i = 1; i < length; ++i)
+    result += graph_weight_unchecked(graph, tour[i - 1], tour[i]);
+  return result;
+}
+
+static void RemainingInit(SeedWorkspace* self, size_t length) {
+  size_t i;
+  for (i = 0; i < length; ++i) {
+    self->visited[i] = 0;
+    self->remaining[i] = i;
+    self->positions[i] = i;
+  }
+  self->remaining_count = length;
+}
+
+static void RemainingRemove(SeedWorkspace* self, City city) {
+  uint32_t position = self->positions[city];
+  City last = self->remaining[--self->remaining_count];
+  self->remaining[position] = last;
+  self->positions[last] = position;
+  self->visited[city] = 1;
+}
+
+// The remaining city nearest to |from|.
+static City NearestRemaining(const SeedWorkspace* self, const graph_t* graph,
+                             City from) {
+  City best = self->remaining[0];
+  int best_weight = graph_weight_unchecked(graph, from, best);
+  size_t i;
+  for (i = 1; i < self->remaining_count; ++i) {
+    City city = self->remaining[i];
+    int weight = graph_weight_unchecked(graph, from, city);
+    if (weight < best_weight) {
+      best = city;
+      best_weight = weight;
+    }
+  }
+  return best;
+}
+
+static void SeedIdentity(City* tour, const SeedJob* job, SeedWorkspace* w,
+                         RandomChunk* chunk) {
+  size_t i;
+  for (i = 0; i < job->graph->n; ++i)
+    tour[i] = i;
+}
+
+static void SeedShuffle(City* tour, const SeedJob* job, SeedWorkspace* w,
+                        RandomChunk* chunk) {
+  size_t i;
+  SeedIdentity(tour, job, w, chunk);
+  for (i = job->graph->n - 1; i; --i) {
+    size_t j = RandomChunkPopRandomBelow(chunk, i + 1);
+    City temp = tour[i];
+    tour[i] = tour[j];
+    tour[j] = temp;
+  }
+}
+
+static void SeedNearestNeighbor(City* tour, const SeedJob* job,
+                                SeedWorkspace* w, RandomChunk* chunk) {
+  const graph_t* graph = job->graph;
+  size_t n = graph->n;
+  City current = RandomChunkPopRandomBelow(chunk, n);
+  size_t i;
+  RemainingInit(w, n);
+  RemainingRemove(w, current);
+  tour[0] = current;
+  for (i = 1; i < n; ++i) {
+    City next = current;
+    int found = 0;
+    if (job->neighbors) {
+      size_t k = job->neighbors->neighbors_count;
+      const City* nearest = job->neighbors->neighbors + current * k;
+      int detour =
+          RandomChunkPopRandomBelow(chunk, kNearestNeighborDetour) == 0;
+      size_t j;
+      // The first city left, or the second one on a detour.
+      for (j = 0; j < k; ++j) {
+        if (w->visited[nearest[j]])
+          continue;
+        next = nearest[j];
+        found = 1;
+        if (!detour)
+          break;
+        detour = 0;
+      }
+    }
+    if (!found)
+      next = NearestRemaining(w, graph, current);
+    RemainingRemove(w, next);
+    tour[i] = next;
+    current = next;
+  }
+}
+
+static int CompareEdges(const void* left, const void* right) {
+  const SeedEdge* a = left;
+  const SeedEdge* b = right;
+  if (a->key != b->key)
+    return a->key < b->key ? -1 : 1;
+  if (a->a != b->a)
+    return a->a < b->a ? -1 : 1;
+  return (a->b > b->b) - (a->b < b->b);
+}
+
+static uint32_t FindFragment(uint32_t* parents, uint32_t city) {
+  while (parents[city] != city) {
+    parents[city] = parents[parents[city]];
+    city = parents[city];
+  }
+  return city;
+}
+
+static void SeedGreedyEdge(City* tour, const SeedJob* job, SeedWorkspace* w,
+                           RandomChunk* chunk) {
+  const graph_t* graph = job->graph;
+  size_t n = graph->n;
+  size_t k;
+  size_t edge_count = 0;
+  size_t length = 0;
+  City current;
+  size_t i;
+  if (!job->neighbors) {
+    SeedNearestNeighbor(tour, job, w, chunk);
+    return;
+  }
+  k = job->neighbors->neighbors_count;
+  for (i = 0; i < n; ++i) {
+    size_t j;
+    for (j = 0; j < k; ++j) {
+      SeedEdge* edge = w->edges + edge_count++;
+      edge->a = i;
+      edge->b = job->neighbors->neighbors[i * k + j];
+      edge->key = (int64_t)graph_weight_unchecked(graph, edge->a, edge->b) *
+                  (1024 + RandomChunkPopRandomBelow(chunk, kGreedyNoise));
+    }
+    w->degrees[i] = 0;
+    w->parents[i] = i;
+  }
+  qsort(w->edges, edge_count, sizeof(SeedEdge), CompareEdges);
+  // An edge listed from both ends is turned down the second time, its
+  // ends are in one fragment by then.
+  for (i = 0; i < edge_count; ++i) {
+    City a = w->edges[i].a;
+    City b = w->edges[i].b;
+    uint32_t fragment_a;
+    uint32_t fragment_b;
+    if (w->degrees[a] == 2 || w->degrees[b] == 2)
+      continue;
+    fragment_a = FindFragment(w->parents, a);
+    fragment_b = FindFragment(w->parents, b);
+    if (fragment_a == fragment_b)
+      continue;
+    w->parents[fragment_a] = fragment_b;
+    w->adjacent[2 * a + w->degrees[a]++] = b;
+    w->adjacent[2 * b + w->degrees[b]++] = a;
+  }
+  // The ends of the fragments are what is left to visit.
+  w->remaining_count = 0;
+  for (i = 0; i < n; ++i) {
+    w->visited[i] = 0;
+    if (w->degrees[i] < 2) {
+      w->positions[i] = w->remaining_count;
+      w->remaining[w->remaining_count++] = i;
+    }
+  }
+  current = w->remaining[RandomChunkPopRandomBelow(chunk, w->remaining_count)];
+  for (;;) {
+    // Walk the fragment from one end to the other.
+    City city = current;
+    for (;;) {
+      size_t j;
+      tour[length++] = city;
+      if (w->degrees[city] < 2)
+        RemainingRemove(w, city);
+      else
+        w->visited[city] = 1;
+      for (j = 0; j < w->degrees[city]; ++j) {
+        if (!w->visited[w->adjacent[2 * city + j]])
+          break;
+      }
+      if (j == w->degrees[city])
+        break;
+      city = w->adjacent[2 * city + j];
+    }
+    if (length == n)
+      break;
+    current = NearestRemaining(w, graph, city);
+  }
+}
+
+// Distance of the point (x, y) along a Hilbert curve through a square
+// of 2^|kCurveBits| cells a side.
+static uint64_t HilbertIndex(uint32_t x, uint32_t y) {
+  const uint32_t side = 1u << kCurveBits;
+  uint64_t index = 0;
+  uint32_t s;
+  for (s = side / 2; s; s /= 2) {
+    uint32_t rx = (x & s) != 0;
+    uint32_t ry = (y & s) != 0;
+    index += (uint64_t)s * s * ((3 * rx) ^ ry);
+    if (!ry) {
+      uint32_t temp;
+      if (rx) {
+        x = side - 1 - x;
+        y = side - 1 - y;
+      }
+      temp = x;
+      x = y;
+      y = temp;
+    }
+  }
+  return index;
+}
+
+static int CompareKeys(const void* left, const void* right) {
+  const SeedKey* a = left;
+  const SeedKey* b = right;
+  if (a->key != b->key)
+    return a->key < b->key ? -1 : 1;
+  return (a->city > b->city) - (a->city < b->city);
+}
+
+static void SeedSpaceFillingCurve(City* tour, const SeedJob* job,
+                                  SeedWorkspace* w, RandomChunk* chunk) {
+  const graph_t* graph = job->graph;
+  const double* coords = graph->coords;
+  size_t n = graph->n;
+  double low[2];
+  double high[2];
+  double offset[2];
+  double side;
+  size_t i;
+  if (!coords) {
+    SeedShuffle(tour, job, w, chunk);
+    return;
+  }
+  low[0] = high[0] = coords[0];
+  low[1] = high[1] = coords[1];
+  for (i = 1; i < n; ++i) {
+    size_t axis;
+    for (axis = 0; axis < 2; ++axis) {
+      if (coords[2 * i + axis] < low[axis])
+        low[axis] = coords[2 * i + axis];
+      if (coords[2 * i + axis] > high[axis])
+        high[axis] = coords[2 * i + axis];
+    }
+  }
+  side = high[0] - low[0] > high[1] - low[1] ? high[0] - low[0]
+                                              : high[1] - low[1];
+  if (side <= 0)
+    side = 1;
+  // The plane is shifted around a torus, so every tour cuts the curve
+  // somewhere else.
+  offset[0] = (RandomChunkPopRandomLong(chunk) >> 11) * 0x1p-53;
+  offset[1] = (RandomChunkPopRandomLong(chunk) >> 11) * 0x1p-53;
+  for (i = 0; i < n; ++i) {
+    uint32_t cell[2];
+    size_t axis;
+    for (axis = 0; axis < 2; ++axis) {
+      double position = (coords[2 * i + axis] - low[axis]) / side +
+                        offset[axis];
+      if (position >= 1)
+        position -= 1;
+      cell[axis] = (uint32_t)(position * ((1u << kCurveBits) - 1));
+    }
+    w->keys[i].key = HilbertIndex(cell[0], cell[1]);
+    w->keys[i].city = i;
+  }
+  qsort(w->keys, n, sizeof(SeedKey), CompareKeys);
+  for (i = 0; i < n; ++i)
+    tour[i] = w->keys[i].city;
+}
+
+// Builders of the kinds of tours, indexed by |SeedKind|.
+static void (*const kSeeders[kSeedKindCount])(City*, const SeedJob*,
+                                              SeedWorkspace*, RandomChunk*) = {
+    SeedIdentity,
+    SeedNearestNeighbor,
+    SeedGreedyEdge,
+    SeedSpaceFillingCurve,
+    SeedShuffle,
+};
+
+static void SeedWorkspaceInit(SeedWorkspace* self, size_t length) {
+  self->visited = malloc(length);
+  self->remaining = malloc(length * sizeof(City));
+  self->positions = malloc(length * sizeof(uint32_t));
+  self->adjacent = malloc(2 * length * sizeof(City));
+  self->degrees = malloc(length);
+  self->parents = malloc(length * sizeof(uint32_t));
+  self->edges = malloc(length * kSeedNeighbors * sizeof(SeedEdge));
+  self->keys = malloc(length * sizeof(SeedKey));
+  assert(self->visited && self->remaining && self->positions &&
+         self->adjacent && self->degrees && self->parents && self->edges &&
+         self->keys);
+}
+
+// Also fine for a zeroed workspace that was never initialised.
+static void SeedWorkspaceDestroy(SeedWorkspace* self) {
+  free(self->visited);
+  free(self->remaining);
+  free(self->positions);
+  free(self->adjacent);
+  free(self->degrees);
+  free(self->parents);
+  free(self->edges);
+  free(self->keys);
+}
+
+static void SeedTask(void* in) {
+  SeedJob* job = in;
+  size_t n = job->graph->n;
+  int identity = SeedMixIsIdentity(job->mix);
+  SeedWorkspace* workspace =
+      job->workspaces + (job->pool ? ThreadPoolWorkerIndex(job->pool) : 0);
+  RandomChunk chunk;
+  size_t i;
+  if (!identity) {
+    if (!workspace->visited)
+      SeedWorkspaceInit(workspace, n);
+    RandomChunkInit(&chunk, job->provider, job->stream);
+  }
+  for (i = job->offset; i < job->offset + job->tours_count; ++i) {
+    City* tour = PopulationTour(job->population, i);
+    SeedKind kind = SeedKindOf(job, i);
+    if (job->control && StopControlCheck(job->control))
+      kind = kSeedIdentity;
+    kSeeders[kind](tour, job, workspace, &chunk);
+    job->population->fitness[i] = SeedTourLength(tour, n, job->graph);
+  }
+  if (!identity)
+    RandomChunkDestroy(&chunk);
+}
+
+void SeedPopulation(Population* population, size_t count,
+                    const graph_t* graph, const SeedMix* mix,
+                    ThreadPool* pool, RandomProvider* provider,
+                    uint64_t* next_stream, StopControl* control) {
+  size_t task_count = (count + kSeedToursPerTask - 1) / kSeedToursPerTask;
+  SeedJob* jobs = malloc(task_count * sizeof(SeedJob));
+  ThreadTask* tasks = malloc(task_count * sizeof(ThreadTask));
+  ThreadTask** task_pointers = malloc(task_count * sizeof(ThreadTask*));
+  size_t workspace_count = pool ? pool->thread_count_ : 1;
+  SeedWorkspace* workspaces = calloc(workspace_count, sizeof(SeedWorkspace));
+  int identity = SeedMixIsIdentity(mix);
+  LocalSearch neighbors;
+  int has_neighbors = !identity && graph->symmetric &&
+                      (mix->shares[kSeedNearestNeighbor] ||
+                       mix->shares[kSeedGreedyEdge]);
+  unsigned total = 0;
+  size_t i;
+  assert(jobs && tasks && task_pointers && workspaces);
+  assert(count <= population->count && population->length == graph->n);
+  for (i = 0; i < kSeedKindCount; ++i)
+    total += mix->shares[i];
+  assert(total);
+  // Nobody would wait for the lists to be used.
+  if (control && StopControlCheck(control))
+    has_neighbors = 0;
+  if (has_neighbors)
+    LocalSearchInit(&neighbors, graph, kSeedNeighbors, pool);
+  for (i = 0; i < task_count; ++i) {
+    SeedJob* job = jobs + i;
+    job->population = population;
+    job->offset = i * kSeedToursPerTask;
+    job->tours_count = count - job->offset < kSeedToursPerTask
+                           ? count - job->offset
+                           : kSeedToursPerTask;
+    job->count = count;
+    job->graph = graph;
+    job->mix = mix;
+    job->total = total;
+    job->neighbors = has_neighbors ? &neighbors : NULL;
+    job->provider = provider;
+    job->stream = *next_stream + i;
+    job->control = control;
+    job->pool = pool;
+    job->workspaces = workspaces;
+    ThreadPoolCreateTask(tasks + i, job, SeedTask);
+    task_pointers[i] = tasks + i;
+  }
+  // Identity tours draw no random numbers.
+  if (!identity)
+    *next_stream += task_count;
+  if (pool) {
+    ThreadPoolAddTasks(pool, task_pointers, task_count);
+    ThreadPoolWait(pool);
+  } else {
+    for (i = 0; i < task_count; ++i)
+      SeedTask(jobs + i);
+  }
+  if (has_neighbors)
+    LocalSearchDestroy(&neighbors);
+  for (i = 0; i < workspace_count; ++i)
+    SeedWorkspaceDestroy(workspaces + i);
+  free(workspaces);
+  free(jobs);
+  free(tasks);
+  free(task_pointers);
+}
@@ -0,0 +1,62 @@
+#ifndef SEEDING_H
+#define SEEDING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "graph.h"
+#include "population.h"
+#include "random_provider.h"
+#include "thread_pool.h"
+
+struct StopControl;
+
+// Kinds of starting tours.
+typedef enum SeedKind {
+  // 0, 1, ..., n - 1.
+  kSeedIdentity,
+  // Nearest neighbour from a random city, now and then taking the
+  // second nearest instead.
+  kSeedNearestNeighbor,
+  // Greedy matching of the shortest edges, with some noise on the
+  // weights, the fragments joined nearest end first. Nearest
+  // neighbour on asymmetric graphs.
+  kSeedGreedyEdge,
+  // The cities in the order of a Hilbert curve through a randomly
+  // shifted copy of the plane. Coordinate graphs only, shuffled
+  // tours on the others.
+  kSeedSpaceFillingCurve,
+  // Uniformly random tours.
+  kSeedShuffle,
+  kSeedKindCount,
+} SeedKind;
+
+// How much of the starting population is of every kind, as relative
+// shares. Tours are handed out in the order of the kinds above.
+typedef struct SeedMix {
+  unsigned shares[kSeedKindCount];
+} SeedMix;
+
+// Identity tours only, which is how the solver has always started.
+void SeedMixDefault(SeedMix* self);
+
+// Parse a mix like "nearest:2,greedy:1,shuffle:1" out of the kinds
+// identity, nearest, greedy, curve and shuffle; the ones left out get
+// no share. Returns 0, or -1 after printing what is wrong to stderr.
+int SeedMixParse(SeedMix* self, const char* text);
+
+// 1 if every tour is an identity tour, which needs no random streams.
+int SeedMixIsIdentity(const SeedMix* self);
+
+// Fill the first |count| tours of |population| and their fitness
+// with tasks on |pool|, or on the calling thread if it is NULL.
+// Random streams are taken starting with |*next_stream|, which is
+// advanced past them, so the tours only depend on the streams. Once
+// |control|, which may be NULL, says to stop, the tours left are
+// identity tours.
+void SeedPopulation(Population* population, size_t count,
+                    const graph_t* graph, const SeedMix* mix,
+                    ThreadPool* pool, RandomProvider* provider,
+                    uint64_t* next_stream, struct StopControl* control);
+
+#endif
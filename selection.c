@@ -0,0 +1,291 @@
+#include "selection.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "random_chunk.h"
+
+// Slices per pool thread, a few more than one so that the work
+// can be balanced by stealing.
+const size_t kSelectionSlicesPerThread = 4;
+// Buckets of one radix select pass.
+#define kSelectionBuckets 1024
+// Tournament slots drawn from one random stream. Fixed, so that
+// the streams don't depend on how the work is sliced.
+const size_t kTournamentSlotsPerStream = 256;
+
+typedef struct SelectionSlice {
+  Selection* selection;
+  size_t index;
+  // Children [begin, end) are looked at by this slice.
+  size_t begin;
+  size_t end;
+  // Partial statistics.
+  int best;
+  int worst;
+  size_t best_index;
+  int64_t sum;
+  uint32_t histogram[kSelectionBuckets];
+  // Children below and equal to the truncation threshold, and
+  // where in |survivors| they go.
+  size_t below;
+  size_t equal;
+  size_t below_offset;
+  size_t equal_offset;
+  size_t equal_take;
+} SelectionSlice;
+
+void SelectionInit(Selection* self, ThreadPool* pool, SelectionMethod method,
+                   size_t tournament_size, size_t children_count,
+                   size_t survivors_count) {
+  size_t i;
+  size_t slice_count = pool ? pool->thread_count_ * kSelectionSlicesPerThread
+                            : 1;
+  assert(survivors_count && survivors_count <= children_count);
+  assert(method != kSelectionTournament || tournament_size);
+  if (slice_count > children_count)
+    slice_count = children_count;
+  self->pool_ = pool;
+  self->method_ = method;
+  self->tournament_size_ = tournament_size;
+  self->survivors_count_ = survivors_count;
+  self->slice_count_ = slice_count;
+  self->slices_ = malloc(slice_count * sizeof(SelectionSlice));
+  self->tasks_ = malloc(slice_count * sizeof(ThreadTask));
+  self->task_pointers_ = malloc(slice_count * sizeof(ThreadTask*));
+  self->histogram_ = malloc(kSelectionBuckets * sizeof(uint32_t));
+  assert(self->slices_ && self->tasks_ && self->task_pointers_ &&
+         self->histogram_);
+  for (i = 0; i < slice_count; ++i) {
+    SelectionSlice* slice = self->slices_ + i;
+    slice->selection = self;
+    slice->index = i;
+  }
+}
+
+void SelectionDestroy(Selection* self) {
+  free(self->slices_);
+  free(self->tasks_);
+  free(self->task_pointers_);
+  free(self->histogram_);
+}
+
+// Run |func| once for every slice and wait for all of them.
+void RunSelectionPass(Selection* self, void (*func)(void*)) {
+  size_t i;
+  if (!self->pool_) {
+    for (i = 0; i < self->slice_count_; ++i)
+      func(self->slices_ + i);
+    return;
+  }
+  for (i = 0; i < self->slice_count_; ++i) {
+    ThreadPoolCreateTask(self->tasks_ + i, self->slices_ + i, func);
+    self->task_pointers_[i] = self->tasks_ + i;
+  }
+  ThreadPoolAddTasks(self->pool_, self->task_pointers_, self->slice_count_);
+  ThreadPoolWait(self->pool_);
+}
+
+void StatsTask(void* in) {
+  SelectionSlice* slice = in;
+  const int* fitness = slice->selection->children_->fitness;
+  size_t i;
+  slice->best = INT_MAX;
+  slice->worst = INT_MIN;
+  slice->best_index = slice->begin;
+  slice->sum = 0;
+  for (i = slice->begin; i < slice->end; ++i) {
+    if (fitness[i] < slice->best) {
+      slice->best = fitness[i];
+      slice->best_index = i;
+    }
+    if (fitness[i] > slice->worst)
+      slice->worst = fitness[i];
+    slice->sum += fitness[i];
+  }
+}
+
+void HistogramTask(void* in) {
+  SelectionSlice* slice = in;
+  Selection* self = slice->selection;
+  const int* fitness = self->children_->fitness;
+  size_t i;
+  memset(slice->histogram, 0, sizeof(slice->histogram));
+  for (i = slice->begin; i < slice->end; ++i) {
+    if (fitness[i] >= self->low_ && fitness[i] <= self->high_)
+      ++slice->histogram[(uint32_t)(fitness[i] - self->low_) >> self->shift_];
+  }
+}
+
+void CountTask(void* in) {
+  SelectionSlice* slice = in;
+  Selection* self = slice->selection;
+  const int* fitness = self->children_->fitness;
+  size_t i;
+  slice->below = 0;
+  slice->equal = 0;
+  for (i = slice->begin; i < slice->end; ++i) {
+    if (fitness[i] < self->low_)
+      ++slice->below;
+    else if (fitness[i] == self->low_)
+      ++slice->equal;
+  }
+}
+
+void CompactTask(void* in) {
+  SelectionSlice* slice = in;
+  Selection* self = slice->selection;
+  const int* fitness = self->children_->fitness;
+  size_t below_cursor = slice->below_offset;
+  size_t equal_cursor = slice->equal_offset;
+  size_t equal_end = slice->equal_offset + slice->equal_take;
+  size_t i;
+  for (i = slice->begin; i < slice->end; ++i) {
+    if (fitness[i] < self->low_)
+      self->survivors_[below_cursor++] = i;
+    else if (fitness[i] == self->low_ && equal_cursor < equal_end)
+      self->survivors_[equal_cursor++] = i;
+  }
+}
+
+// Truncation: find the fitness of the |survivors_count|-th best
+// child with a radix select, then let every slice copy out its
+// children below (and enough of the ones equal to) that fitness.
+void TruncationSelect(Selection* self, const SelectionStats* stats) {
+  size_t needed = self->survivors_count_;
+  size_t below_total = 0;
+  size_t equal_left;
+  size_t i;
+  self->low_ = stats->best;
+  self->high_ = stats->worst;
+  // Invariant: the children with fitness in [low_, high_] are at
+  // least |needed|, and the ones below low_ all survive.
+  for (;;) {
+    uint64_t range = (uint64_t)((int64_t)self->high_ - self->low_);
+    size_t bucket = 0;
+    int64_t bucket_low;
+    int64_t bucket_high;
+    self->shift_ = 0;
+    while ((range >> self->shift_) >= kSelectionBuckets)
+      ++self->shift_;
+    RunSelectionPass(self, HistogramTask);
+    memset(self->histogram_, 0, kSelectionBuckets * sizeof(uint32_t));
+    for (i = 0; i < self->slice_count_; ++i) {
+      size_t j;
+      for (j = 0; j < kSelectionBuckets; ++j)
+        self->histogram_[j] += self->slices_[i].histogram[j];
+    }
+    while (self->histogram_[bucket] < needed) {
+      needed -= self->histogram_[bucket];
+      ++bucket;
+      assert(bucket < kSelectionBuckets);
+    }
+    bucket_low = self->low_ + ((int64_t)bucket << self->shift_);
+    bucket_high = bucket_low + ((int64_t)1 << self->shift_) - 1;
+    self->low_ = (int)bucket_low;
+    if (bucket_high < self->high_)
+      self->high_ = (int)bucket_high;
+    if (!self->shift_)
+      break;
+  }
+  // |low_| is now the threshold, and |needed| of the children
+  // equal to it survive. Ties go to the lowest indices.
+  RunSelectionPass(self, CountTask);
+  for (i = 0; i < self->slice_count_; ++i) {
+    self->slices_[i].below_offset = below_total;
+    below_total += self->slices_[i].below;
+  }
+  assert(below_total + needed == self->survivors_count_);
+  equal_left = needed;
+  for (i = 0; i < self->slice_count_; ++i) {
+    SelectionSlice* slice = self->slices_ + i;
+    slice->equal_offset = below_total + (needed - equal_left);
+    slice->equal_take = slice->equal < equal_left ? slice->equal : equal_left;
+    equal_left -= slice->equal_take;
+  }
+  assert(!equal_left);
+  RunSelectionPass(self, CompactTask);
+}
+
+void TournamentTask(void* in) {
+  SelectionSlice* slice = in;
+  Selection* self = slice->selection;
+  const int* fitness = self->children_->fitness;
+  size_t children_count = self->children_->count;
+  size_t begin = self->survivors_count_ * slice->index / self->slice_count_;
+  size_t end = self->survivors_count_ * (slice->index + 1) / self->slice_count_;
+  size_t slot;
+  RandomChunk chunk;
+  for (slot = begin; slot < end; ++slot) {
+    size_t winner;
+    if (slot == begin || slot % kTournamentSlotsPerStream == 0) {
+      // Skip ahead to where this slot's stream would be.
+      size_t block = slot / kTournamentSlotsPerStream;
+      size_t skip = slot - block * kTournamentSlotsPerStream;
+      RandomChunkInit(&chunk, self->provider_, self->first_stream_ + block);
+      for (; skip; --skip) {
+        size_t draw;
+        for (draw = 0; draw < self->tournament_size_; ++draw)
+          RandomChunkPopRandomBelow(&chunk, children_count);
+      }
+    }
+    winner = RandomChunkPopRandomBelow(&chunk, children_count);
+    size_t round;
+    for (round = 1; round < self->tournament_size_; ++round) {
+      size_t rival = RandomChunkPopRandomBelow(&chunk, children_count);
+      if (fitness[rival] < fitness[winner] ||
+          (fitness[rival] == fitness[winner] && rival < winner))
+        winner = rival;
+    }
+    self->survivors_[slot] = winner;
+  }
+  RandomChunkDestroy(&chunk);
+}
+
+void TournamentSelect(Selection* self, const SelectionStats* stats) {
+  RunSelectionPass(self, TournamentTask);
+}
+
+// Selection methods, indexed by |SelectionMethod|.
+void (*const kSelectors[])(Selection*, const SelectionStats*) = {
+    TruncationSelect,
+    TournamentSelect,
+};
+
+void SelectionRun(Selection* self, const Population* children,
+                  RandomProvider* provider, uint64_t* next_stream,
+                  size_t* survivors, SelectionStats* stats) {
+  size_t i;
+  int64_t sum = 0;
+  assert(children->count >= self->survivors_count_);
+  for (i = 0; i < self->slice_count_; ++i) {
+    SelectionSlice* slice = self->slices_ + i;
+    slice->begin = children->count * i / self->slice_count_;
+    slice->end = children->count * (i + 1) / self->slice_count_;
+  }
+  self->children_ = children;
+  self->survivors_ = survivors;
+  self->provider_ = provider;
+  self->first_stream_ = *next_stream;
+  *next_stream += (self->survivors_count_ + kTournamentSlotsPerStream - 1) /
+                  kTournamentSlotsPerStream;
+  RunSelectionPass(self, StatsTask);
+  stats->best = INT_MAX;
+  stats->worst = INT_MIN;
+  stats->best_index = 0;
+  // Slices are in index order, so the first best one wins ties.
+  for (i = 0; i < self->slice_count_; ++i) {
+    const SelectionSlice* slice = self->slices_ + i;
+    if (slice->best < stats->best) {
+      stats->best = slice->best;
+      stats->best_index = slice->best_index;
+    }
+    if (slice->worst > stats->worst)
+      stats->worst = slice->worst;
+    sum += slice->sum;
+  }
+  stats->average = (double)sum / children->count;
+  kSelectors[self->method_](self, stats);
+}
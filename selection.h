@@ -0,0 +1,73 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "population.h"
+#include "random_provider.h"
+#include "thread_pool.h"
+
+typedef enum SelectionMethod {
+  // Keep the |survivors_count| fittest children.
+  kSelectionTruncation,
+  // Fill every survivor slot with the fittest of
+  // |tournament_size| randomly picked children.
+  kSelectionTournament,
+} SelectionMethod;
+
+typedef struct SelectionStats {
+  int best;
+  int worst;
+  size_t best_index;
+  double average;
+} SelectionStats;
+
+struct SelectionSlice;
+
+// Parallel selection over a population. The children are split
+// into slices, one pool task each, and every method is built out of
+// passes over those slices: statistics are reduced from per-slice
+// partial results, and truncation finds its cut-off with a radix
+// select over per-slice fitness histograms instead of sorting.
+typedef struct Selection {
+  ThreadPool* pool_;
+  SelectionMethod method_;
+  size_t tournament_size_;
+  size_t survivors_count_;
+  size_t slice_count_;
+  struct SelectionSlice* slices_;
+  ThreadTask* tasks_;
+  ThreadTask** task_pointers_;
+  // Merged histogram of the current radix select pass.
+  uint32_t* histogram_;
+  // State of the current run.
+  const Population* children_;
+  size_t* survivors_;
+  RandomProvider* provider_;
+  uint64_t first_stream_;
+  int low_;
+  int high_;
+  int shift_;
+  size_t equal_needed_;
+} Selection;
+
+// Prepare to select |survivors_count| out of |children_count|
+// children. All the memory is allocated here. With a NULL |pool| the
+// selection runs on the calling thread, which may be a pool task.
+void SelectionInit(Selection* self, ThreadPool* pool, SelectionMethod method,
+                   size_t tournament_size, size_t children_count,
+                   size_t survivors_count);
+void SelectionDestroy(Selection* self);
+
+// Write the indices of the children that survive into |survivors|
+// and the statistics of |children| into |stats|. Random streams are
+// taken starting with |*next_stream|, which is advanced past them.
+// The result only depends on the children and the streams. There
+// may be fewer children than |SelectionInit| was told, but no fewer
+// than the survivors.
+void SelectionRun(Selection* self, const Population* children,
+                  RandomProvider* provider, uint64_t* next_stream,
+                  size_t* survivors, SelectionStats* stats);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef STOP_CONTROL_H
+#define STOP_CONTROL_H
+
+#include <stdatomic.h>
+#include <time.h>
+
+static inline double Seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1.0e9;
+}
+
+// Tells a run to stop before |same_fitness_for| says so. Tasks poll
+// it between tours, a generation whose tasks were cut short is thrown
+// away.
+typedef struct StopControl {
+  atomic_int stopped;
+  // Set from outside the run, may be NULL.
+  atomic_int* cancel;
+  // On the clock of |Seconds|, 0 for none.
+  double deadline;
+} StopControl;
+
+// Whether the run has to stop, which from then on it has.
+static inline int StopControlCheck(StopControl* self) {
+  if (atomic_load_explicit(&self->stopped, memory_order_relaxed))
+    return 1;
+  if ((self->cancel && atomic_load(self->cancel)) ||
+      (self->deadline > 0 && Seconds() >= self->deadline)) {
+    atomic_store(&self->stopped, 1);
+    return 1;
+  }
+  return 0;
+}
+
+// Whether a check has found that the run has to stop.
+static inline int StopControlStopped(StopControl* self) {
+  return atomic_load(&self->stopped);
+}
+
+#endif
@@ -6,89 +6,306 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-ThreadTask* PopTask(ThreadPool* self) {
-  void* result;
-  pthread_mutex_lock(&(self->queue_mutex_));
-  while (!atomic_load(&(self->shutdown_)) && !self->task_count_)
-    pthread_cond_wait(&(self->queue_condvar_), &(self->queue_mutex_));
-  if (self->task_count_) {
-    result = QueuePop(&(self->queue_));
-    --self->task_count_;
-  } else {
-    result = NULL;
-  }
-  pthread_mutex_unlock(&(self->queue_mutex_));
-  pthread_cond_signal(&(self->queue_condvar_));
+#include "metrics.h"
+
+const size_t kTaskDequeInitialCapacity = 64;
+// Upper bound on how many tasks a thief takes in one go.
+#define kMaxStolenTasks 32
+
+// Ring buffer of tasks. The owning worker pushes and pops at the
+// back, thieves take the oldest tasks from the front.
+typedef struct TaskDeque {
+  ThreadTask** tasks_;
+  size_t capacity_;
+  size_t head_;
+  size_t size_;
+  pthread_mutex_t mutex_;
+} TaskDeque;
+
+typedef struct ThreadPoolWorker {
+  pthread_t thread_;
+  TaskDeque deque_;
+  ThreadPool* pool_;
+  size_t index_;
+  unsigned random_state_;
+  WorkerCounters counters_;
+} ThreadPoolWorker;
+
+// Worker the current thread belongs to, NULL outside of the pool.
+static _Thread_local ThreadPoolWorker* current_worker = NULL;
+
+void TaskDequeInit(TaskDeque* self) {
+  self->capacity_ = kTaskDequeInitialCapacity;
+  self->tasks_ = malloc(self->capacity_ * sizeof(ThreadTask*));
+  self->head_ = 0;
+  self->size_ = 0;
+  pthread_mutex_init(&(self->mutex_), NULL);
+}
+
+void TaskDequeDestroy(TaskDeque* self) {
+  assert(!self->size_);
+  free(self->tasks_);
+  pthread_mutex_destroy(&(self->mutex_));
+}
+
+// Lock the deque, timing the wait if somebody else holds it.
+static inline void TaskDequeLock(TaskDeque* self) {
+  uint64_t begin;
+  if (!pthread_mutex_trylock(&(self->mutex_)))
+    return;
+  begin = MetricsNow();
+  pthread_mutex_lock(&(self->mutex_));
+  MetricsAddToWorker(lock_wait, MetricsNow() - begin);
+}
+
+// Make room for |extra| more tasks. Must be called with the lock held.
+void TaskDequeReserve(TaskDeque* self, size_t extra) {
+  size_t capacity = self->capacity_;
+  size_t i;
+  ThreadTask** tasks;
+  if (self->size_ + extra <= capacity)
+    return;
+  while (capacity < self->size_ + extra)
+    capacity *= 2;
+  tasks = malloc(capacity * sizeof(ThreadTask*));
+  for (i = 0; i < self->size_; ++i)
+    tasks[i] = self->tasks_[(self->head_ + i) & (self->capacity_ - 1)];
+  free(self->tasks_);
+  self->tasks_ = tasks;
+  self->capacity_ = capacity;
+  self->head_ = 0;
+}
+
+void TaskDequePushBack(TaskDeque* self, ThreadTask* const* tasks,
+                       size_t count) {
+  size_t i;
+  TaskDequeLock(self);
+  TaskDequeReserve(self, count);
+  for (i = 0; i < count; ++i) {
+    size_t index = (self->head_ + self->size_) & (self->capacity_ - 1);
+    self->tasks_[index] = tasks[i];
+    ++self->size_;
+  }
+  pthread_mutex_unlock(&(self->mutex_));
+}
+
+ThreadTask* TaskDequePopBack(TaskDeque* self) {
+  ThreadTask* result = NULL;
+  TaskDequeLock(self);
+  if (self->size_) {
+    --self->size_;
+    result = self->tasks_[(self->head_ + self->size_) & (self->capacity_ - 1)];
+  }
+  pthread_mutex_unlock(&(self->mutex_));
   return result;
 }
 
-void PushTask(ThreadPool* self, ThreadTask* data) {
-  // printf("Task added\n");
-  pthread_mutex_lock(&(self->queue_mutex_));
-  QueuePush(&(self->queue_), data);
-  ++self->task_count_;
-  pthread_mutex_unlock(&(self->queue_mutex_));
-  pthread_cond_signal(&(self->queue_condvar_));
+// Take up to half of the tasks from the front of the deque.
+// Returns how many tasks were written to |out|.
+size_t TaskDequeStealFront(TaskDeque* self, ThreadTask** out) {
+  size_t count;
+  size_t i;
+  TaskDequeLock(self);
+  count = (self->size_ + 1) / 2;
+  if (count > kMaxStolenTasks)
+    count = kMaxStolenTasks;
+  for (i = 0; i < count; ++i) {
+    out[i] = self->tasks_[self->head_];
+    self->head_ = (self->head_ + 1) & (self->capacity_ - 1);
+  }
+  self->size_ -= count;
+  pthread_mutex_unlock(&(self->mutex_));
+  return count;
+}
+
+// Wake up parked workers if there are any. Called after
+// |queued_count_| has been increased.
+void WakeWorkers(ThreadPool* self, size_t count) {
+  if (!atomic_load(&(self->sleeping_count_)))
+    return;
+  pthread_mutex_lock(&(self->park_mutex_));
+  if (count > 1)
+    pthread_cond_broadcast(&(self->park_condvar_));
+  else
+    pthread_cond_signal(&(self->park_condvar_));
+  pthread_mutex_unlock(&(self->park_mutex_));
+}
+
+void PushTasks(ThreadPool* self, ThreadPoolWorker* worker,
+               ThreadTask* const* tasks, size_t count) {
+  // Counters go up first so they never drop below the real number
+  // of tasks in the deques.
+  atomic_fetch_add(&(self->active_count_), count);
+  atomic_fetch_add(&(self->queued_count_), count);
+  TaskDequePushBack(&(worker->deque_), tasks, count);
+  WakeWorkers(self, count);
+}
+
+unsigned WorkerRandom(ThreadPoolWorker* self) {
+  unsigned x = self->random_state_;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  self->random_state_ = x;
+  return x;
+}
+
+// Try to take tasks from randomly chosen victims. The first stolen
+// task is returned, the rest are moved to the worker's own deque.
+ThreadTask* StealTask(ThreadPoolWorker* self) {
+  ThreadPool* pool = self->pool_;
+  ThreadTask* stolen[kMaxStolenTasks];
+  size_t attempt;
+  if (pool->thread_count_ < 2)
+    return NULL;
+  for (attempt = 0; attempt < 2 * pool->thread_count_; ++attempt) {
+    size_t victim = WorkerRandom(self) % (pool->thread_count_ - 1);
+    size_t count;
+    if (victim >= self->index_)
+      ++victim;
+    count = TaskDequeStealFront(&(pool->workers_[victim].deque_), stolen);
+    if (count) {
+      MetricsAdd(&(self->counters_.steals), count);
+      if (count > 1)
+        TaskDequePushBack(&(self->deque_), stolen + 1, count - 1);
+      return stolen[0];
+    }
+    if (!atomic_load(&(pool->queued_count_)))
+      break;
+  }
+  return NULL;
+}
+
+ThreadTask* PopTask(ThreadPoolWorker* self) {
+  ThreadPool* pool = self->pool_;
+  ThreadTask* result;
+  uint64_t parked;
+  for (;;) {
+    result = TaskDequePopBack(&(self->deque_));
+    if (!result)
+      result = StealTask(self);
+    if (result) {
+      atomic_fetch_sub(&(pool->queued_count_), 1);
+      return result;
+    }
+    // Nothing to do: park until somebody queues a task.
+    parked = MetricsNow();
+    pthread_mutex_lock(&(pool->park_mutex_));
+    atomic_fetch_add(&(pool->sleeping_count_), 1);
+    while (!atomic_load(&(pool->queued_count_)) &&
+           !atomic_load(&(pool->shutdown_)))
+      pthread_cond_wait(&(pool->park_condvar_), &(pool->park_mutex_));
+    atomic_fetch_sub(&(pool->sleeping_count_), 1);
+    pthread_mutex_unlock(&(pool->park_mutex_));
+    MetricsAdd(&(self->counters_.idle), MetricsNow() - parked);
+    if (!atomic_load(&(pool->queued_count_)) &&
+        atomic_load(&(pool->shutdown_)))
+      return NULL;
+  }
+}
+
+// Mark one active task as finished, waking up the waiters
+// if it was the last one.
+void FinishTask(ThreadPool* self) {
+  if (atomic_fetch_sub(&(self->active_count_), 1) == 1) {
+    pthread_mutex_lock(&(self->park_mutex_));
+    pthread_cond_broadcast(&(self->idle_condvar_));
+    pthread_mutex_unlock(&(self->park_mutex_));
+  }
 }
 
 void* ThreadPoolThreadLoop(void* in) {
-  ThreadPool* pool = in;
+  ThreadPoolWorker* worker = in;
+  ThreadPool* pool = worker->pool_;
   ThreadTask* task = NULL;
 
-  while ((task = PopTask(pool))) {
+  current_worker = worker;
+  metrics_worker = &(worker->counters_);
+  while ((task = PopTask(worker))) {
+    uint64_t begin = MetricsNow();
     task->task(task->data);
+    MetricsAdd(&(worker->counters_.busy), MetricsNow() - begin);
+    MetricsAdd(&(worker->counters_.tasks), 1);
+    // The dependant is queued before this task is accounted as
+    // finished, so the waiters never see an empty pool in between.
     if (task->dep_) {
       if (atomic_fetch_sub(&(task->dep_->pending_), 1) == 1) {
         ThreadPoolAddTask(pool, task->dep_);
       }
     }
-    free(task);
+    FinishTask(pool);
   }
+  current_worker = NULL;
+  metrics_worker = NULL;
   return NULL;
 }
 
 void ThreadPoolInit(ThreadPool* self, size_t thread_count) {
+  size_t i;
   self->thread_count_ = thread_count;
-  self->threads_ = malloc(thread_count * sizeof(pthread_t));
+  self->workers_ = malloc(thread_count * sizeof(ThreadPoolWorker));
+  for (i = 0; i < thread_count; ++i) {
+    ThreadPoolWorker* worker = self->workers_ + i;
+    TaskDequeInit(&(worker->deque_));
+    worker->pool_ = self;
+    worker->index_ = i;
+    worker->random_state_ = 2463534242u + 7919 * i;
+    atomic_init(&(worker->counters_.tasks), 0);
+    atomic_init(&(worker->counters_.steals), 0);
+    atomic_init(&(worker->counters_.streams), 0);
+    atomic_init(&(worker->counters_.busy), 0);
+    atomic_init(&(worker->counters_.idle), 0);
+    atomic_init(&(worker->counters_.lock_wait), 0);
+  }
   atomic_store(&(self->shutdown_), 0);
   atomic_store(&(self->done_), 0);
-  self->task_count_ = 0;
-  QueueInit(&(self->queue_));
-  pthread_mutex_init(&(self->queue_mutex_), NULL);
-  pthread_cond_init(&(self->queue_condvar_), NULL);
+  atomic_store(&(self->queued_count_), 0);
+  atomic_store(&(self->active_count_), 0);
+  atomic_store(&(self->sleeping_count_), 0);
+  atomic_store(&(self->next_worker_), 0);
+  pthread_mutex_init(&(self->park_mutex_), NULL);
+  pthread_cond_init(&(self->park_condvar_), NULL);
+  pthread_cond_init(&(self->idle_condvar_), NULL);
 }
 
 void ThreadPoolDestroy(ThreadPool* self) {
+  size_t i;
   if (!atomic_load(&(self->done_))) {
     ThreadPoolShutdown(self);
     ThreadPoolJoin(self);
   }
-  free(self->threads_);
-  assert(QueueEmpty(&(self->queue_)));
-  QueueDestroy(&(self->queue_));
-  pthread_mutex_destroy(&(self->queue_mutex_));
-  pthread_cond_destroy(&(self->queue_condvar_));
+  assert(!atomic_load(&(self->queued_count_)));
+  for (i = 0; i < self->thread_count_; ++i) {
+    TaskDequeDestroy(&(self->workers_[i].deque_));
+  }
+  free(self->workers_);
+  pthread_mutex_destroy(&(self->park_mutex_));
+  pthread_cond_destroy(&(self->park_condvar_));
+  pthread_cond_destroy(&(self->idle_condvar_));
 }
 
 void ThreadPoolStart(ThreadPool* self) {
   size_t thread;
   for (thread = 0; thread < self->thread_count_; thread++) {
-    pthread_create(self->threads_ + thread, NULL, ThreadPoolThreadLoop, self);
+    ThreadPoolWorker* worker = self->workers_ + thread;
+    pthread_create(&(worker->thread_), NULL, ThreadPoolThreadLoop, worker);
   }
 }
 
 void ThreadPoolReset(ThreadPool* self) {
   assert(atomic_load(&(self->shutdown_)));
   assert(atomic_load(&(self->done_)));
-  assert(QueueEmpty(&(self->queue_)));
-  assert(!self->task_count_);
+  assert(!atomic_load(&(self->queued_count_)));
+  assert(!atomic_load(&(self->active_count_)));
   atomic_store(&(self->shutdown_), 0);
   atomic_store(&(self->done_), 0);
 }
 
 void ThreadPoolShutdown(ThreadPool* self) {
+  pthread_mutex_lock(&(self->park_mutex_));
   atomic_store(&(self->shutdown_), 1);
-  pthread_cond_signal(&(self->queue_condvar_));
+  pthread_cond_broadcast(&(self->park_condvar_));
+  pthread_mutex_unlock(&(self->park_mutex_));
 }
 
 void ThreadPoolCreateTask(ThreadTask* task, void* data, void (*func)(void*)) {
@@ -104,16 +321,101 @@ void ThreadPoolSetDependant(ThreadTask* parent, ThreadTask* dep) {
 }
 
 void ThreadPoolAddTask(ThreadPool* self, ThreadTask* task) {
+  ThreadPoolWorker* worker = current_worker;
+  if (atomic_load(&(self->shutdown_))) {
+    return;
+  }
+  if (!worker || worker->pool_ != self) {
+    size_t index = atomic_fetch_add(&(self->next_worker_), 1);
+    worker = self->workers_ + index % self->thread_count_;
+  }
+  PushTasks(self, worker, &task, 1);
+}
+
+void ThreadPoolAddTasks(ThreadPool* self, ThreadTask** tasks, size_t count) {
+  size_t thread;
+  size_t offset = 0;
   if (atomic_load(&(self->shutdown_))) {
     return;
   }
-  PushTask(self, task);
+  for (thread = 0; thread < self->thread_count_; ++thread) {
+    size_t share = count / self->thread_count_ +
+                   (thread < count % self->thread_count_ ? 1 : 0);
+    if (share) {
+      PushTasks(self, self->workers_ + thread, tasks + offset, share);
+      offset += share;
+    }
+  }
+  assert(offset == count);
+}
+
+void ThreadPoolWait(ThreadPool* self) {
+  pthread_mutex_lock(&(self->park_mutex_));
+  while (atomic_load(&(self->active_count_)))
+    pthread_cond_wait(&(self->idle_condvar_), &(self->park_mutex_));
+  pthread_mutex_unlock(&(self->park_mutex_));
+}
+
+size_t ThreadPoolWorkerIndex(const ThreadPool* self) {
+  assert(current_worker && current_worker->pool_ == self);
+  return current_worker->index_;
+}
+
+typedef struct RunOnWorkersJob {
+  ThreadPool* pool;
+  void (*func)(void*, size_t);
+  void* data;
+  pthread_barrier_t barrier;
+} RunOnWorkersJob;
+
+// Workers stay in here until every one of them has taken a task, so
+// no worker can run two of them.
+void RunOnWorkersTask(void* in) {
+  RunOnWorkersJob* job = in;
+  pthread_barrier_wait(&(job->barrier));
+  job->func(job->data, ThreadPoolWorkerIndex(job->pool));
+}
+
+void ThreadPoolRunOnWorkers(ThreadPool* self,
+                            void (*func)(void* data, size_t worker),
+                            void* data) {
+  RunOnWorkersJob job;
+  ThreadTask* tasks = malloc(self->thread_count_ * sizeof(ThreadTask));
+  ThreadTask** task_pointers =
+      malloc(self->thread_count_ * sizeof(ThreadTask*));
+  size_t i;
+  assert(tasks && task_pointers);
+  assert(!current_worker && !atomic_load(&(self->active_count_)));
+  job.pool = self;
+  job.func = func;
+  job.data = data;
+  pthread_barrier_init(&(job.barrier), NULL, self->thread_count_);
+  for (i = 0; i < self->thread_count_; ++i) {
+    ThreadPoolCreateTask(tasks + i, &job, RunOnWorkersTask);
+    task_pointers[i] = tasks + i;
+  }
+  ThreadPoolAddTasks(self, task_pointers, self->thread_count_);
+  ThreadPoolWait(self);
+  pthread_barrier_destroy(&(job.barrier));
+  free(tasks);
+  free(task_pointers);
 }
 
 void ThreadPoolJoin(ThreadPool* self) {
   int i;
   for (i = 0; i < self->thread_count_; ++i) {
-    pthread_join(self->threads_[i], NULL);
+    pthread_join(self->workers_[i].thread_, NULL);
   }
   atomic_store(&(self->done_), 1);
 }
+
+void ThreadPoolGetMetrics(const ThreadPool* self, size_t worker,
+                          WorkerMetrics* metrics) {
+  const WorkerCounters* counters = &(self->workers_[worker].counters_);
+  metrics->tasks = MetricsRead(&(counters->tasks));
+  metrics->steals = MetricsRead(&(counters->steals));
+  metrics->streams = MetricsRead(&(counters->streams));
+  metrics->busy = MetricsRead(&(counters->busy)) / 1.0e9;
+  metrics->idle = MetricsRead(&(counters->idle)) / 1.0e9;
+  metrics->lock_wait = MetricsRead(&(counters->lock_wait)) / 1.0e9;
+}
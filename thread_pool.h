@@ -1,19 +1,46 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
 #include <pthread.h>
 #include <stdatomic.h>
+#include <stddef.h>
 
-#include "queue.h"
+struct ThreadPoolWorker;
 
 typedef struct {
   size_t thread_count_;
-  pthread_t* threads_;
+  struct ThreadPoolWorker* workers_;
   atomic_int shutdown_;
   atomic_int done_;
-  Queue queue_;
-  size_t task_count_;
-  pthread_mutex_t queue_mutex_;
-  pthread_cond_t queue_condvar_;
+  // Tasks sitting in the worker deques.
+  atomic_size_t queued_count_;
+  // Tasks that were added and have not finished yet, including
+  // the ones that are currently running.
+  atomic_size_t active_count_;
+  // Workers that are parked waiting for new tasks.
+  atomic_size_t sleeping_count_;
+  // Round-robin cursor for tasks added from outside the pool.
+  atomic_size_t next_worker_;
+  pthread_mutex_t park_mutex_;
+  pthread_cond_t park_condvar_;
+  pthread_cond_t idle_condvar_;
 } ThreadPool;
 
+// What one worker has done since the pool was created, see metrics.h.
+// All zero in a build with -DSALESMAN_NO_METRICS.
+typedef struct WorkerMetrics {
+  size_t tasks;
+  // Tasks taken from other workers.
+  size_t steals;
+  // Random streams started by the tasks.
+  size_t streams;
+  // Seconds running tasks, parked with nothing to do and waiting for
+  // the locks of the task deques.
+  double busy;
+  double idle;
+  double lock_wait;
+} WorkerMetrics;
+
 typedef struct ThreadTask {
   void* data;
   atomic_int pending_;
@@ -26,10 +53,13 @@ void ThreadPoolInit(ThreadPool* self, size_t thread_count);
 
 void ThreadPoolDestroy(ThreadPool* self);
 
-// Start processing tasks.
+// Start the worker threads. They keep waiting for new tasks
+// until the pool is shut down, so one pool can serve any number
+// of batches.
 void ThreadPoolStart(ThreadPool* self);
 
 // Shut the pool down and stop accepting new tasks.
+// Tasks that are already queued are still processed.
 void ThreadPoolShutdown(ThreadPool* self);
 
 // Reset the pool after it has been joined to reuse it.
@@ -48,8 +78,40 @@ void ThreadPoolCreateTask(ThreadTask* task, void* data, void (*func)(void*));
 void ThreadPoolSetDependant(ThreadTask* parent, ThreadTask* dep);
 
 // Add a task to the pool if it is still working.
-// This transfers ownership of the task to the pool.
+// The pool does not take ownership of the task: it must stay
+// alive until it has finished (see |ThreadPoolWait|), after which
+// it may be reused for another |ThreadPoolCreateTask|.
+// Called from inside a task, it goes to the calling worker's deque.
 void ThreadPoolAddTask(ThreadPool* self, ThreadTask* task);
 
+// Add |count| tasks at once, spreading them evenly over the
+// worker deques. The same lifetime rules as in |ThreadPoolAddTask|
+// apply; the |tasks| array itself may be reused right away.
+void ThreadPoolAddTasks(ThreadPool* self, ThreadTask** tasks, size_t count);
+
+// Block until every task added so far (and every dependant they
+// release) has finished. The workers stay alive afterwards, so this
+// is the barrier between two batches of tasks.
+void ThreadPoolWait(ThreadPool* self);
+
+// Index of the worker running the calling task, in
+// [0, thread_count). Lets tasks use per-worker resources without
+// locking. Must be called from inside a task of this pool.
+size_t ThreadPoolWorkerIndex(const ThreadPool* self);
+
+// Run |func| once on every worker thread, with the index of the
+// worker, and block until all of them are done. Lets the workers pin
+// themselves or first touch their own memory. Must not be called from
+// inside a task, nor while tasks are queued.
+void ThreadPoolRunOnWorkers(ThreadPool* self,
+                            void (*func)(void* data, size_t worker),
+                            void* data);
+
+// Read the counters of |worker|, which may be running.
+void ThreadPoolGetMetrics(const ThreadPool* self, size_t worker,
+                          WorkerMetrics* metrics);
+
 // Wait for all the threads to stop.
-void ThreadPoolJoin(ThreadPool* self);
\ No newline at end of file
+void ThreadPoolJoin(ThreadPool* self);
+
+#endif
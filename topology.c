@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include "topology.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kNodeDirectory "/sys/devices/system/node"
+// Nodes looked for, they may be numbered with gaps.
+const int kMaxNodes = 1024;
+
+// Add the CPUs of |list|, like "0-3,8,10-11", that are in |allowed|
+// and not taken yet, to |self| as |node|.
+static void TopologyAddList(Topology* self, const char* list,
+                            const cpu_set_t* allowed, cpu_set_t* taken,
+                            size_t node) {
+  while (*list && *list != '\n') {
+    char* end;
+    long first = strtol(list, &end, 10);
+    long last = first;
+    long cpu;
+    if (end == list)
+      return;
+    if (*end == '-')
+      last = strtol(end + 1, &end, 10);
+    for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+      if (!CPU_ISSET(cpu, allowed) || CPU_ISSET(cpu, taken))
+        continue;
+      CPU_SET(cpu, taken);
+      self->cpus[self->cpu_count] = cpu;
+      self->nodes[self->cpu_count] = node;
+      ++self->cpu_count;
+    }
+    list = *end == ',' ? end + 1 : end;
+  }
+}
+
+int TopologyInit(Topology* self) {
+  cpu_set_t allowed;
+  cpu_set_t taken;
+  char path[64];
+  char list[4096];
+  int node;
+  int cpu;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    perror("cannot read the CPU affinity");
+    return -1;
+  }
+  CPU_ZERO(&taken);
+  self->cpu_count = 0;
+  self->node_count = 0;
+  self->cpus = malloc(CPU_COUNT(&allowed) * sizeof(int));
+  self->nodes = malloc(CPU_COUNT(&allowed) * sizeof(size_t));
+  assert(self->cpus && self->nodes);
+  for (node = 0; node < kMaxNodes; ++node) {
+    FILE* file;
+    size_t count = self->cpu_count;
+    snprintf(path, sizeof(path), kNodeDirectory "/node%d/cpulist", node);
+    file = fopen(path, "r");
+    if (!file)
+      continue;
+    if (fgets(list, sizeof(list), file))
+      TopologyAddList(self, list, &allowed, &taken, self->node_count);
+    fclose(file);
+    // Memory only nodes have no CPUs to place workers on.
+    if (self->cpu_count > count)
+      ++self->node_count;
+  }
+  // Whatever sysfs did not list makes one more node.
+  for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed) && !CPU_ISSET(cpu, &taken)) {
+      self->cpus[self->cpu_count] = cpu;
+      self->nodes[self->cpu_count] = self->node_count;
+      ++self->cpu_count;
+    }
+  }
+  if (self->cpu_count && self->nodes[self->cpu_count - 1] == self->node_count)
+    ++self->node_count;
+  if (!self->cpu_count) {
+    fprintf(stderr, "no CPUs to run on\n");
+    TopologyDestroy(self);
+    return -1;
+  }
+  return 0;
+}
+
+void TopologyDestroy(Topology* self) {
+  free(self->cpus);
+  free(self->nodes);
+}
+
+int TopologyPin(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set)) {
+    fprintf(stderr, "cannot pin a thread to CPU %d\n", cpu);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+
+// The CPUs this process may run on, grouped by NUMA node, as listed
+// in /sys/devices/system/node. Machines without NUMA, or without that
+// directory, show up as a single node.
+typedef struct Topology {
+  size_t cpu_count;
+  // CPU numbers, the ones of the first node first.
+  int* cpus;
+  // Node of every entry of |cpus|, numbered from 0 in order.
+  size_t* nodes;
+  size_t node_count;
+} Topology;
+
+// Returns 0, or -1 after printing what went wrong to stderr.
+int TopologyInit(Topology* self);
+void TopologyDestroy(Topology* self);
+
+// Pin the calling thread to |cpu|. Returns 0, or -1 after printing
+// what went wrong to stderr.
+int TopologyPin(int cpu);
+
+#endif
@@ -0,0 +1,91 @@
+#include "tour_set.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keys of empty slots. A tour that hashes to it is stored as 1.
+const uint64_t kTourSetEmpty = 0;
+
+uint64_t TourHash(const City* tour, size_t length) {
+  uint64_t hash = TourEdgeKey(tour[length - 1], tour[0]);
+  size_t i;
+  for (i = 1; i < length; ++i)
+    hash ^= TourEdgeKey(tour[i - 1], tour[i]);
+  return hash;
+}
+
+void TourSetInit(TourSet* self, size_t count) {
+  memset(self, 0, sizeof(TourSet));
+  TourSetReserve(self, count);
+}
+
+void TourSetDestroy(TourSet* self) {
+  free(self->keys_);
+  free(self->indices_);
+}
+
+void TourSetReserve(TourSet* self, size_t count) {
+  size_t capacity = 16;
+  while (capacity < 2 * count)
+    capacity *= 2;
+  if (capacity > self->capacity_) {
+    free(self->keys_);
+    free(self->indices_);
+    self->keys_ = malloc(capacity * sizeof(uint64_t));
+    self->indices_ = malloc(capacity * sizeof(size_t));
+    assert(self->keys_ && self->indices_);
+    self->capacity_ = capacity;
+  }
+  TourSetClear(self);
+}
+
+void TourSetClear(TourSet* self) {
+  TourSetClearSlice(self, 0, 1);
+}
+
+void TourSetClearSlice(TourSet* self, size_t slice, size_t slice_count) {
+  size_t end = (slice + 1) * self->capacity_ / slice_count;
+  size_t i;
+  for (i = slice * self->capacity_ / slice_count; i < end; ++i) {
+    atomic_store_explicit(self->keys_ + i, kTourSetEmpty,
+                          memory_order_relaxed);
+    atomic_store_explicit(self->indices_ + i, SIZE_MAX,
+                          memory_order_relaxed);
+  }
+}
+
+void TourSetAdd(TourSet* self, uint64_t hash, size_t index) {
+  size_t mask = self->capacity_ - 1;
+  size_t slot;
+  size_t first;
+  if (hash == kTourSetEmpty)
+    hash = 1;
+  for (slot = hash & mask;; slot = (slot + 1) & mask) {
+    uint64_t key = atomic_load(self->keys_ + slot);
+    if (key == kTourSetEmpty &&
+        atomic_compare_exchange_strong(self->keys_ + slot, &key, hash))
+      key = hash;
+    // A lost race leaves the winner's key in |key|.
+    if (key == hash)
+      break;
+  }
+  first = atomic_load(self->indices_ + slot);
+  while (index < first &&
+         !atomic_compare_exchange_weak(self->indices_ + slot, &first, index)) {
+  }
+}
+
+size_t TourSetFirst(const TourSet* self, uint64_t hash) {
+  size_t mask = self->capacity_ - 1;
+  size_t slot;
+  if (hash == kTourSetEmpty)
+    hash = 1;
+  for (slot = hash & mask;; slot = (slot + 1) & mask) {
+    uint64_t key = atomic_load(self->keys_ + slot);
+    if (key == hash)
+      return atomic_load(self->indices_ + slot);
+    if (key == kTourSetEmpty)
+      return SIZE_MAX;
+  }
+}
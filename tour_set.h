@@ -0,0 +1,53 @@
+#ifndef TOUR_SET_H
+#define TOUR_SET_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "population.h"
+
+// Random key of the edge between |a| and |b|, either way round.
+static inline uint64_t TourEdgeKey(City a, City b) {
+  uint64_t x = a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+  x += 0x9e3779b97f4a7c15u;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+  return x ^ (x >> 31);
+}
+
+// Zobrist hash of a tour as a cycle: the XOR of the keys of its
+// edges. Every rotation of a tour and its reverse hash the same, and
+// an operator that swaps edge (a, b) for (c, d) can roll the hash
+// along with TourEdgeKey(a, b) ^ TourEdgeKey(c, d).
+uint64_t TourHash(const City* tour, size_t length);
+
+// Lock-free set of the tour hashes of one generation, keeping the
+// lowest index of a tour added with every hash. Open addressing with
+// linear probing over at least twice as many slots as tours.
+typedef struct TourSet {
+  _Atomic uint64_t* keys_;
+  atomic_size_t* indices_;
+  size_t capacity_;
+} TourSet;
+
+// A zeroed set may be reserved without |TourSetInit|.
+void TourSetInit(TourSet* self, size_t count);
+void TourSetDestroy(TourSet* self);
+
+// Make room for |count| tours, and empty the set.
+void TourSetReserve(TourSet* self, size_t count);
+// Empty the set. Must not race with |TourSetAdd|.
+void TourSetClear(TourSet* self);
+// Empty slice |slice| of |slice_count| of the slots; the slices may
+// be emptied in parallel, but not while the set is being used.
+void TourSetClearSlice(TourSet* self, size_t slice, size_t slice_count);
+
+// Add tour |index| with |hash|. Safe to call from any number of
+// threads at once.
+void TourSetAdd(TourSet* self, uint64_t hash, size_t index);
+
+// The lowest index added with |hash|, SIZE_MAX if there is none.
+size_t TourSetFirst(const TourSet* self, uint64_t hash);
+
+#endif